@@ -32,6 +32,7 @@ from qudi.util.helpers import natural_sort
 from qudi.util.datastorage import get_timestamp_filename
 from qudi.util.datastorage import TextDataStorage, CsvDataStorage, NpyDataStorage
 from qudi.util.colordefs import QudiPalettePale as palette
+from qudi.util.shared_array import SharedArrayReader
 from qudi.util.widgets.fitting import FitConfigurationDialog
 from qudi.core.module import GuiBase
 from qudi.util import uic
@@ -166,6 +167,11 @@ class PulsedMeasurementGui(GuiBase):
 
     def __init__(self, config, **kwargs):
         super().__init__(config=config, **kwargs)
+        # mapping of the shared memory segment of the logic, see _get_measurement_data
+        self._shared_data_reader = None
+        self._shared_data_version = -1
+        self._shared_data = None
+        self._shared_data_unavailable = False
 
     def on_activate(self):
         """ Initialize, connect and configure the pulsed measurement GUI.
@@ -270,6 +276,13 @@ class PulsedMeasurementGui(GuiBase):
         self._disconnect_dialog_signals()
         self._disconnect_logic_signals()
 
+        if self._shared_data_reader is not None:
+            self._shared_data_reader.close()
+            self._shared_data_reader = None
+        self._shared_data = None
+        self._shared_data_version = -1
+        self._shared_data_unavailable = False
+
         self.sigPulseGeneratorSettingsUpdated.disconnect()
         self.sigPulseGeneratorRunBenchmark.disconnect()
 
@@ -2417,15 +2430,50 @@ class PulsedMeasurementGui(GuiBase):
         self._pa.ana_param_fc_bins_ComboBox.blockSignals(False)
         return
 
+    def _get_measurement_data(self, *names):
+        """ Get measurement data arrays of the logic. If the logic publishes them into shared
+        memory (config option shared_memory_transport), the segment is mapped and only read if its
+        version changed. Otherwise each array is fetched from the logic, i.e. serialized if the
+        logic is a remote module.
+
+        @param str names: names of the arrays, e.g. 'signal_data' or 'raw_data'
+
+        @return list: the arrays in the order of names
+        """
+        reader = self._shared_data_reader
+        if not self._shared_data_unavailable and (reader is None or reader.closed):
+            if reader is not None:
+                reader.close()
+            self._shared_data_reader = reader = None
+            self._shared_data_version = -1
+            name = self.pulsedmasterlogic().shared_data_name
+            if name is not None:
+                try:
+                    self._shared_data_reader = reader = SharedArrayReader(name)
+                except (OSError, ValueError):
+                    # e.g. the logic runs on another computer
+                    self.log.warning('Unable to map the shared memory segment "{0}" of the pulsed '
+                                     'measurement data. Fetching the data from the logic '
+                                     'instead.'.format(name))
+                    self._shared_data_unavailable = True
+        if reader is not None:
+            if reader.version != self._shared_data_version:
+                version, arrays = reader.read()
+                if arrays is not None:
+                    self._shared_data_version = version
+                    self._shared_data = arrays
+            if self._shared_data is not None:
+                return [self._shared_data[name] for name in names]
+        return [getattr(self.pulsedmasterlogic(), name) for name in names]
+
     @QtCore.Slot()
     def measurement_data_updated(self):
         """
 
         @return:
         """
-        signal_data = self.pulsedmasterlogic().signal_data
-        signal_alt_data = self.pulsedmasterlogic().signal_alt_data
-        measurement_error = self.pulsedmasterlogic().measurement_error
+        signal_data, signal_alt_data, measurement_error = self._get_measurement_data(
+            'signal_data', 'signal_alt_data', 'measurement_error')
 
         # Adjust number of data sets to plot
         self.set_plot_dimensions()
@@ -3165,22 +3213,24 @@ class PulsedMeasurementGui(GuiBase):
         """
         laser_index = self._pe.laserpulses_ComboBox.currentIndex()
         show_raw = self._pe.laserpulses_display_raw_CheckBox.isChecked()
-        is_gated = len(self.pulsedmasterlogic().raw_data.shape) > 1
 
         # Determine the right array to plot as y-data
         if show_raw:
+            raw_data, = self._get_measurement_data('raw_data')
+            is_gated = len(raw_data.shape) > 1
             if is_gated:
                 if laser_index == 0:
-                    y_data = np.sum(self.pulsedmasterlogic().raw_data, axis=0)
+                    y_data = np.sum(raw_data, axis=0)
                 else:
-                    y_data = self.pulsedmasterlogic().raw_data[laser_index - 1]
+                    y_data = raw_data[laser_index - 1]
             else:
-                y_data = self.pulsedmasterlogic().raw_data
+                y_data = raw_data
         else:
+            laser_data, = self._get_measurement_data('laser_data')
             if laser_index == 0:
-                y_data = np.sum(self.pulsedmasterlogic().laser_data, axis=0)
+                y_data = np.sum(laser_data, axis=0)
             else:
-                y_data = self.pulsedmasterlogic().laser_data[laser_index - 1]
+                y_data = laser_data[laser_index - 1]
 
         # Calculate the x-axis of the laser plot here
         bin_width = self.pulsedmasterlogic().fast_counter_settings['bin_width']
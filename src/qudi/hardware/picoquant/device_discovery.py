@@ -0,0 +1,92 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains helpers for a fast activation of PicoQuant devices: the programming libraries
+are loaded once per process and the device index of a serial number is remembered, so the device
+indices do not have to be probed one by one on every activation.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import ctypes
+import threading
+
+__all__ = ['load_library', 'open_device']
+
+_libraries = dict()
+_libraries_lock = threading.Lock()
+
+
+def load_library(name, loader=None):
+    """ Load a programming library once per process and return the cached handle afterwards.
+
+    @param str name: name or path of the library, e.g. 'phlib64'
+    @param object loader: optional, ctypes library loader (default: ctypes.cdll)
+
+    @return ctypes.CDLL: the library handle
+    """
+    if loader is None:
+        loader = ctypes.cdll
+    with _libraries_lock:
+        library = _libraries.get(name)
+        if library is None:
+            library = loader.LoadLibrary(name)
+            _libraries[name] = library
+        return library
+
+
+def open_device(open_func, close_func, device_index, serial=None, index_cache=None,
+                max_devices=8):
+    """ Open the device with the given serial number, trying the most likely indices first.
+
+    @param callable open_func: function taking a device index, opening the device and returning a
+                               tuple (error code, serial number string)
+    @param callable close_func: function taking a device index and closing the device
+    @param int device_index: configured device index, used if no serial number is given
+    @param str serial: optional, serial number of the device to open
+    @param dict index_cache: optional, serial number to device index of previous activations. It is
+                             updated with the opened device.
+    @param int max_devices: number of device indices supported by the library
+
+    @return tuple(int, str): index and serial number of the opened device, (-1, '') if no matching
+                             device could be opened
+
+    Without a serial number, only the configured index is opened, so a module never takes over
+    a device of another module by accident. With a serial number, the cached index of that serial
+    number and the configured index are tried before all other indices. Devices opened while
+    probing are closed again.
+    """
+    if index_cache is None:
+        index_cache = dict()
+    candidates = list()
+    if serial:
+        serial = str(serial)
+        if serial in index_cache:
+            candidates.append(int(index_cache[serial]))
+    candidates.append(int(device_index))
+    if serial:
+        candidates.extend(index for index in range(max_devices) if index not in candidates)
+
+    for index in candidates:
+        ret, device_serial = open_func(index)
+        if ret < 0:
+            continue
+        if serial and device_serial != serial:
+            close_func(index)
+            continue
+        index_cache[device_serial] = index
+        return index, device_serial
+    return -1, ''
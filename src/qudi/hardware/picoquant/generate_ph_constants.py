@@ -0,0 +1,103 @@
+# -*- coding: utf-8 -*-
+"""
+This file generates the module ph_constants.py from the PicoHarp300 library headers 'phdefin.h'
+and 'errorcodes.h' located next to it. Rerun it whenever the headers are updated:
+
+    python -m qudi.hardware.picoquant.generate_ph_constants
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import os
+import re
+
+__all__ = ['parse_defines', 'generate']
+
+_DEFINE_PATTERN = re.compile(r'^\s*#define\s+(\w+)\s+("[^"]*"|[-+]?(?:0x[0-9A-Fa-f]+|\d+))')
+
+_MODULE_HEADER = '''# -*- coding: utf-8 -*-
+"""
+This file contains the constants of the PicoHarp300 library (PHLib) defined in the header files
+'phdefin.h' and 'errorcodes.h'.
+
+THIS FILE IS GENERATED BY generate_ph_constants.py, DO NOT EDIT IT BY HAND.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+'''
+
+
+def parse_defines(file_path):
+    """ Extract the numerical and string #defines of a C header file.
+
+    @param str file_path: path of the header file
+
+    @return list: (name, value literal) tuples in the order of the file
+    """
+    defines = list()
+    with open(file_path) as file:
+        for line in file:
+            match = _DEFINE_PATTERN.match(line)
+            if match is not None:
+                defines.append(match.groups())
+    return defines
+
+
+def generate(header_dir=None, output_path=None):
+    """ Write ph_constants.py from phdefin.h and errorcodes.h.
+
+    @param str header_dir: optional, directory of the header files (default: this directory)
+    @param str output_path: optional, path of the generated module (default: ph_constants.py in
+                            this directory)
+    """
+    if header_dir is None:
+        header_dir = os.path.dirname(os.path.abspath(__file__))
+    if output_path is None:
+        output_path = os.path.join(header_dir, 'ph_constants.py')
+
+    lines = [_MODULE_HEADER, '', '# phdefin.h']
+    lines.extend('{0} = {1}'.format(name, value)
+                 for name, value in parse_defines(os.path.join(header_dir, 'phdefin.h')))
+
+    error_codes = parse_defines(os.path.join(header_dir, 'errorcodes.h'))
+    lines.extend(['', '# errorcodes.h'])
+    lines.extend('{0} = {1}'.format(name, value) for name, value in error_codes)
+    lines.extend(['', '# error code value to name, as used for error messages',
+                  'ERROR_CODES = {'])
+    lines.extend('    {0}: {1!r},'.format(value, name) for name, value in error_codes)
+    lines.append('}')
+
+    with open(output_path, 'w') as file:
+        file.write('\n'.join(lines) + '\n')
+
+
+if __name__ == '__main__':
+    generate()
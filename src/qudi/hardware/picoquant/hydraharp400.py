@@ -24,7 +24,12 @@ import ctypes
 import numpy as np
 
 from qudi.core.configoption import ConfigOption
+from qudi.core.statusvariable import StatusVar
 from qudi.interface.fast_counter_interface import FastCounterInterface
+from qudi.hardware.picoquant.device_discovery import load_library, open_device
+from qudi.hardware.picoquant.tttr_decoder import HydraHarpT3Decoder
+from qudi.hardware.picoquant.tttr_acquisition import TTTRBlockRing, TTTRReaderThread
+from qudi.hardware.picoquant.tttr_histogram import TTTRHistogram, IncrementalHistogram
 
 # =============================================================================
 # Wrapper around the HHLib64.DLL. The current file is based on the header files
@@ -36,7 +41,6 @@ from qudi.interface.fast_counter_interface import FastCounterInterface
 # information read the manual
 #       'HHLib - Programming Library for Custom Software Development'
 # which can be downloaded from the PicoQuant homepage.
-# TODO GATED mode
 # =============================================================================
 """
 The PicoHarp programming library HHLib.DLL is written in C and its data types
@@ -64,13 +68,22 @@ class HydraHarp400(FastCounterInterface):
     fastcounter_hydraharp400:
         module.Class: 'picoquant.hydraharp400.hydraharp400.HydraHarp400'
         deviceID: 0 # a device index from 0 to 7.
+        serial: None # optional, serial number of the device, takes precedence over deviceID. Only with a serial number other device IDs are searched
+        calibration_validity: 0 # optional, time in s a calibration stays valid over restarts (0: always calibrate)
         mode: 0 # 0: histogram mode, 2: T2 mode, 3: T3 mode, 8: continuous mode
-        
+        gated: False # if True, the device runs in T3 mode and every marker record starts the next gate
+        gate_marker_mask: 0b1111 # optional, bit mask of the marker inputs starting a new gate
+        fifo_ring_blocks: 32 # optional, number of TTREADMAX blocks buffered between FIFO reader and analysis
+        return_uint32: False # optional, if True the ungated time trace is returned as uint32 without copy, it is overwritten by the next poll
+        incremental_readout: False # optional, if True the histogram memory is cleared on each read and accumulated on the host
+
     """
     _modclass = 'HydraHarp400'
     _modtype = 'hardware'
 
     _deviceID = ConfigOption('deviceID', 0, missing='warn') # a device index from 0 to 7.
+    _device_serial = ConfigOption('serial', None)
+    _calibration_validity = ConfigOption('calibration_validity', 0)
     _mode = ConfigOption('mode', 0, missing='warn')
     _refsource = ConfigOption('refsource', 0, missing='warn')
 
@@ -78,6 +91,15 @@ class HydraHarp400(FastCounterInterface):
     trigger_safety = ConfigOption('trigger_safety', 400e-9, missing='warn')
     aom_delay = ConfigOption('aom_delay', 390e-9, missing='warn')
     minimal_binwidth = ConfigOption('minimal_binwidth', 1e-12, missing='warn')
+    _gate_marker_mask = ConfigOption('gate_marker_mask', 0b1111)
+    _fifo_ring_blocks = ConfigOption('fifo_ring_blocks', 32)
+    _return_uint32 = ConfigOption('return_uint32', False)
+    _incremental_readout = ConfigOption('incremental_readout', False)
+
+    # serial number to device index and time of the last calibration of the
+    # devices seen in previous activations:
+    _device_index_cache = StatusVar('device_index_cache', default=dict())
+    _calibration_times = StatusVar('calibration_times', default=dict())
 
     def __init__(self, config, **kwargs):
         super().__init__(config=config, **kwargs)
@@ -93,43 +115,104 @@ class HydraHarp400(FastCounterInterface):
         self.stopped_or_halt = "stopped"
         self.bins_num = 0
 
+        # persistent buffers for the ungated histogram, (re)allocated if the
+        # number of bins changes:
+        self._histogram_buffer = np.zeros(0, dtype=np.uint32)
+        self._histogram_pointer = None
+        self._incremental_histogram = IncrementalHistogram(0)
+
+        # the elapsed measurement time is tracked on the host, so polling the
+        # data does not need an additional library call:
+        self._meas_start_time = None
+        self._elapsed_time_offset = 0.0
+
+        # gated mode: T3 records are read by a separate thread and binned into
+        # a histogram per gate on the host.
+        self._decoder = None
+        self._histogram = None
+        self._fifo_ring = None
+        self._reader_thread = None
+        self._fifo_num_counts = ctypes.c_int()
+        self._fifo_num_counts_ref = ctypes.byref(self._fifo_num_counts)
+        self._hh_read_fifo = None
+
     def on_activate(self):
         """ Initialisation performed during activation of the module.
         """
 
-        self.dll = ctypes.windll.LoadLibrary('C:\Windows\System32\hhlib64.dll')
-        serial = ctypes.create_string_buffer(8)
-        dev=[]
-        # Check the availability of the configured Pico Quant device
-        op = self.dll.HH_OpenDevice(ctypes.c_int(self._deviceID), serial)
-        if op == 0:
-            ini = self.dll.HH_Initialize(ctypes.c_int(self._deviceID), ctypes.c_int(self._mode), ctypes.c_int(self._refsource))
-        else:
-            # search available Pico Quant device
-            # unplug or replug of PQ device, could change the device ID
-            self.log.warn('Fastcounter: Cannot find configured HydraHarp400. \nSearching available HydraHarp400...')
-            for i in range(0, 8):
-                op = self.dll.HH_OpenDevice(ctypes.c_int(i), serial)
-                if op == 0:
-                    dev.append(i)
-            # Use the first Pico Quant device as fastcounter
-            self.log.info('Using the first Pico Quant device of the searching list as the fastcounter. \ndeviceID: {0}'.format(dev[0]))
-            self._deviceID = dev[0]
-            ini = self.dll.HH_Initialize(ctypes.c_int(self._deviceID), ctypes.c_int(self._mode), ctypes.c_int(self._refsource))
+        # the library is loaded once per process:
+        self.dll = load_library('C:\Windows\System32\hhlib64.dll', loader=ctypes.windll)
+        # The reader thread calls HH_ReadFiFo through a private, prototyped function pointer
+        # (item access does not change self.dll.HH_ReadFiFo), so the buffer address is passed
+        # as a full pointer instead of a truncated C int:
+        self._hh_read_fifo = self.dll['HH_ReadFiFo']
+        self._hh_read_fifo.argtypes = (ctypes.c_int, ctypes.POINTER(ctypes.c_uint32),
+                                       ctypes.c_int, ctypes.POINTER(ctypes.c_int))
+        self._hh_read_fifo.restype = ctypes.c_int
+        # the gates are assigned from the marker records, which are only
+        # available in T3 mode:
+        if self.gated:
+            self._mode = self.MODE_T3
+
+        def open_func(index):
+            serial = ctypes.create_string_buffer(8)
+            return self.dll.HH_OpenDevice(ctypes.c_int(index), serial), serial.value.decode()
+
+        # Open the configured Pico Quant device. Unplugging or replugging a PQ
+        # device can change the device ID, so with a configured serial number
+        # the other IDs are searched if it is not found (starting with the one
+        # the serial number had last time).
+        index_cache = dict(self._device_index_cache)
+        index, serial = open_device(open_func=open_func,
+                                    close_func=lambda i: self.dll.HH_CloseDevice(ctypes.c_int(i)),
+                                    device_index=self._deviceID,
+                                    serial=self._device_serial,
+                                    index_cache=index_cache)
+        if index < 0:
+            self.log.error('Fastcounter: Could not open the Pico Quant device {0}.'.format(
+                'with deviceID {0}'.format(self._deviceID) if not self._device_serial else
+                'with serial number {0}'.format(self._device_serial)))
+            return
+        if index != self._deviceID:
+            self.log.info('Using the Pico Quant device with deviceID {0} (serial number {1}) as '
+                          'the fastcounter.'.format(index, serial))
+        self._deviceID = index
+        self._device_index_cache = index_cache
+
+        ini = self.dll.HH_Initialize(ctypes.c_int(self._deviceID), ctypes.c_int(self._mode), ctypes.c_int(self._refsource))
         if ini == 0:
-            cal = self.dll.HH_Calibrate(self._deviceID)
+            last_calibration = self._calibration_times.get(serial)
+            if self._calibration_validity > 0 and last_calibration is not None and \
+                    time.time() - last_calibration < self._calibration_validity:
+                self.log.debug('Skipping the calibration of the HydraHarp400, the last one is '
+                               'still valid.')
+                cal = 0
+            else:
+                cal = self.dll.HH_Calibrate(self._deviceID)
+                if cal == 0:
+                    calibration_times = dict(self._calibration_times)
+                    calibration_times[serial] = time.time()
+                    self._calibration_times = calibration_times
             if cal == 0:
                 self.connected_to_device = True
+                if self.gated:
+                    self._fifo_ring = TTTRBlockRing(block_count=self._fifo_ring_blocks,
+                                                    block_size=self.TTREADMAX)
+                    self._reader_thread = TTTRReaderThread(read_fifo=self._read_fifo_into,
+                                                           ring=self._fifo_ring)
                 self.log.info('Calibration of HydraHarp400 is finished.')
                 return
             else:
                 self.log.warn('Fastcounter: Calibration of HydraHarp400 failed.')
         else:
-            self.log.error('Fastcounter: Could not find any Pico Quant device.')
+            self.log.error('Fastcounter: Initialization of HydraHarp400 failed.')
 
     def on_deactivate(self):
         """ Deinitialisation performed during deactivation of the module.
         """
+        self._stop_reader_thread()
+        self._reader_thread = None
+        self._fifo_ring = None
         self.dll.HH_CloseDevice(ctypes.c_int(self._deviceID))
         self.log.info('HydraHarp400 closed.')
         return
@@ -224,37 +307,142 @@ class HydraHarp400(FastCounterInterface):
             if self.gated:
                 # add time to account for AOM delay
                 new_record_length_s = int((record_length_HydraHarp_s + self.aom_delay) / bin_width_s)
+                self._configure_gated_histogram(new_record_length_s, number_of_gates)
             else:
                 # subtract time to make sure no sequence trigger is missed
                 new_record_length_s = int((record_length_HydraHarp_s - self.trigger_safety) / bin_width_s)
-            self.set_length(new_record_length_s)
-            # self.set_cycles(number_of_gates)
+                self.set_length(new_record_length_s)
 
             return self.get_binwidth(), self.get_length() * self.get_binwidth(), number_of_gates
 
+    def _configure_gated_histogram(self, length_bins, number_of_gates):
+        """ Set up the host side histogram of the gated T3 mode.
+
+        @param int length_bins: length of each gate in bins
+        @param int number_of_gates: number of gates in the pulse sequence
+
+        The 15 bit start-stop time of the T3 records limits the length of
+        each gate to 32768 bins of the current resolution.
+        """
+        if length_bins > 32768:
+            self.log.warn('Fastcounter: {0} bins per gate exceed the T3 start-stop time range, '
+                          'the gates are truncated to 32768 bins.'.format(length_bins))
+        self.bins_num = max(1, min(int(length_bins), 32768))
+        self._decoder = HydraHarpT3Decoder()
+        self._histogram = TTTRHistogram(bin_count=self.bins_num,
+                                        number_of_gates=max(1, int(number_of_gates)),
+                                        gate_marker_mask=self._gate_marker_mask)
+
     def start_measure(self):
         """Start the measurement. """
+        if self.gated:
+            if self._histogram is None:
+                self.log.error('Fastcounter: The gated HydraHarp400 has to be configured before '
+                               'a measurement can be started.')
+                return -1
+            self._decoder.reset()
+            self._histogram.reset()
+            self._fifo_ring.reset()
+            self._elapsed_time_offset = 0.0
+            status = self.tryfunc(self.dll.HH_StartMeas(self._deviceID, self.ACQTMAX), "StartMeas")
+            if status == 0:
+                self._meas_start_time = time.perf_counter()
+                self._reader_thread.start()
+            return status
         self.dll.HH_ClearHistMem(self._deviceID)
+        self._incremental_histogram.reset()
+        self._elapsed_time_offset = 0.0
         status = self.dll.HH_StartMeas(self._deviceID, 360000) # t is aquisition time, can set ACQTMAX as default
+        if status == 0:
+            self._meas_start_time = time.perf_counter()
         return status
 
     def stop_measure(self):
         """Stop the measurement. """
         self.stopped_or_halt = "stopped"
+        self._stop_reader_thread()
         status = self.dll.HH_StopMeas(self._deviceID)
+        self._hold_elapsed_time()
         return status
 
     def pause_measure(self):
         """Make a pause in the measurement, which can be continued. """
         self.stopped_or_halt = "halt"
+        self._stop_reader_thread()
         status = self.dll.HH_StopMeas(self._deviceID)
+        self._hold_elapsed_time()
+        if self.gated:
+            # bin the records read before the pause with the decoder of their run:
+            self._process_fifo_data()
         return status
 
     def continue_measure(self):
         """Continue a paused measurement. """
+        if self.gated:
+            # the records of a new T3 measurement start with a new sync
+            # counter and gate sequence, the binned counts are kept:
+            self._process_fifo_data()
+            self._fifo_ring.reset()
+            self._decoder.reset()
+            self._histogram.restart()
+            status = self.tryfunc(self.dll.HH_StartMeas(self._deviceID, self.ACQTMAX), "StartMeas")
+            if status == 0:
+                self._meas_start_time = time.perf_counter()
+                self._reader_thread.start()
+            return status
         status = self.dll.HH_StartMeas(self._deviceID, 360000)
+        if status == 0:
+            self._meas_start_time = time.perf_counter()
         return status
 
+    def _hold_elapsed_time(self):
+        """ Add the time of the current run to the elapsed measurement time. """
+        if self._meas_start_time is not None:
+            self._elapsed_time_offset += time.perf_counter() - self._meas_start_time
+            self._meas_start_time = None
+
+    def get_elapsed_time(self):
+        """ Get the elapsed measurement time tracked on the host.
+
+        @return float: elapsed time of all runs since start_measure in seconds
+        """
+        if self._meas_start_time is None:
+            return self._elapsed_time_offset
+        return self._elapsed_time_offset + time.perf_counter() - self._meas_start_time
+
+    def _stop_reader_thread(self):
+        """ Let the FIFO reader thread finish its current read and wait for it. """
+        if self._reader_thread is not None and self._reader_thread.isRunning():
+            self._reader_thread.request_stop()
+            self._reader_thread.wait()
+
+    def _read_fifo_into(self, buffer):
+        """ Read the FIFO into a given buffer. This is the read function of the
+        FIFO reader thread.
+
+        @param numpy.ndarray buffer: uint32 array with at most TTREADMAX entries.
+
+        @return int: number of records read into the buffer or the (negative)
+                     error code of the library.
+        """
+        ret = self.tryfunc(self._hh_read_fifo(self._deviceID,
+                                              buffer.ctypes.data_as(ctypes.POINTER(ctypes.c_uint32)),
+                                              min(buffer.size, self.TTREADMAX),
+                                              self._fifo_num_counts_ref), "ReadFiFo")
+        if ret < 0:
+            return ret
+        return self._fifo_num_counts.value
+
+    def _process_fifo_data(self):
+        """ Decode all blocks read by the FIFO reader thread and bin them into
+        the gated histogram.
+        """
+        records = self._fifo_ring.peek()
+        while records is not None:
+            self._histogram.add(self._decoder.decode(records))
+            self._fifo_ring.release()
+            records = self._fifo_ring.peek()
+
     def is_gated(self):
         """ Check the gated counting possibility.
 
@@ -283,23 +471,56 @@ class HydraHarp400(FastCounterInterface):
           - If the counter is gated it will return a 2D-numpy-array with
             returnarray[gate_index, timebin_index]
         @return arrray: Time trace.
-        """
-        py_counts = np.empty((self.bins_num,), dtype=np.uint32)
-        pointer = ctypes.POINTER(ctypes.c_uint32)
-        c_counts = py_counts.ctypes.data_as(pointer)
 
+        In gated mode the T3 records are assigned to the gates by the marker
+        records and binned on the host while the measurement is running, so
+        the 2D array is returned directly without any laser pulse extraction.
+        """
         if self.is_gated():
-            pass
-            # TODO implement
-        else:
-            self.tryfunc(self.dll.HH_GetHistogram(self._deviceID, c_counts, 1, 0), "GetHistogram")
-
-        time_trace = np.int64(py_counts)
+            if self._histogram is None:
+                self.log.error('Fastcounter: The gated HydraHarp400 has to be configured first.')
+                return np.zeros((0, 0), dtype=np.int64), {'elapsed_sweeps': None,
+                                                          'elapsed_time': None}
+            self._process_fifo_data()
+            info_dict = {'elapsed_sweeps': self._histogram.elapsed_sweeps,
+                         'elapsed_time': self.get_elapsed_time()}
+            return self._histogram.snapshot(), info_dict
+
+        if self._histogram_buffer.size != self.bins_num:
+            self._allocate_histogram_buffers()
+
+        if self._incremental_readout:
+            # clearing the histogram memory on read delivers only the counts
+            # since the last poll, which are accumulated in int64 on the host:
+            self.tryfunc(self.dll.HH_GetHistogram(self._deviceID, self._histogram_pointer, 1, 1),
+                         "GetHistogram")
+            self._incremental_histogram.add_delta(self._histogram_buffer)
+            info_dict = {'elapsed_sweeps': None,
+                         'elapsed_time': self.get_elapsed_time(),
+                         'delta': self._incremental_histogram.delta.copy()}
+            return self._incremental_histogram.total.copy(), info_dict
+
+        self.tryfunc(self.dll.HH_GetHistogram(self._deviceID, self._histogram_pointer, 1, 0),
+                     "GetHistogram")
 
-        meas_t = int(self.get_measurement_time())
         info_dict = {'elapsed_sweeps': None,
-                     'elapsed_time': meas_t}
-        return time_trace, info_dict
+                     'elapsed_time': self.get_elapsed_time()}
+        if self._return_uint32:
+            # the device bins are 32 bit, so only accumulating the returned
+            # data (e.g. with recalled data in the pulsed logic) needs int64:
+            return self._histogram_buffer, info_dict
+        return self._histogram_buffer.astype(np.int64), info_dict
+
+    def _allocate_histogram_buffers(self):
+        """ Allocate the persistent buffers for bins_num histogram bins.
+
+        Only with return_uint32 the returned time trace is this buffer, which
+        is overwritten by the next call of get_data_trace.
+        """
+        self._histogram_buffer = np.zeros(self.bins_num, dtype=np.uint32)
+        self._histogram_pointer = self._histogram_buffer.ctypes.data_as(
+            ctypes.POINTER(ctypes.c_uint32))
+        self._incremental_histogram = IncrementalHistogram(self.bins_num)
 
     def get_measurement_time(self):
         t = ctypes.c_double()  # in ms unit
@@ -0,0 +1,168 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains the constants of the PicoHarp300 library (PHLib) defined in the header files
+'phdefin.h' and 'errorcodes.h'.
+
+THIS FILE IS GENERATED BY generate_ph_constants.py, DO NOT EDIT IT BY HAND.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+
+# phdefin.h
+LIB_VERSION = "3.0"
+MAXDEVNUM = 8
+HISTCHAN = 65536
+TTREADMAX = 131072
+MODE_HIST = 0
+MODE_T2 = 2
+MODE_T3 = 3
+FEATURE_DLL = 0x0001
+FEATURE_TTTR = 0x0002
+FEATURE_MARKERS = 0x0004
+FEATURE_LOWRES = 0x0008
+FEATURE_TRIGOUT = 0x0010
+FLAG_FIFOFULL = 0x0003
+FLAG_OVERFLOW = 0x0040
+FLAG_SYSERROR = 0x0100
+BINSTEPSMAX = 8
+SYNCDIVMIN = 1
+SYNCDIVMAX = 8
+ZCMIN = 0
+ZCMAX = 20
+DISCRMIN = 0
+DISCRMAX = 800
+OFFSETMIN = 0
+OFFSETMAX = 1000000000
+SYNCOFFSMIN = -99999
+SYNCOFFSMAX = 99999
+CHANOFFSMIN = -8000
+CHANOFFSMAX = 8000
+ACQTMIN = 1
+ACQTMAX = 360000000
+PHR800LVMIN = -1600
+PHR800LVMAX = 2400
+HOLDOFFMAX = 210480
+WARNING_INP0_RATE_ZERO = 0x0001
+WARNING_INP0_RATE_TOO_LOW = 0x0002
+WARNING_INP0_RATE_TOO_HIGH = 0x0004
+WARNING_INP1_RATE_ZERO = 0x0010
+WARNING_INP1_RATE_TOO_HIGH = 0x0040
+WARNING_INP_RATE_RATIO = 0x0100
+WARNING_DIVIDER_GREATER_ONE = 0x0200
+WARNING_TIME_SPAN_TOO_SMALL = 0x0400
+WARNING_OFFSET_UNNECESSARY = 0x0800
+
+# errorcodes.h
+ERROR_NONE = 0
+ERROR_DEVICE_OPEN_FAIL = -1
+ERROR_DEVICE_BUSY = -2
+ERROR_DEVICE_HEVENT_FAIL = -3
+ERROR_DEVICE_CALLBSET_FAIL = -4
+ERROR_DEVICE_BARMAP_FAIL = -5
+ERROR_DEVICE_CLOSE_FAIL = -6
+ERROR_DEVICE_RESET_FAIL = -7
+ERROR_DEVICE_GETVERSION_FAIL = -8
+ERROR_DEVICE_VERSION_MISMATCH = -9
+ERROR_DEVICE_NOT_OPEN = -10
+ERROR_DEVICE_LOCKED = -11
+ERROR_INSTANCE_RUNNING = -16
+ERROR_INVALID_ARGUMENT = -17
+ERROR_INVALID_MODE = -18
+ERROR_INVALID_OPTION = -19
+ERROR_INVALID_MEMORY = -20
+ERROR_INVALID_RDATA = -21
+ERROR_NOT_INITIALIZED = -22
+ERROR_NOT_CALIBRATED = -23
+ERROR_DMA_FAIL = -24
+ERROR_XTDEVICE_FAIL = -25
+ERROR_FPGACONF_FAIL = -26
+ERROR_IFCONF_FAIL = -27
+ERROR_FIFORESET_FAIL = -28
+ERROR_STATUS_FAIL = -29
+ERROR_USB_GETDRIVERVER_FAIL = -32
+ERROR_USB_DRIVERVER_MISMATCH = -33
+ERROR_USB_GETIFINFO_FAIL = -34
+ERROR_USB_HISPEED_FAIL = -35
+ERROR_USB_VCMD_FAIL = -36
+ERROR_USB_BULKRD_FAIL = -37
+ERROR_HARDWARE_F01 = -64
+ERROR_HARDWARE_F02 = -65
+ERROR_HARDWARE_F03 = -66
+ERROR_HARDWARE_F04 = -67
+ERROR_HARDWARE_F05 = -68
+ERROR_HARDWARE_F06 = -69
+ERROR_HARDWARE_F07 = -70
+ERROR_HARDWARE_F08 = -71
+ERROR_HARDWARE_F09 = -72
+ERROR_HARDWARE_F10 = -73
+ERROR_HARDWARE_F11 = -74
+ERROR_HARDWARE_F12 = -75
+ERROR_HARDWARE_F13 = -76
+ERROR_HARDWARE_F14 = -77
+ERROR_HARDWARE_F15 = -78
+
+# error code value to name, as used for error messages
+ERROR_CODES = {
+    0: 'ERROR_NONE',
+    -1: 'ERROR_DEVICE_OPEN_FAIL',
+    -2: 'ERROR_DEVICE_BUSY',
+    -3: 'ERROR_DEVICE_HEVENT_FAIL',
+    -4: 'ERROR_DEVICE_CALLBSET_FAIL',
+    -5: 'ERROR_DEVICE_BARMAP_FAIL',
+    -6: 'ERROR_DEVICE_CLOSE_FAIL',
+    -7: 'ERROR_DEVICE_RESET_FAIL',
+    -8: 'ERROR_DEVICE_GETVERSION_FAIL',
+    -9: 'ERROR_DEVICE_VERSION_MISMATCH',
+    -10: 'ERROR_DEVICE_NOT_OPEN',
+    -11: 'ERROR_DEVICE_LOCKED',
+    -16: 'ERROR_INSTANCE_RUNNING',
+    -17: 'ERROR_INVALID_ARGUMENT',
+    -18: 'ERROR_INVALID_MODE',
+    -19: 'ERROR_INVALID_OPTION',
+    -20: 'ERROR_INVALID_MEMORY',
+    -21: 'ERROR_INVALID_RDATA',
+    -22: 'ERROR_NOT_INITIALIZED',
+    -23: 'ERROR_NOT_CALIBRATED',
+    -24: 'ERROR_DMA_FAIL',
+    -25: 'ERROR_XTDEVICE_FAIL',
+    -26: 'ERROR_FPGACONF_FAIL',
+    -27: 'ERROR_IFCONF_FAIL',
+    -28: 'ERROR_FIFORESET_FAIL',
+    -29: 'ERROR_STATUS_FAIL',
+    -32: 'ERROR_USB_GETDRIVERVER_FAIL',
+    -33: 'ERROR_USB_DRIVERVER_MISMATCH',
+    -34: 'ERROR_USB_GETIFINFO_FAIL',
+    -35: 'ERROR_USB_HISPEED_FAIL',
+    -36: 'ERROR_USB_VCMD_FAIL',
+    -37: 'ERROR_USB_BULKRD_FAIL',
+    -64: 'ERROR_HARDWARE_F01',
+    -65: 'ERROR_HARDWARE_F02',
+    -66: 'ERROR_HARDWARE_F03',
+    -67: 'ERROR_HARDWARE_F04',
+    -68: 'ERROR_HARDWARE_F05',
+    -69: 'ERROR_HARDWARE_F06',
+    -70: 'ERROR_HARDWARE_F07',
+    -71: 'ERROR_HARDWARE_F08',
+    -72: 'ERROR_HARDWARE_F09',
+    -73: 'ERROR_HARDWARE_F10',
+    -74: 'ERROR_HARDWARE_F11',
+    -75: 'ERROR_HARDWARE_F12',
+    -76: 'ERROR_HARDWARE_F13',
+    -77: 'ERROR_HARDWARE_F14',
+    -78: 'ERROR_HARDWARE_F15',
+}
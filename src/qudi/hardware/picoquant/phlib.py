@@ -0,0 +1,219 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains a binding of the PHLib functions called in the acquisition hot paths of the
+PicoHarp 300 modules: FIFO and histogram reads into caller supplied numpy buffers and the status
+queries, with prototyped function pointers, preallocated out-parameters and the library error
+codes mapped to exceptions.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import ctypes
+import numpy as np
+
+from qudi.hardware.picoquant import ph_constants
+
+__all__ = ['PHLib', 'PHLibError']
+
+_c_int_p = ctypes.POINTER(ctypes.c_int)
+_c_double_p = ctypes.POINTER(ctypes.c_double)
+
+# argument types of the bound functions, see phlib.h
+_PROTOTYPES = {
+    'PH_ReadFiFo': (ctypes.c_int, ctypes.c_void_p, ctypes.c_int, _c_int_p),
+    'PH_GetHistogram': (ctypes.c_int, ctypes.c_void_p, ctypes.c_int),
+    'PH_CTCStatus': (ctypes.c_int, _c_int_p),
+    'PH_GetCountRate': (ctypes.c_int, ctypes.c_int, _c_int_p),
+    'PH_GetFlags': (ctypes.c_int, _c_int_p),
+    'PH_GetWarnings': (ctypes.c_int, _c_int_p),
+    'PH_GetElapsedMeasTime': (ctypes.c_int, _c_double_p),
+    'PH_GetResolution': (ctypes.c_int, _c_double_p),
+}
+
+
+class PHLibError(Exception):
+    """ A PHLib function returned an error code (see ph_constants.ERROR_CODES). """
+
+    def __init__(self, function, code):
+        self.function = function
+        self.code = code
+        super().__init__('{0} failed with errorcode {1:d}: {2}'.format(
+            function, code, ph_constants.ERROR_CODES.get(code, 'unknown error')))
+
+
+class _DeviceOutParameters:
+    """ Out-parameters of the bound functions for a single device.
+
+    Every function has its own out-parameter, so e.g. the FIFO reader thread and the count rate
+    queries of the module thread never share one. The same function must not be called
+    concurrently for the same device.
+    """
+
+    def __init__(self):
+        self.fifo_count = ctypes.c_int()
+        self.fifo_count_ref = ctypes.byref(self.fifo_count)
+        self.ctc_status = ctypes.c_int()
+        self.ctc_status_ref = ctypes.byref(self.ctc_status)
+        self.count_rate = ctypes.c_int()
+        self.count_rate_ref = ctypes.byref(self.count_rate)
+        self.flags = ctypes.c_int()
+        self.flags_ref = ctypes.byref(self.flags)
+        self.warnings = ctypes.c_int()
+        self.warnings_ref = ctypes.byref(self.warnings)
+        self.elapsed = ctypes.c_double()
+        self.elapsed_ref = ctypes.byref(self.elapsed)
+        self.resolution = ctypes.c_double()
+        self.resolution_ref = ctypes.byref(self.resolution)
+
+
+class PHLib:
+    """ Prototyped access to the hot path functions of a loaded PHLib.
+
+    Without prototypes, ctypes converts every argument by inspecting its Python type on each call
+    and passes Python integers as C int, which truncates the buffer addresses of 64 bit processes.
+    Here the argument types are declared once and every device has preallocated out-parameters, so
+    a call only converts the plain integer arguments. The library has to be loaded as CDLL (or
+    WinDLL), whose foreign calls release the GIL: while PH_ReadFiFo waits for its timeout or
+    PH_GetHistogram copies the histogram, the analysis threads keep running.
+
+    The function pointers are private to this binding, the prototypes do not change the functions
+    called through the library handle itself.
+    """
+
+    MAX_FIFO_READ = ph_constants.TTREADMAX
+    HISTOGRAM_SIZE = ph_constants.HISTCHAN
+
+    def __init__(self, library):
+        """
+        @param ctypes.CDLL library: the loaded PHLib (phlib64)
+        """
+        if isinstance(library, ctypes.PyDLL):
+            raise ValueError('PHLib needs a library handle releasing the GIL (CDLL or WinDLL).')
+        self._functions = dict()
+        for name, argtypes in _PROTOTYPES.items():
+            # item access creates a new function pointer, unlike attribute access
+            function = library[name]
+            function.argtypes = argtypes
+            function.restype = ctypes.c_int
+            self._functions[name] = function
+        self._read_fifo = self._functions['PH_ReadFiFo']
+        self._get_histogram = self._functions['PH_GetHistogram']
+        self._out = dict()
+
+    def _out_parameters(self, device):
+        out = self._out.get(device)
+        if out is None:
+            out = self._out.setdefault(device, _DeviceOutParameters())
+        return out
+
+    def read_fifo(self, device, buffer, count=None):
+        """ Read TTTR records from the FIFO into a caller supplied buffer.
+
+        @param int device: device index
+        @param numpy.ndarray buffer: C-contiguous uint32 array
+        @param int count: optional, maximum number of records (default: buffer size, at most
+                          TTREADMAX)
+
+        @return int: number of records read
+        """
+        if buffer.dtype != np.uint32 or not buffer.flags.c_contiguous:
+            raise ValueError('PHLib.read_fifo needs a C-contiguous uint32 buffer.')
+        count = min(buffer.size if count is None else int(count), buffer.size,
+                    self.MAX_FIFO_READ)
+        out = self._out_parameters(device)
+        ret = self._read_fifo(device, buffer.ctypes.data, count, out.fifo_count_ref)
+        if ret < 0:
+            raise PHLibError('PH_ReadFiFo', ret)
+        return out.fifo_count.value
+
+    def get_histogram(self, device, buffer, block=0):
+        """ Copy the device histogram into a caller supplied buffer.
+
+        @param int device: device index
+        @param numpy.ndarray buffer: C-contiguous uint32 array of at least HISTCHAN entries
+        @param int block: optional, histogram block (> 0 only with routing)
+
+        @return numpy.ndarray: buffer
+        """
+        if buffer.dtype != np.uint32 or not buffer.flags.c_contiguous or \
+                buffer.size < self.HISTOGRAM_SIZE:
+            raise ValueError('PHLib.get_histogram needs a C-contiguous uint32 buffer with at least '
+                             '{0:d} entries.'.format(self.HISTOGRAM_SIZE))
+        ret = self._get_histogram(device, buffer.ctypes.data, block)
+        if ret < 0:
+            raise PHLibError('PH_GetHistogram', ret)
+        return buffer
+
+    def ctc_status(self, device):
+        """
+        @return int: 0 while the acquisition time is running, > 0 once it has ended
+        """
+        out = self._out_parameters(device)
+        ret = self._functions['PH_CTCStatus'](device, out.ctc_status_ref)
+        if ret < 0:
+            raise PHLibError('PH_CTCStatus', ret)
+        return out.ctc_status.value
+
+    def get_count_rate(self, device, channel):
+        """
+        @return int: count rate of the input channel in counts/s
+        """
+        out = self._out_parameters(device)
+        ret = self._functions['PH_GetCountRate'](device, channel, out.count_rate_ref)
+        if ret < 0:
+            raise PHLibError('PH_GetCountRate', ret)
+        return out.count_rate.value
+
+    def get_flags(self, device):
+        """
+        @return int: status flags (bit pattern of ph_constants.FLAG_*)
+        """
+        out = self._out_parameters(device)
+        ret = self._functions['PH_GetFlags'](device, out.flags_ref)
+        if ret < 0:
+            raise PHLibError('PH_GetFlags', ret)
+        return out.flags.value
+
+    def get_warnings(self, device):
+        """
+        @return int: warnings (bit pattern of ph_constants.WARNING_*)
+        """
+        out = self._out_parameters(device)
+        ret = self._functions['PH_GetWarnings'](device, out.warnings_ref)
+        if ret < 0:
+            raise PHLibError('PH_GetWarnings', ret)
+        return out.warnings.value
+
+    def get_elapsed_meas_time(self, device):
+        """
+        @return float: elapsed measurement time in ms
+        """
+        out = self._out_parameters(device)
+        ret = self._functions['PH_GetElapsedMeasTime'](device, out.elapsed_ref)
+        if ret < 0:
+            raise PHLibError('PH_GetElapsedMeasTime', ret)
+        return out.elapsed.value
+
+    def get_resolution(self, device):
+        """
+        @return float: resolution at the current binning in ps
+        """
+        out = self._out_parameters(device)
+        ret = self._functions['PH_GetResolution'](device, out.resolution_ref)
+        if ret < 0:
+            raise PHLibError('PH_GetResolution', ret)
+        return out.resolution.value
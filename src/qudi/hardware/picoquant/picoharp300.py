@@ -20,14 +20,40 @@ If not, see <https://www.gnu.org/licenses/>.
 """
 
 import ctypes
+import functools
+import threading
 import numpy as np
 import time
 from qtpy import QtCore
 
 from qudi.core.configoption import ConfigOption
-from qudi.util.paths import get_main_dir
+from qudi.core.statusvariable import StatusVar
 from qudi.util.mutex import Mutex
+from qudi.util.stage_metrics import StageMetrics
 from qudi.interface.fast_counter_interface import FastCounterInterface
+from qudi.hardware.picoquant import ph_constants
+from qudi.hardware.picoquant.device_discovery import load_library, open_device
+from qudi.hardware.picoquant.phlib import PHLib, PHLibError
+from qudi.hardware.picoquant.tttr_decoder import PicoHarpTTTRDecoder
+from qudi.hardware.picoquant.tttr_acquisition import TTTRBufferPool, TTTRBlockRing
+from qudi.hardware.picoquant.tttr_acquisition import TTTRReaderThread
+from qudi.hardware.picoquant.tttr_histogram import TTTRHistogram, IncrementalHistogram
+from qudi.hardware.picoquant.tttr_correlator import TTTRCorrelator
+from qudi.hardware.picoquant.tttr_flim import FLIMImage
+from qudi.hardware.picoquant.ptu_file import PTUWriter
+
+def _after_calibration(method):
+    """ Decorator for the methods calling the device: while the background
+    calibration runs, the library must not be used for the device, so the call
+    waits for the calibration thread first.
+    """
+    @functools.wraps(method)
+    def wrapper(self, *args, **kwargs):
+        if self._calibration_thread is not None:
+            self._wait_for_calibration()
+        return method(self, *args, **kwargs)
+    return wrapper
+
 
 # =============================================================================
 # Wrapper around the PHLib.DLL. The current file is based on the header files
@@ -94,16 +120,39 @@ class PicoHarp300(FastCounterInterface):
     fastcounter_picoharp300:
         module.Class: 'picoquant.picoharp300.PicoHarp300'
         deviceID: 0 # a device index from 0 to 7.
+        serial: None # optional, serial number of the device, takes precedence over deviceID. Only with a serial number other device IDs are searched
         mode: 0 # 0: histogram mode, 2: T2 mode, 3: T3 mode
+        background_calibration: True # optional, calibrate while activation continues
+        calibration_validity: 0 # optional, time in s a calibration stays valid over restarts (0: always calibrate)
+        fifo_ring_blocks: 32 # optional, number of TTREADMAX blocks buffered between FIFO reader and analysis
+        gated: False # optional, if True every marker record starts the next gate of the time trace
+        gate_marker_mask: 0b1111 # optional, bit mask of the marker inputs starting a new gate
+        hardware_histogram: False # optional, if True and not gated, the device histograms in histogram mode
+        router_channels: 0 # optional, number of PHR800 routing channels histogrammed separately
+        router_channel_offsets: [0, 0, 0, 0] # optional, delay of each routing channel in ps
         
     """
 
     _deviceID = ConfigOption('deviceID', 0, missing='warn') # a device index from 0 to 7.
+    _device_serial = ConfigOption('serial', None)
+    _background_calibration = ConfigOption('background_calibration', True)
+    _calibration_validity = ConfigOption('calibration_validity', 0)
     _mode = ConfigOption('mode', 0, missing='warn')
+    _fifo_ring_blocks = ConfigOption('fifo_ring_blocks', 32)
+    _gated = ConfigOption('gated', False)
+    _gate_marker_mask = ConfigOption('gate_marker_mask', 0b1111)
+    _hardware_histogram = ConfigOption('hardware_histogram', False)
+    _router_channels = ConfigOption('router_channels', 0)
+    _router_channel_offsets = ConfigOption('router_channel_offsets', None)
+
+    # serial number to device index and time of the last calibration of the
+    # devices seen in previous activations:
+    _device_index_cache = StatusVar('device_index_cache', default=dict())
+    _calibration_times = StatusVar('calibration_times', default=dict())
 
-    sigReadoutPicoharp = QtCore.Signal()
-    sigAnalyzeData = QtCore.Signal(object, object)
     sigStart = QtCore.Signal()
+    _sigStartCountRates = QtCore.Signal()
+    _sigStopCountRates = QtCore.Signal()
 
     def __init__(self, config, **kwargs):
         super().__init__(config=config, **kwargs)
@@ -114,51 +163,142 @@ class PicoHarp300(FastCounterInterface):
         # the library can communicate with 8 devices:
         self.connected_to_device = False
 
-        #FIXME: Check which architecture the host PC is and choose the dll
-        # according to that!
-
-        # Load the picoharp library file phlib64.dll from the folder
-        # <Windows>/System32/
-        self._dll = ctypes.cdll.LoadLibrary('phlib64')
+        # the picoharp library file phlib64.dll (from the folder
+        # <Windows>/System32/) is loaded in on_activate, once per process:
+        self._dll = None
+        self._phlib = None
+        self._serial = ''
+        self._calibration_thread = None
 
         # Just some default values:
-        self._bin_width_ns = 3000
-        self._record_length_ns = 100 *1e9
+        self._bin_width_s = 4e-12
+        self._record_length_s = 4096 * 4e-12
+        self._number_of_gates = 0
+
+        self.meas_run = False
 
         self._photon_source2 = None #for compatibility reasons with second APD
         self._count_channel = 1
 
+        # count rates of both inputs, refreshed by a timer with the 100 ms
+        # gate time of the rate meters while the counter is set up:
+        self._count_rates = [0, 0]
+        self._count_rate_timer = None
+
+        # decoder for the TTTR records read from the FIFO and histogram of the
+        # time trace, both created in configure:
+        self._decoder = None
+        self._last_events = None
+        self._histogram = None
+        # start-multistop correlator of the T2 records, created in
+        # configure_correlation:
+        self._correlator = None
+        # FLIM image of the T3 records and scanner markers, created in
+        # configure_flim, and its dtime unit in seconds:
+        self._flim = None
+        self._flim_resolution_s = 0.0
+
+        # ring buffer and thread continuously reading the FIFO, created in on_activate:
+        self._fifo_ring = None
+        self._reader_thread = None
+
+        # reused buffers for FIFO reads, so the read path does not allocate
+        # anything (the out-parameter is kept by the PHLib binding):
+        self._fifo_buffer_pool = TTTRBufferPool(buffer_count=4,
+                                                buffer_size=self.TTREADMAX)
+
+        # optional PTU file the raw records are streamed to:
+        self._ptu_writer = None
+
+        # latencies of the processing stages of the FIFO records, device flags
+        # accumulated since the measurement started and the last warnings, see
+        # get_metrics:
+        self._stage_metrics = StageMetrics(('decode', 'histogram', 'flim', 'correlate',
+                                            'record'))
+        self._device_flags = 0
+        self._device_warnings = 0
+        self._last_metrics_query = (time.perf_counter(), 0)
+
+        # histogram mode fast path, set up in configure: device histogram
+        # buffer, host side rebin factor and number of bins, and the time
+        # trace accumulated over measurement restarts
+        self._hist_mode = False
+        self._hist_buffer = None
+        self._hist_rebin = 1
+        self._hist_bin_count = 0
+        self._hist_accumulator = None
+        self._hist_elapsed_offset = 0.0
+        self._hist_overflow = False
+
+        # values last applied to the device by apply_settings:
+        self._settings_cache = dict()
+
         #locking for thread safety
         self.threadlock = Mutex()
 
 
     def on_activate(self):
         """ Activate and establish the connection to Picohard and initialize.
+
+        The calibration runs in the background (ConfigOption
+        background_calibration) or is skipped if the last calibration of the
+        device is younger than calibration_validity. Everything starting a
+        measurement waits for a running calibration.
         """
+        self._dll = load_library('phlib64')
+        # prototyped access for the FIFO, histogram and status calls:
+        self._phlib = PHLib(self._dll)
         self.open_connection()
         self.initialize(self._mode)
-        self.calibrate()
 
         #FIXME: These are default values determined from the measurement
         # One need still to include this in the config.
         self.set_input_CFD(1,10,7)
+        self._start_calibration()
 
         # the signal has one argument of type object, which should allow
         # anything to pass through:
 
         self.sigStart.connect(self.start_measure)
-        self.sigReadoutPicoharp.connect(self.get_fresh_data_loop, QtCore.Qt.QueuedConnection) # ,QtCore.Qt.QueuedConnection
-        self.sigAnalyzeData.connect(self.analyze_received_data, QtCore.Qt.QueuedConnection)
         self.result = []
 
+        # the FIFO is read by a separate thread into preallocated blocks, which
+        # are pulled and analyzed by process_fifo_data:
+        self._fifo_ring = TTTRBlockRing(block_count=self._fifo_ring_blocks,
+                                        block_size=self.TTREADMAX)
+        self._reader_thread = TTTRReaderThread(read_fifo=self._read_fifo_into,
+                                               ring=self._fifo_ring)
+        # analyze the blocks as soon as they arrive instead of only on demand:
+        self._reader_thread.sigDataAvailable.connect(self._fifo_data_available,
+                                                     QtCore.Qt.QueuedConnection)
+
+        # QTimer must be created here to run in the thread of this module:
+        self._count_rate_timer = QtCore.QTimer()
+        self._count_rate_timer.setInterval(100)
+        self._count_rate_timer.timeout.connect(self._update_count_rates,
+                                               QtCore.Qt.QueuedConnection)
+        self._sigStartCountRates.connect(self._count_rate_timer.start,
+                                         QtCore.Qt.QueuedConnection)
+        self._sigStopCountRates.connect(self._count_rate_timer.stop,
+                                        QtCore.Qt.QueuedConnection)
+
 
     def on_deactivate(self):
         """ Deactivates and disconnects the device.
         """
-
+        self._wait_for_calibration()
+        self._stop_reader_thread()
+        self._count_rate_timer.stop()
+        self._count_rate_timer.timeout.disconnect()
+        self._sigStartCountRates.disconnect()
+        self._sigStopCountRates.disconnect()
+        self._count_rate_timer = None
+        self.stop_recording()
         self.close_connection()
-        self.sigReadoutPicoharp.disconnect()
-        self.sigAnalyzeData.disconnect()
+        self.sigStart.disconnect()
+        self._reader_thread.sigDataAvailable.disconnect()
+        self._reader_thread = None
+        self._fifo_ring = None
 
     def _create_errorcode(self):
         """ Create a dictionary with the errorcode for the device.
@@ -169,58 +309,51 @@ class PicoHarp300(FastCounterInterface):
         errorcode can be also extracted by calling the get_error_string method
         with the appropriate integer value.
         """
-
-        maindir = get_main_dir()
-
-        filename = os.path.join(maindir, 'hardware', 'PicoQuant', 'errorcodes.h')
-        try:
-            with open(filename) as f:
-                content = f.readlines()
-        except:
-            self.log.error('No file "errorcodes.h" could be found in the '
-                           'PicoHarp hardware directory!')
-
-        errorcode = {}
-        for line in content:
-            if '#define ERROR' in line:
-                errorstring, errorvalue = line.split()[-2:]
-                errorcode[int(errorvalue)] = errorstring
-
-        return errorcode
+        return dict(ph_constants.ERROR_CODES)
 
     def _set_constants(self):
         """ Set the constants (max and min values) for the Picoharp300 device.
-        These setting are taken from phdefin.h """
+        These setting are taken from phdefin.h via the generated module
+        ph_constants. """
 
-        self.MODE_HIST = 0
-        self.MODE_T2 = 2
-        self.MODE_T3 = 3
+        self.MODE_HIST = ph_constants.MODE_HIST
+        self.MODE_T2 = ph_constants.MODE_T2
+        self.MODE_T3 = ph_constants.MODE_T3
 
         # in mV:
-        self.ZCMIN = 0
-        self.ZCMAX = 20
-        self.DISCRMIN = 0
-        self.DISCRMAX = 800
-        self.PHR800LVMIN = -1600
-        self.PHR800LVMAX = 2400
+        self.ZCMIN = ph_constants.ZCMIN
+        self.ZCMAX = ph_constants.ZCMAX
+        self.DISCRMIN = ph_constants.DISCRMIN
+        self.DISCRMAX = ph_constants.DISCRMAX
+        self.PHR800LVMIN = ph_constants.PHR800LVMIN
+        self.PHR800LVMAX = ph_constants.PHR800LVMAX
 
         # in ps:
-        self.OFFSETMIN = 0
-        self.OFFSETMAX = 1000000000
-        self.SYNCOFFSMIN = -99999
-        self.SYNCOFFSMAX	= 99999
+        self.OFFSETMIN = ph_constants.OFFSETMIN
+        self.OFFSETMAX = ph_constants.OFFSETMAX
+        self.SYNCOFFSMIN = ph_constants.SYNCOFFSMIN
+        self.SYNCOFFSMAX = ph_constants.SYNCOFFSMAX
 
         # in ms:
-        self.ACQTMIN = 1
-        self.ACQTMAX = 10*60*60*1000
+        self.ACQTMIN = ph_constants.ACQTMIN
+        self.ACQTMAX = ph_constants.ACQTMAX
         self.TIMEOUT = 80   # the maximal device timeout for a readout request
 
         # in ns:
-        self.HOLDOFFMAX = 210480
+        self.HOLDOFFMAX = ph_constants.HOLDOFFMAX
 
-        self.BINSTEPSMAX = 8
-        self.HISTCHAN = 65536    # number of histogram channels 2^16
-        self.TTREADMAX = 131072  # 128K event records (2^17)
+        # in ps, resolution for binning code 0:
+        self.BASERESOLUTION = 4
+
+        self.SYNCDIVMIN = ph_constants.SYNCDIVMIN
+        self.SYNCDIVMAX = ph_constants.SYNCDIVMAX
+        self.BINSTEPSMAX = ph_constants.BINSTEPSMAX
+        self.HISTCHAN = ph_constants.HISTCHAN    # number of histogram channels 2^16
+        # the 16 bit histogram bins saturate at HISTBINMAX, in histogram mode the
+        # run is restarted with a cleared memory once a bin reaches HISTBINREFRESH:
+        self.HISTBINMAX = 65535
+        self.HISTBINREFRESH = 60000
+        self.TTREADMAX = ph_constants.TTREADMAX  # 128K event records (2^17)
 
         # in Hz:
         self.COUNTFREQ = 10
@@ -242,7 +375,7 @@ class PicoHarp300(FastCounterInterface):
 
         if not func_val == 0:
             self.log.error('Error in PicoHarp300 with errorcode {0}:\n'
-                           '{1}'.format(func_val, self.errorcode[func_val]))
+                           '{1}'.format(func_val, self.errorcode.get(func_val, 'unknown error')))
         return func_val
 
     # =========================================================================
@@ -279,16 +412,39 @@ class PicoHarp300(FastCounterInterface):
     # =========================================================================
 
     def open_connection(self):
-        """ Open a connection to this device. """
-
-
-        buf = ctypes.create_string_buffer(16)   # at least 8 byte
-        ret = self.check(self._dll.PH_OpenDevice(self._deviceID, ctypes.byref(buf)))
-        self._serial = buf.value.decode()   # .decode() converts byte to string
-        if ret >= 0:
-            self.connected_to_device = True
-            self.log.info('Connection to the Picoharp 300 established')
+        """ Open a connection to this device.
 
+        With a configured serial number, the device index it had in the
+        previous activation is tried first, so usually no other device
+        index has to be probed.
+        """
+        def open_func(index):
+            buf = ctypes.create_string_buffer(16)   # at least 8 byte
+            ret = self._dll.PH_OpenDevice(index, ctypes.byref(buf))
+            return ret, buf.value.decode()  # .decode() converts byte to string
+
+        index_cache = dict(self._device_index_cache)
+        index, serial = open_device(open_func=open_func,
+                                    close_func=self._dll.PH_CloseDevice,
+                                    device_index=self._deviceID,
+                                    serial=self._device_serial,
+                                    index_cache=index_cache,
+                                    max_devices=ph_constants.MAXDEVNUM)
+        if index < 0:
+            self.log.error('PicoHarp: No Picoharp 300 {0} could be opened.'.format(
+                'with deviceID {0}'.format(self._deviceID) if not self._device_serial else
+                'with serial number {0}'.format(self._device_serial)))
+            return
+        if index != self._deviceID:
+            self.log.info('PicoHarp: Using device index {0:d} (serial number {1}).'
+                          ''.format(index, serial))
+        self._deviceID = index
+        self._serial = serial
+        self._device_index_cache = index_cache
+        self.connected_to_device = True
+        self.log.info('Connection to the Picoharp 300 established')
+
+    @_after_calibration
     def initialize(self, mode):
         """ Initialize the device with one of the three possible modes.
 
@@ -309,8 +465,11 @@ class PicoHarp300(FastCounterInterface):
                                             mode)
                            )
         else:
+            # the device starts with its default settings again:
+            self._settings_cache.clear()
             self.check(self._dll.PH_Initialize(self._deviceID, mode))
 
+    @_after_calibration
     def close_connection(self):
         """Close the connection to the device.
 
@@ -328,6 +487,7 @@ class PicoHarp300(FastCounterInterface):
     # All functions below can be used if the device was successfully called.
     # =========================================================================
 
+    @_after_calibration
     def get_hardware_info(self):
         """ Retrieve the device hardware information.
 
@@ -343,6 +503,7 @@ class PicoHarp300(FastCounterInterface):
         # the .decode() function converts byte objects to string objects
         return model.value.decode(), partnum.value.decode(), version.value.decode()
 
+    @_after_calibration
     def get_serial_number(self):
         """ Retrieve the serial number of the device.
 
@@ -353,6 +514,7 @@ class PicoHarp300(FastCounterInterface):
         self.check(self._dll.PH_GetSerialNumber(self._deviceID, ctypes.byref(serialnum)))
         return serialnum.value.decode() # .decode() converts byte to string
 
+    @_after_calibration
     def get_base_resolution(self):
         """ Retrieve the base resolution of the device.
 
@@ -365,8 +527,46 @@ class PicoHarp300(FastCounterInterface):
 
     def calibrate(self):
         """ Calibrate the device."""
-        self.check(self._dll.PH_Calibrate(self._deviceID))
-
+        ret = self.check(self._dll.PH_Calibrate(self._deviceID))
+        if ret == 0:
+            calibration_times = dict(self._calibration_times)
+            calibration_times[self._serial] = time.time()
+            self._calibration_times = calibration_times
+        return ret
+
+    def _start_calibration(self):
+        """ Calibrate the device after activation, in the background if
+        configured, unless the last calibration is still valid.
+        """
+        if not self.connected_to_device:
+            return
+        last_calibration = self._calibration_times.get(self._serial)
+        if self._calibration_validity > 0 and last_calibration is not None and \
+                time.time() - last_calibration < self._calibration_validity:
+            self.log.debug('PicoHarp: Skipping the calibration, the last one is still valid.')
+            return
+        if not self._background_calibration:
+            self.calibrate()
+            return
+        self._calibration_thread = threading.Thread(target=self.calibrate,
+                                                    name='PicoHarp300-calibration',
+                                                    daemon=True)
+        self._calibration_thread.start()
+
+    def _wait_for_calibration(self):
+        """ Block until a background calibration has finished. """
+        thread = self._calibration_thread
+        # the calibration itself may call decorated methods (e.g. via check):
+        if thread is not None and thread is not threading.current_thread():
+            thread.join()
+            self._calibration_thread = None
+
+    @property
+    def is_calibrating(self):
+        """ True while the background calibration after activation runs. """
+        return self._calibration_thread is not None and self._calibration_thread.is_alive()
+
+    @_after_calibration
     def get_features(self):
         """ Retrieve the possible features of the device.
 
@@ -384,27 +584,7 @@ class PicoHarp300(FastCounterInterface):
         @param int zerocross: CFD zero cross in millivolts
         """
         channel = int(channel)
-        level = int(level)
-        zerocross = int(zerocross)
-        if channel not in (0, 1):
-            self.log.error('PicoHarp: Channal does not exist.\nChannel has '
-                           'to be 0 or 1 but {0} was passed.'.format(channel))
-            return
-        if not(self.DISCRMIN <= level <= self.DISCRMAX):
-            self.log.error('PicoHarp: Invalid CFD level.\nValue must be '
-                           'within the range [{0},{1}] millivolts but a value of '
-                           '{2} has been '
-                           'passed.'.format(self.DISCRMIN, self.DISCRMAX, level))
-            return
-        if not(self.ZCMIN <= zerocross <= self.ZCMAX):
-            self.log.error('PicoHarp: Invalid CFD zero cross.\nValue must be '
-                           'within the range [{0},{1}] millivolts but a value of '
-                           '{2} has been '
-                           'passed.'.format(self.ZCMIN, self.ZCMAX, zerocross))
-            return
-
-        self.check(self._dll.PH_SetInputCFD(self._deviceID, channel, level, zerocross))
-
+        return self.apply_settings({'input_cfd{0}'.format(channel): (level, zerocross)})
 
     def set_sync_div(self, div):
         """ Synchronize the devider of the device.
@@ -416,13 +596,7 @@ class PicoHarp300(FastCounterInterface):
         period. The readins obtained with PH_GetCountRate are corrected for the
         devider settin and deliver the external (undivided) rate.
         """
-        if not ( (div !=1) or (div !=2) or (div !=4) or (div !=8) ):
-            self.log.error('PicoHarp: Invalid sync devider.\n'
-                           'Value must be 1, 2, 4 or 8 but a value of {0} was '
-                           'passed.'.format(div))
-            return
-        else:
-            self.check(self._dll.PH_SetSyncDiv(self._deviceID, div))
+        return self.apply_settings({'sync_div': div})
 
     def set_sync_offset(self, offset):
         """ Set the offset of the synchronization.
@@ -431,15 +605,7 @@ class PicoHarp300(FastCounterInterface):
                            value must lie within the range of SYNCOFFSMIN and
                            SYNCOFFSMAX.
         """
-        offset = int(offset)
-        if not(self.SYNCOFFSMIN <= offset <= self.SYNCOFFSMAX):
-            self.log.error('PicoHarp: Invalid Synchronization offset.\nValue '
-                           'must be within the range [{0},{1}] ps but a value of '
-                           '{2} has been passed.'.format(
-                self.SYNCOFFSMIN, self.SYNCOFFSMAX, offset))
-        else:
-            self.check(self._dll.PH_SetSyncOffset(self._deviceID, offset))
-
+        return self.apply_settings({'sync_offset': offset})
 
     def set_stop_overflow(self, stop_ovfl, stopcount):
         """ Stop the measurement if maximal amount of counts is reached.
@@ -453,19 +619,7 @@ class PicoHarp300(FastCounterInterface):
         reaches the maximum set by stopcount. If stop_ofl is 0 the measurement
         will continue but counts above 65535 in any bin will be clipped.
         """
-        if stop_ovfl not in (0, 1):
-            self.log.error('PicoHarp: Invalid overflow parameter.\n'
-                           'The overflow parameter must be either 0 or 1 but a '
-                           'value of {0} was passed.'.format(stop_ovfl))
-            return
-
-        if not(0 <= stopcount <= self.HISTCHAN):
-            self.log.error('PicoHarp: Invalid stopcount parameter.\n'
-                           'stopcount must be within the range [0,{0}] but a '
-                           'value of {1} was passed.'.format(self.HISTCHAN, stopcount))
-            return
-
-        return self.check(self._dll.PH_SetStopOverflow(self._deviceID, stop_ovfl, stopcount))
+        return self.apply_settings({'stop_overflow': (stop_ovfl, stopcount)})
 
     def set_binning(self, binning):
         """ Set the base resolution of the measurement.
@@ -489,12 +643,7 @@ class PicoHarp300(FastCounterInterface):
         resolution you can count  33.55392 ms in total
 
         """
-        if not(0 <= binning < self.BINSTEPSMAX):
-            self.log.error('PicoHarp: Invalid binning.\nValue must be within '
-                           'the range [{0},{1}] bins, but a value of {2} has been '
-                           'passed.'.format(0, self.BINSTEPSMAX, binning))
-        else:
-            self.check(self._dll.PH_SetBinning(self._deviceID, binning))
+        return self.apply_settings({'binning': binning})
 
     def set_multistop_enable(self, enable=True):
         """ Set whether multistops are possible within a measurement.
@@ -506,10 +655,7 @@ class PicoHarp300(FastCounterInterface):
         it is not required to call this function. By default, multistop is
         enabled after PH_Initialize.
         """
-        if enable:
-            self.check(self._dll.PH_SetMultistopEnable(self._deviceID, 1))
-        else:
-            self.check(self._dll.PH_SetMultistopEnable(self._deviceID, 0))
+        return self.apply_settings({'multistop_enable': enable})
 
     def set_offset(self, offset):
         """ Set an offset time.
@@ -522,13 +668,179 @@ class PicoHarp300(FastCounterInterface):
         difference between ch1 and ch0 in hitogramming and T3 mode. Do not
         confuse it with the input offsets!
         """
-        if not(self.OFFSETMIN <= offset <= self.OFFSETMAX):
-            self.log.error('PicoHarp: Invalid offset.\nValue must be within '
-                           'the range [{0},{1}] ps, but a value of {2} has been '
-                           'passed.'.format(self.OFFSETMIN, self.OFFSETMAX, offset))
-        else:
-            self.check(self._dll.PH_SetOffset(self._deviceID, offset))
+        return self.apply_settings({'offset': offset})
+
+
+    # =========================================================================
+    #  Batched device configuration
+    # =========================================================================
+
+    # the settings understood by apply_settings in the order they are applied:
+    _SETTING_KEYS = ('binning', 'offset', 'sync_div', 'sync_offset', 'input_cfd0', 'input_cfd1',
+                     'stop_overflow', 'multistop_enable', 'marker_edges', 'marker_enable',
+                     'marker_holdofftime')
+
+    def apply_settings(self, settings):
+        """ Validate and apply several device settings at once.
+
+        @param dict settings: the settings to apply, possible keys are
+                                'binning': int binning code
+                                'offset': int offset in ps
+                                'sync_div': int sync divider (1, 2, 4 or 8)
+                                'sync_offset': int sync offset in ps
+                                'input_cfd0', 'input_cfd1': tuple(level, zerocross) in mV
+                                'stop_overflow': tuple(stop_ovfl, stopcount)
+                                'multistop_enable': bool
+                                'marker_edges': tuple of 4 int (0 or 1)
+                                'marker_enable': tuple of 4 int (0 or 1)
+                                'marker_holdofftime': int holdoff time in ns
+
+        @return int: error code (0:OK, -1:invalid settings, otherwise the error
+                     code of the first failed library call)
+
+        All settings are checked against the phdefin.h limits before any of
+        them is applied, so either all or none of them are passed to the
+        device. Settings which already have the requested value on the device
+        are skipped. The cache of applied values is cleared by initialize().
+        """
+        validated = dict()
+        errors = list()
+        for key, value in settings.items():
+            if key not in self._SETTING_KEYS:
+                errors.append('Unknown setting "{0}".'.format(key))
+                continue
+            value, error = self._validate_setting(key, value)
+            if error is None:
+                validated[key] = value
+            else:
+                errors.append(error)
+        if errors:
+            self.log.error('PicoHarp: Settings not applied.\n{0}'.format('\n'.join(errors)))
+            return -1
 
+        failed = list()
+        for key in self._SETTING_KEYS:
+            if key not in validated or self._settings_cache.get(key) == validated[key]:
+                continue
+            ret = self._call_setting(key, validated[key])
+            if ret == 0:
+                self._settings_cache[key] = validated[key]
+            else:
+                self._settings_cache.pop(key, None)
+                failed.append(ret)
+        # error messages are only composed once all calls are done:
+        for ret in failed:
+            self.check(ret)
+        return failed[0] if failed else 0
+
+    def _validate_setting(self, key, value):
+        """ Check a single setting of apply_settings against the device limits.
+
+        @param str key: name of the setting
+        @param value: the requested value
+
+        @return tuple(value, str): the value converted to the types passed to
+                                   the library and an error message (None if
+                                   the value is valid)
+        """
+        try:
+            if key == 'binning':
+                value = int(value)
+                if not(0 <= value < self.BINSTEPSMAX):
+                    return value, ('Invalid binning.\nValue must be within the range [{0},{1}] '
+                                   'bins, but a value of {2} has been passed.'
+                                   ''.format(0, self.BINSTEPSMAX - 1, value))
+            elif key == 'offset':
+                value = int(value)
+                if not(self.OFFSETMIN <= value <= self.OFFSETMAX):
+                    return value, ('Invalid offset.\nValue must be within the range [{0},{1}] '
+                                   'ps, but a value of {2} has been passed.'
+                                   ''.format(self.OFFSETMIN, self.OFFSETMAX, value))
+            elif key == 'sync_div':
+                value = int(value)
+                if value not in (1, 2, 4, 8) or not(self.SYNCDIVMIN <= value <= self.SYNCDIVMAX):
+                    return value, ('Invalid sync devider.\nValue must be 1, 2, 4 or 8 but a '
+                                   'value of {0} was passed.'.format(value))
+            elif key == 'sync_offset':
+                value = int(value)
+                if not(self.SYNCOFFSMIN <= value <= self.SYNCOFFSMAX):
+                    return value, ('Invalid Synchronization offset.\nValue must be within the '
+                                   'range [{0},{1}] ps but a value of {2} has been passed.'
+                                   ''.format(self.SYNCOFFSMIN, self.SYNCOFFSMAX, value))
+            elif key in ('input_cfd0', 'input_cfd1'):
+                level, zerocross = (int(val) for val in value)
+                value = (level, zerocross)
+                if not(self.DISCRMIN <= level <= self.DISCRMAX):
+                    return value, ('Invalid CFD level.\nValue must be within the range [{0},{1}] '
+                                   'millivolts but a value of {2} has been passed.'
+                                   ''.format(self.DISCRMIN, self.DISCRMAX, level))
+                if not(self.ZCMIN <= zerocross <= self.ZCMAX):
+                    return value, ('Invalid CFD zero cross.\nValue must be within the range '
+                                   '[{0},{1}] millivolts but a value of {2} has been passed.'
+                                   ''.format(self.ZCMIN, self.ZCMAX, zerocross))
+            elif key == 'stop_overflow':
+                stop_ovfl, stopcount = (int(val) for val in value)
+                value = (stop_ovfl, stopcount)
+                if stop_ovfl not in (0, 1):
+                    return value, ('Invalid overflow parameter.\nThe overflow parameter must be '
+                                   'either 0 or 1 but a value of {0} was passed.'
+                                   ''.format(stop_ovfl))
+                if not(0 <= stopcount < self.HISTCHAN):
+                    return value, ('Invalid stopcount parameter.\nstopcount must be within the '
+                                   'range [0,{0}] but a value of {1} was passed.'
+                                   ''.format(self.HISTCHAN - 1, stopcount))
+            elif key == 'multistop_enable':
+                value = 1 if value else 0
+            elif key in ('marker_edges', 'marker_enable'):
+                value = tuple(int(val) for val in value)
+                if len(value) != 4 or any(val not in (0, 1) for val in value):
+                    return value, ('All the marker settings of "{0}" must be either 0 or 1 for '
+                                   'the 4 markers, but {1} was passed.'.format(key, value))
+            elif key == 'marker_holdofftime':
+                value = int(value)
+                if not(0 <= value <= self.HOLDOFFMAX):
+                    return value, ('Holdofftime could not be set.\nValue of holdofftime must be '
+                                   'within the range [0,{0}], but a value of {1} was passed.'
+                                   ''.format(self.HOLDOFFMAX, value))
+        except (TypeError, ValueError):
+            return value, 'Invalid value {0!r} for the setting "{1}".'.format(value, key)
+        return value, None
+
+    @_after_calibration
+    def _call_setting(self, key, value):
+        """ Pass a single validated setting to the library.
+
+        @param str key: name of the setting
+        @param value: the validated value as returned by _validate_setting
+
+        @return int: return code of the library call
+        """
+        dev = self._deviceID
+        if key == 'binning':
+            return self._dll.PH_SetBinning(dev, value)
+        if key == 'offset':
+            return self._dll.PH_SetOffset(dev, value)
+        if key == 'sync_div':
+            return self._dll.PH_SetSyncDiv(dev, value)
+        if key == 'sync_offset':
+            return self._dll.PH_SetSyncOffset(dev, value)
+        if key == 'input_cfd0':
+            return self._dll.PH_SetInputCFD(dev, 0, *value)
+        if key == 'input_cfd1':
+            return self._dll.PH_SetInputCFD(dev, 1, *value)
+        if key == 'stop_overflow':
+            return self._dll.PH_SetStopOverflow(dev, *value)
+        if key == 'multistop_enable':
+            return self._dll.PH_SetMultistopEnable(dev, value)
+        if key == 'marker_edges':
+            return self._dll.PH_TTSetMarkerEdges(dev, *value)
+        if key == 'marker_enable':
+            return self._dll.PH_SetMarkerEnable(dev, *value)
+        if key == 'marker_holdofftime':
+            return self._dll.PH_SetMarkerHoldofftime(dev, value)
+        raise KeyError(key)
+
+    @_after_calibration
     def clear_hist_memory(self, block=0):
         """ Clear the histogram memory.
 
@@ -536,6 +848,7 @@ class PicoHarp300(FastCounterInterface):
         """
         self.check(self._dll.PH_ClearHistMem(self._deviceID, block))
 
+    @_after_calibration
     def start(self, acq_time):
         """ Start acquisition for 'acq_time' ms.
 
@@ -550,21 +863,26 @@ class PicoHarp300(FastCounterInterface):
         else:
             self.check(self._dll.PH_StartMeas(self._deviceID, int(acq_time)))
 
+    @_after_calibration
     def stop_device(self):
         """ Stop the measurement."""
         self.check(self._dll.PH_StopMeas(self._deviceID))
         self.meas_run = False
 
+    @_after_calibration
     def _get_status(self):
         """ Check the status of the device.
 
         @return int:  = 0: acquisition time still running
                       > 0: acquisition time has ended, measurement finished.
         """
-        ctcstatus = ctypes.c_int32()
-        self.check(self._dll.PH_CTCStatus(self._deviceID, ctypes.byref(ctcstatus)))
-        return ctcstatus.value
+        try:
+            return self._phlib.ctc_status(self._deviceID)
+        except PHLibError as err:
+            self.check(err.code)
+            return 0
 
+    @_after_calibration
     def get_histogram(self, block=0, xdata=True):
         """ Retrieve the measured histogram.
 
@@ -579,23 +897,29 @@ class PicoHarp300(FastCounterInterface):
 
         """
         chcount = np.zeros((self.HISTCHAN,), dtype=np.uint32)
-        # buf.ctypes.data is the reference to the array in the memory.
-        self.check(self._dll.PH_GetHistogram(self._deviceID, chcount.ctypes.data, block))
+        try:
+            self._phlib.get_histogram(self._deviceID, chcount, block)
+        except PHLibError as err:
+            self.check(err.code)
         if xdata:
             xbuf = np.arange(self.HISTCHAN) * self.get_resolution() / 1000
             return xbuf, chcount
         return chcount
 
+    @_after_calibration
     def get_resolution(self):
         """ Retrieve the current resolution of the picohard.
 
         @return double: resolution at current binning.
         """
 
-        resolution = ctypes.c_double()
-        self.check(self._dll.PH_GetResolution(self._deviceID, ctypes.byref(resolution)))
-        return resolution.value
+        try:
+            return self._phlib.get_resolution(self._deviceID)
+        except PHLibError as err:
+            self.check(err.code)
+            return 0.0
 
+    @_after_calibration
     def get_count_rate(self, channel):
         """ Get the current count rate for the
 
@@ -618,10 +942,13 @@ class PicoHarp300(FastCounterInterface):
                            'but {0} was passed.'.format(channel))
             return -1
         else:
-            rate = ctypes.c_int32()
-            self.check(self._dll.PH_GetCountRate(self._deviceID, channel, ctypes.byref(rate)))
-            return rate.value
+            try:
+                return self._phlib.get_count_rate(self._deviceID, channel)
+            except PHLibError as err:
+                self.check(err.code)
+                return 0
 
+    @_after_calibration
     def get_flags(self):
         """ Get the current status flag as a bit pattern.
 
@@ -634,19 +961,25 @@ class PicoHarp300(FastCounterInterface):
         results to support.
         """
 
-        flags = ctypes.c_int32()
-        self.check(self._dll.PH_GetFlags(self._deviceID, ctypes.byref(flags)))
-        return flags.value
+        try:
+            return self._phlib.get_flags(self._deviceID)
+        except PHLibError as err:
+            self.check(err.code)
+            return 0
 
+    @_after_calibration
     def get_elepased_meas_time(self):
         """ Retrieve the elapsed measurement time in ms.
 
         @return double: the elapsed measurement time in ms.
         """
-        elapsed = ctypes.c_double()
-        self.check(self._dll.PH_GetElapsedMeasTime(self._deviceID, ctypes.byref(elapsed)))
-        return elapsed.value
+        try:
+            return self._phlib.get_elapsed_meas_time(self._deviceID)
+        except PHLibError as err:
+            self.check(err.code)
+            return 0.0
 
+    @_after_calibration
     def get_warnings(self):
         """Retrieve any warnings about the device or the current measurement.
 
@@ -655,10 +988,13 @@ class PicoHarp300(FastCounterInterface):
         NOTE: you have to call PH_GetCountRates for all channels prior to this
               call!
         """
-        warnings = ctypes.c_int32()
-        self.check(self._dll.PH_GetWarnings(self._deviceID, ctypes.byref(warnings)))
-        return warnings.value
+        try:
+            return self._phlib.get_warnings(self._deviceID)
+        except PHLibError as err:
+            self.check(err.code)
+            return 0
 
+    @_after_calibration
     def get_warnings_text(self, warning_num):
         """Retrieve the warningtext for the corresponding warning bitmask.
 
@@ -671,6 +1007,7 @@ class PicoHarp300(FastCounterInterface):
         self.check(self._dll.PH_GetWarningsText(self._deviceID, warning_num, text))
         return text.value
 
+    @_after_calibration
     def get_hardware_debug_info(self):
         """ Retrieve the debug information for the current hardware.
 
@@ -686,36 +1023,32 @@ class PicoHarp300(FastCounterInterface):
     # To check whether you can use the TTTR mode (must be purchased in
     # addition) you can call PH_GetFeatures to check.
 
-    def tttr_read_fifo(self):#, num_counts):
+    def tttr_read_fifo(self, buffer=None):
         """ Read out the buffer of the FIFO.
 
-        @param int num_counts: number of TTTR records to be fetched. Maximal
-                               TTREADMAX
+        @param numpy.ndarray buffer: optional, uint32 array with TTREADMAX
+                                     entries to read the records into. If not
+                                     given, a buffer is taken from the FIFO
+                                     buffer pool. Hand it back with
+                                     release_fifo_buffer once its content is
+                                     not needed anymore.
 
         @return tuple (buffer, actual_num_counts):
                     buffer = data array where the TTTR data are stored.
                     actual_num_counts = how many numbers of TTTR could be
-                                        actually be read out. THIS NUMBER IS
-                                        NOT CHECKED FOR PERFORMANCE REASONS, SO
-                                        BE  CAREFUL! Maximum is TTREADMAX.
+                                        actually be read out. Only the first
+                                        actual_num_counts entries of buffer
+                                        are valid. Maximum is TTREADMAX.
 
         THIS FUNCTION SHOULD BE CALLED IN A SEPARATE THREAD!
 
-        Must not be called with count larger than buffer size permits. CPU time
-        during wait for completion will be yielded to other processes/threads.
-        Function will return after a timeout period of 80 ms even if not all
-        data could be fetched. Return value indicates how many records were
-        fetched. Buffer must not be accessed until the function returns!
+        CPU time during wait for completion will be yielded to other
+        processes/threads. Function will return after a timeout period of 80 ms
+        even if not all data could be fetched. Return value indicates how many
+        records were fetched. Buffer must not be accessed until the function
+        returns!
         """
 
-        # if type(num_counts) is not int:
-        #     num_counts = self.TTREADMAX
-        # elif (num_counts<0) or (num_counts>self.TTREADMAX):
-        #     self.log.error('PicoHarp: num_counts were expected to within the '
-        #                 'interval [0,{0}], but a value of {1} was '
-        #                 'passed'.format(self.TTREADMAX, num_counts))
-        #     num_counts = self.TTREADMAX
-
         # PicoHarp T3 Format (for analysis and interpretation):
         # The bit allocation in the record for the 32bit event is, starting
         # from the MSB:
@@ -729,17 +1062,36 @@ class PicoHarp300(FastCounterInterface):
         #     If it is zero, the record marks an overflow.
         #     If it is >=1 the individual bits are external markers.
 
-        num_counts = self.TTREADMAX
+        if buffer is None:
+            buffer = self._fifo_buffer_pool.acquire()
 
-        buffer = np.zeros((num_counts,), dtype=np.uint32)
+        actual_num_counts = self._read_fifo_into(buffer)
+        return buffer, max(actual_num_counts, 0)
 
-        actual_num_counts = ctypes.c_int32()
+    def release_fifo_buffer(self, buffer):
+        """ Hand a buffer returned by tttr_read_fifo back to the buffer pool.
 
-        self.check(self._dll.PH_ReadFiFo(self._deviceID, buffer.ctypes.data,
-                                         num_counts, ctypes.byref(actual_num_counts)))
+        @param numpy.ndarray buffer: the buffer or a view of it.
+        """
+        self._fifo_buffer_pool.release(buffer)
+
+    def _read_fifo_into(self, buffer):
+        """ Read the FIFO into a given buffer.
 
+        @param numpy.ndarray buffer: uint32 array with at most TTREADMAX entries.
 
-        return buffer, actual_num_counts.value
+        @return int: number of records read into the buffer or the (negative)
+                     error code of the library.
+
+        This is the read function of the FIFO reader thread. The out-parameter
+        for the number of records is reused, so do not call this concurrently
+        from different threads. The GIL is released while the library waits
+        for records.
+        """
+        try:
+            return self._phlib.read_fifo(self._deviceID, buffer)
+        except PHLibError as err:
+            return self.check(err.code)
 
     def tttr_set_marker_edges(self, me0, me1, me2, me3):
         """ Set the marker edges
@@ -751,18 +1103,7 @@ class PicoHarp300(FastCounterInterface):
         PicoHarp devices prior to hardware version 2.0 support only the first
         three markers. Default after Initialize is all rising, i.e. set to 1.
         """
-
-        if (me0 != 0) or (me0 != 1) or (me1 != 0) or (me1 != 1) or \
-                (me2 != 0) or (me2 != 1) or (me3 != 0) or (me3 != 1):
-
-            self.log.error('PicoHarp: All the marker edges must be either 0 '
-                           'or 1, but the current marker settings were passed:\n'
-                           'me0={0}, me1={1}, '
-                           'me2={2}, me3={3},'.format(me0, me1, me2, me3))
-            return
-        else:
-            self.check(self._dll.PH_TTSetMarkerEdges(self._deviceID, me0, me1,
-                                                     me2, me3))
+        return self.apply_settings({'marker_edges': (me0, me1, me2, me3)})
 
     def tttr_set_marker_enable(self, me0, me1, me2, me3):
         """ Set the marker enable or not.
@@ -774,21 +1115,9 @@ class PicoHarp300(FastCounterInterface):
         PicoHarp devices prior to hardware version 2.0 support only the first
         three markers. Default after Initialize is all rising, i.e. set to 1.
         """
+        return self.apply_settings({'marker_enable': (me0, me1, me2, me3)})
 
-        #        if ((me0 != 0) or (me0 != 1)) or ((me1 != 0) or (me1 != 1)) or \
-        #           ((me2 != 0) or (me2 != 1)) or ((me3 != 0) or (me3 != 1)):
-        #
-        #            self.log.error('PicoHarp: Could not set marker enable.\n'
-        #                        'All the marker options must be either 0 or 1, but '
-        #                        'the current marker settings were passed:\n'
-        #                        'me0={0}, me1={1}, '
-        #                        'me2={2}, me3={3},'.format(me0, me1, me2, me3))
-        #            return
-        #        else:
-        self.check(self._dll.PH_SetMarkerEnable(self._deviceID, me0,
-                                                me1, me2, me3))
-
-    def tttr_set_marker_holdofftime(self, holfofftime):
+    def tttr_set_marker_holdofftime(self, holdofftime):
         """ Set the holdofftime for the markers.
 
         @param int holdofftime: holdofftime in ns. Maximal value is HOLDOFFMAX.
@@ -800,14 +1129,8 @@ class PicoHarp300(FastCounterInterface):
         equally for all marker inputs but the holdoff logic acts on each
         marker independently.
         """
+        return self.apply_settings({'marker_holdofftime': holdofftime})
 
-        if not(0 <= holdofftime <= self.HOLDOFFMAX):
-            self.log.error('PicoHarp: Holdofftime could not be set.\n'
-                           'Value of holdofftime must be within the range '
-                           '[0,{0}], but a value of {1} was passed.'
-                           ''.format(self.HOLDOFFMAX, holfofftime))
-        else:
-            self.check(self._dll.PH_SetMarkerHoldofftime(self._deviceID, holfofftime))
 
     # =========================================================================
     #  Special functions for Routing Devices
@@ -815,6 +1138,7 @@ class PicoHarp300(FastCounterInterface):
     # If this functions wanted to be used, then you have to use the current
     # PicoHarp300 with a router device like PHR 402, PHR 403 or PHR 800.
 
+    @_after_calibration
     def get_routing_channels(self):
         """  Retrieve the number of routing channels.
 
@@ -825,17 +1149,19 @@ class PicoHarp300(FastCounterInterface):
             self._deviceID, ctypes.byref(routing_channels)))
         return routing_channels.value
 
+    @_after_calibration
     def set_enable_routing(self, use_router):
         """ Configure whether the connected router is used or not.
 
-        @param int use_router: 0 = enable routing
-                               1 = disable routing
+        @param int use_router: 0 = disable routing
+                               1 = enable routing
 
         Note: This function can also be used to detect the presence of a router!
         """
 
         return self.check(self._dll.PH_EnableRouting(self._deviceID, use_router))
 
+    @_after_calibration
     def get_router_version(self):
         """ Retrieve the model number and the router version.
 
@@ -852,6 +1178,7 @@ class PicoHarp300(FastCounterInterface):
 
         return [model_number.value.decode(), version_number.value.decode()]
 
+    @_after_calibration
     def set_routing_channel_offset(self, offset_time):
         """ Set the offset for the routed channels to compensate cable delay.
 
@@ -875,6 +1202,7 @@ class PicoHarp300(FastCounterInterface):
         else:
             self.check(self._dll.PH_SetRoutingChannelOffset(self._deviceID, offset_time))
 
+    @_after_calibration
     def set_phr800_input(self, channel, level, edge):
         """ Configure the input channels of the PHR800 device.
 
@@ -914,6 +1242,7 @@ class PicoHarp300(FastCounterInterface):
 
         self.check(self._dll.PH_SetPHR800Input(self._deviceID, channel, level, edge))
 
+    @_after_calibration
     def set_phr800_cfd(self, channel, dscrlevel, zerocross):
         """ Set the Constant Fraction Discriminators (CFD) for the PHR800 device.
 
@@ -996,6 +1325,8 @@ class PicoHarp300(FastCounterInterface):
         self.log.info('Picoharp: The counter allows no set up!\n'
                       'The implementation of this command ensures Interface '
                       'compatibility.')
+        # start refreshing the cached count rates:
+        self._sigStartCountRates.emit()
 
         #FIXME: make the counter channel chooseable in config
         #FIXME: add second photon source either to config or in a better way to file
@@ -1005,37 +1336,42 @@ class PicoHarp300(FastCounterInterface):
         """ Return one counter channel. """
         return ['Ctr0']
 
-    def get_constraints(self):
-        """ Get hardware limits of NI device.
-
-        @return SlowCounterConstraints: constraints class for slow counter
-
-        FIXME: ask hardware for limits when module is loaded
-        """
-        constraints = SlowCounterConstraints()
-        constraints.max_detectors = 1
-        constraints.min_count_frequency = 1e-3
-        constraints.max_count_frequency = 10e9
-        conetraints.counting_mode = [CountingMode.CONTINUOUS]
-        return constraints
-
     def get_counter(self, samples=None):
         """ Returns the current counts per second of the counter.
 
         @param int samples: if defined, number of samples to read in one go
 
         @return float: the photon counts per second
+
+        Returns the count rate cached by the last refresh, which happens every
+        100 ms (the gate time of the rate meters) while the counter is set up,
+        so this does not block.
         """
-        time.sleep(0.05)
-        return [self.get_count_rate(self._count_channel)]
+        return [self._count_rates[self._count_channel]]
+
+    @QtCore.Slot()
+    def _update_count_rates(self):
+        """ Refresh the cached count rates of both inputs. """
+        if self.is_calibrating:
+            return
+        for channel in (0, 1):
+            self._count_rates[channel] = self.get_count_rate(channel)
+
+    @QtCore.Slot()
+    def _fifo_data_available(self):
+        """ Analyze the blocks waiting in the FIFO ring buffer. """
+        with self.threadlock:
+            self.process_fifo_data()
 
     def close_counter(self):
         """ Closes the counter and cleans up afterwards. Actually, you do not
-        have to do anything with the picoharp. Therefore this command will do
-        nothing and is only here for SlowCounterInterface compatibility.
+        have to do anything with the picoharp. Therefore this command only
+        stops refreshing the cached count rates and is here for
+        SlowCounterInterface compatibility.
 
         @return int: error code (0:OK, -1:error)
         """
+        self._sigStopCountRates.emit()
         return 0
 
     def close_clock(self):
@@ -1051,31 +1387,219 @@ class PicoHarp300(FastCounterInterface):
     #  Functions for the FastCounter Interface
     # =========================================================================
 
-    #FIXME: The interface connection to the fast counter must be established!
+    def get_constraints(self):
+        """ Retrieve the hardware constrains from the Fast counting device.
+
+        @return dict: dict with keys being the constraint names as string and
+                      items are the definition for the constaints.
+
+        In T3 mode the time bins are the device resolution (the base resolution
+        times 2^binning code) and multiples of it combined on the host.
+        """
+        constraints = dict()
+
+        # the unit of those entries are seconds per bin, covering the device
+        # resolutions and host side rebinning up to the full dtime range:
+        constraints['hardware_binwidth_list'] = [self.BASERESOLUTION * 2**exponent * 1e-12
+                                                 for exponent in range(self.BINSTEPSMAX + 12)]
+        return constraints
 
-    def configure(self, bin_width_ns, record_length_ns, number_of_gates = 0):
+    def configure(self, bin_width_s, record_length_s, number_of_gates=0):
+        """ Configuration of the fast counter.
+
+        @param float bin_width_s: Length of a single time bin in the time trace
+                                  histogram in seconds.
+        @param float record_length_s: Total length of the timetrace/each single
+                                      gate in seconds.
+        @param int number_of_gates: optional, number of gates in the pulse
+                                    sequence. Ignore for not gated counter.
+
+        @return tuple(binwidth_s, gate_length_s, number_of_gates):
+                    binwidth_s: float the actual set binwidth in seconds
+                    gate_length_s: the actual set gate length in seconds
+                    number_of_gates: the number of gated, which are accepted
+
+        The device is operated in T3 mode. The 12 bit start-stop time limits
+        the record length to 4096 times the device resolution, so the smallest
+        binning code covering the record length is chosen and the time bins
+        are combined on the host to match the requested bin width.
+
+        With the ConfigOption hardware_histogram for an ungated counter, the
+        device is operated in histogram mode instead, see _configure_hist_mode.
+
+        With the ConfigOption router_channels, the photons of each routing
+        channel are histogrammed separately (shifted by the delays in
+        router_channel_offsets) and get_data_trace returns the traces stacked
+        along a leading channel axis.
         """
-        Configuration of the fast counter.
-        bin_width_ns: Length of a single time bin in the time trace histogram
-                      in nanoseconds.
-        record_length_ns: Total length of the timetrace/each single gate in
-                          nanoseconds.
-        number_of_gates: Number of gates in the pulse sequence. Ignore for
-                         ungated counter.
+        self._wait_for_calibration()
+        if self._hardware_histogram and not self._gated and self._router_channels == 0:
+            return self._configure_hist_mode(bin_width_s, record_length_s)
+        self._hist_mode = False
+        resolution_ps, rebin, bin_count = self._configure_t3_binning(bin_width_s,
+                                                                     record_length_s)
+
+        self._number_of_gates = int(number_of_gates) if self._gated else 0
+        self._bin_width_s = rebin * resolution_ps * 1e-12
+        self._record_length_s = bin_count * self._bin_width_s
+
+        channel_offsets = None
+        if self._router_channels > 0:
+            self.set_enable_routing(1)
+            if self._router_channel_offsets:
+                # in units of the device resolution, the dtime unit:
+                channel_offsets = [int(round(offset / resolution_ps))
+                                   for offset in self._router_channel_offsets]
+
+        self._decoder = PicoHarpTTTRDecoder(mode=self.MODE_T3)
+        try:
+            self._histogram = TTTRHistogram(bin_count=bin_count,
+                                            rebin=rebin,
+                                            number_of_gates=self._number_of_gates,
+                                            gate_marker_mask=self._gate_marker_mask,
+                                            channel_count=self._router_channels,
+                                            channel_offsets=channel_offsets)
+        except ValueError as err:
+            self.log.error('PicoHarp: {0}'.format(err))
+            self._histogram = None
+        self._correlator = None
+        self._flim = None
+        return self._bin_width_s, self._record_length_s, self._number_of_gates
+
+    def _configure_t3_binning(self, bin_width_s, record_length_s):
+        """ Initialize the device in T3 mode with the binning code covering
+        the record length.
+
+        @param float bin_width_s: requested length of a time bin in seconds
+        @param float record_length_s: requested record length in seconds
+
+        @return tuple(resolution_ps, rebin, bin_count): the device resolution,
+                the number of dtime units combined into one time bin on the
+                host and the number of time bins
+
+        The 12 bit start-stop time limits the record length to 4096 times the
+        device resolution, so the smallest binning code covering the record
+        length is chosen.
+        """
+        bin_width_ps = max(bin_width_s * 1e12, self.BASERESOLUTION)
+        record_length_ps = max(record_length_s * 1e12, bin_width_ps)
+
+        binning = 0
+        while binning < self.BINSTEPSMAX - 1 and \
+                self.BASERESOLUTION * 2**binning * 4096 < record_length_ps:
+            binning += 1
+
+        self.initialize(self.MODE_T3)
+        self.set_binning(binning)
+        resolution_ps = self.BASERESOLUTION * 2**binning
+
+        rebin = max(1, int(round(bin_width_ps / resolution_ps)))
+        bin_count = int(np.ceil(record_length_ps / (rebin * resolution_ps)))
+        # all bins must be reachable with the 12 bit start-stop time:
+        bin_count = max(1, min(bin_count, int(np.ceil(4096 / rebin))))
+        return resolution_ps, rebin, bin_count
+
+    def _configure_hist_mode(self, bin_width_s, record_length_s):
+        """ Configure the device for histogram mode, where the device bins the
+        start-stop times itself and no TTTR records are transferred at all.
+
+        @param float bin_width_s: Length of a single time bin in seconds.
+        @param float record_length_s: Total length of the timetrace in seconds.
+
+        @return tuple(binwidth_s, record_length_s, number_of_gates): the actual
+                set values like configure
+
+        The binning code with the resolution closest to (but not above) the
+        requested bin width is chosen. Wider bins than the coarsest device
+        resolution are combined on the host. The HISTCHAN device channels
+        limit the record length.
+        """
+        bin_width_ps = max(bin_width_s * 1e12, self.BASERESOLUTION)
+        record_length_ps = max(record_length_s * 1e12, bin_width_ps)
+
+        binning = 0
+        while binning < self.BINSTEPSMAX - 1 and \
+                self.BASERESOLUTION * 2**(binning + 1) <= bin_width_ps:
+            binning += 1
+
+        self.initialize(self.MODE_HIST)
+        self.set_binning(binning)
+        resolution_ps = self.BASERESOLUTION * 2**binning
+
+        rebin = max(1, int(round(bin_width_ps / resolution_ps)))
+        bin_count = int(np.ceil(record_length_ps / (rebin * resolution_ps)))
+        bin_count = max(1, min(bin_count, self.HISTCHAN // rebin))
+
+        self._hist_mode = True
+        self._hist_rebin = rebin
+        self._hist_bin_count = bin_count
+        if self._hist_buffer is None:
+            self._hist_buffer = np.zeros(self.HISTCHAN, dtype=np.uint32)
+        self._hist_accumulator = IncrementalHistogram(bin_count)
+        self._number_of_gates = 0
+        self._bin_width_s = rebin * resolution_ps * 1e-12
+        self._record_length_s = bin_count * self._bin_width_s
+
+        # no TTTR records in histogram mode:
+        self._decoder = None
+        self._histogram = None
+        self._correlator = None
+        self._flim = None
+        return self._bin_width_s, self._record_length_s, self._number_of_gates
+
+    def _read_hist_mode_histogram(self, refresh=True):
+        """ Read the device histogram into the persistent buffer and
+        accumulate the counts added since the previous read.
+
+        @param bool refresh: optional, restart a running measurement with a
+                             cleared device memory once a bin reaches
+                             HISTBINREFRESH, so the 16 bit bins never saturate.
+
+        Saturated bins (FLAG_OVERFLOW) are logged once and put the counter into
+        the error state.
         """
-        #        self.initialize(mode=3)
-        self._bin_width_ns = bin_width_ns
-        self._record_length_ns = record_length_ns
-        self._number_of_gates = number_of_gates
+        device_bins = self._accumulate_hist_mode_histogram()
+        peak = int(device_bins.max()) if device_bins.size > 0 else 0
+        if peak >= self.HISTBINMAX or self.get_flags() & ph_constants.FLAG_OVERFLOW:
+            if not self._hist_overflow:
+                self.log.error('PicoHarp: The histogram bins saturated at {0:d} counts, the '
+                               'time trace is clipped. Poll the data more often or lower the '
+                               'count rate.'.format(self.HISTBINMAX))
+            self._hist_overflow = True
+        elif refresh and self.meas_run and peak >= self.HISTBINREFRESH:
+            # end this run with its final counts and continue with a cleared
+            # device memory, like continue_measure:
+            self.stop_device()
+            self._accumulate_hist_mode_histogram()
+            self._hist_elapsed_offset += self.get_elepased_meas_time()
+            self._continue_hist_mode()
+
+    def _continue_hist_mode(self):
+        """ Start a new run with a cleared device memory, the host keeps the
+        accumulated trace.
+        """
+        self.meas_run = True
+        self.clear_hist_memory()
+        self._hist_accumulator.mark_cleared()
+        self.start(self.ACQTMAX)
 
-        #FIXME: actualle only an unsigned array will be needed. Change that later.
-        #        self.data_trace = np.zeros(number_of_gates, dtype=np.int64 )
-        self.data_trace = [0]*number_of_gates
-        self.count = 0
+    @_after_calibration
+    def _accumulate_hist_mode_histogram(self):
+        """ Copy the device histogram and accumulate the counts added since the
+        previous read.
 
-        self.result = []
-        self.initialize(2)
-        return
+        @return numpy.ndarray: the device bins of the time trace, before rebinning
+        """
+        try:
+            self._phlib.get_histogram(self._deviceID, self._hist_buffer, 0)
+        except PHLibError as err:
+            self.check(err.code)
+        device_bins = self._hist_buffer[:self._hist_bin_count * self._hist_rebin]
+        snapshot = device_bins
+        if self._hist_rebin > 1:
+            snapshot = snapshot.reshape(-1, self._hist_rebin).sum(axis=1, dtype=np.int64)
+        self._hist_accumulator.add_snapshot(snapshot)
+        return device_bins
 
     def get_status(self):
         """
@@ -1090,6 +1614,11 @@ class PicoHarp300(FastCounterInterface):
         if not self.connected_to_device:
             return -1
         else:
+            self._device_flags |= self.get_flags()
+            if self._device_flags & ph_constants.FLAG_SYSERROR:
+                return -1
+            if self._hist_mode and self._hist_overflow:
+                return -1
             returnvalue = self._get_status()
             if returnvalue == 0:
                 return 2
@@ -1109,22 +1638,43 @@ class PicoHarp300(FastCounterInterface):
         """
         Continues the current measurement if the fast counter is in pause state.
         """
-        self.meas_run = True
-        self.start(self._record_length_ns/1e6)
+        if self._hist_mode:
+            # the device memory is cleared, the host keeps the accumulated trace:
+            with self.threadlock:
+                if self.module_state() == 'idle':
+                    self.module_state.lock()
+                self._continue_hist_mode()
+            return
+
+        self._wait_for_calibration()
+        with self.threadlock:
+            if self.module_state() == 'idle':
+                self.module_state.lock()
+            self.meas_run = True
+            # the ring was analyzed by stop_measure and the time tags of the device start at 0
+            # again, the histogram, correlator and FLIM accumulators keep the data of the
+            # previous runs:
+            if self._decoder is not None:
+                self._decoder.restart()
+            # the gate sequence starts again with the first marker of the new run:
+            if self._histogram is not None:
+                self._histogram.restart()
+            self._fifo_ring.reset()
+            self.start(self.ACQTMAX)
+            self._reader_thread.start()
 
     def is_gated(self):
         """
         Boolean return value indicates if the fast counter is a gated counter
         (TRUE) or not (FALSE).
         """
-        return False
+        return bool(self._gated)
 
     def get_binwidth(self):
         """
         returns the width of a single timebin in the timetrace in seconds
         """
-        #FIXME: Must be implemented
-        return 2e-9
+        return self._bin_width_s
 
     def get_data_trace(self):
         """
@@ -1136,11 +1686,259 @@ class PicoHarp300(FastCounterInterface):
             returnarray[timebin_index].
           - If the counter is gated it will return a 2D-numpy-array with
             returnarray[gate_index, timebin_index]
+          - With PHR800 routing channels (ConfigOption router_channels), a
+            leading axis separates the channels, i.e.
+            returnarray[channel_index, timebin_index] or
+            returnarray[channel_index, gate_index, timebin_index]
+
+        The records are binned as soon as they are pulled from the FIFO ring
+        buffer, so this only copies the histogram. In histogram mode, the
+        device histogram is read instead.
+        """
+        if self._hist_mode:
+            with self.threadlock:
+                elapsed_ms = 0.0
+                if self.meas_run:
+                    # may restart the run and advance the elapsed time offset:
+                    self._read_hist_mode_histogram()
+                    elapsed_ms = self.get_elepased_meas_time()
+                elapsed_ms += self._hist_elapsed_offset
+                data = self._hist_accumulator.total.copy()
+            return data, {'elapsed_sweeps': None, 'elapsed_time': elapsed_ms / 1e3}
+
+        # the ring buffer has a single consumer:
+        with self.threadlock:
+            self.process_fifo_data()
+            if self._histogram is None:
+                self.log.error('PicoHarp: No time trace available, the fast '
+                               'counter has to be configured first.')
+                return np.zeros(0, dtype=np.int64), {'elapsed_sweeps': None,
+                                                     'elapsed_time': None}
+            data = self._histogram.snapshot()
+            info_dict = {'elapsed_sweeps': self._histogram.elapsed_sweeps,
+                         'elapsed_time': self.get_elepased_meas_time() / 1e3}
+            info_dict.update(self._fifo_info())
+        return data, info_dict
+
+    def set_event_windows(self, signal_windows, reference_windows=None):
+        """
+        Count the photons in a signal and a reference window of every laser pulse as the T3
+        records arrive, see get_window_sums.
+
+        @param numpy.ndarray signal_windows: [start, end) time bins of the signal window of each
+                                             laser pulse, shape [number_of_lasers, 2]. Gated, the
+                                             bins index the flattened time trace.
+        @param numpy.ndarray reference_windows: optional, reference windows in the same format
+
+        @return int: error code (0:OK, -1:error)
+        """
+        with self.threadlock:
+            if self._histogram is None:
+                self.log.error('PicoHarp: Event windows can only be set after the fast counter '
+                               'has been configured.')
+                return -1
+            # catch up with the records waiting in the ring, so the initial sums are complete
+            self.process_fifo_data()
+            try:
+                self._histogram.set_windows(signal_windows, reference_windows)
+            except ValueError as err:
+                self.log.error('PicoHarp: {0}'.format(err))
+                return -1
+        return 0
+
+    def clear_event_windows(self):
+        """ Stop counting the photons in the laser pulse windows. """
+        with self.threadlock:
+            if self._histogram is not None:
+                self._histogram.clear_windows()
+
+    def get_window_sums(self):
         """
+        Get the number of photons counted in the windows set by set_event_windows since the
+        measurement started. Cheaper than get_data_trace for large time traces, since only two
+        numbers per laser pulse are copied.
+
+        @return tuple(numpy.ndarray, numpy.ndarray, dict): signal and reference window sums per
+                                                           laser pulse (None if no windows are
+                                                           set) and the info_dict of
+                                                           get_data_trace
+        """
+        with self.threadlock:
+            self.process_fifo_data()
+            if self._histogram is None or not self._histogram.has_windows:
+                return None, None, {'elapsed_sweeps': None, 'elapsed_time': None}
+            signal_sums, reference_sums = self._histogram.window_sums()
+            info_dict = {'elapsed_sweeps': self._histogram.elapsed_sweeps,
+                         'elapsed_time': self.get_elepased_meas_time() / 1e3}
+            info_dict.update(self._fifo_info())
+        return signal_sums, reference_sums, info_dict
+
+    # =========================================================================
+    #  Correlation (g2) measurement in T2 mode
+    # =========================================================================
+
+    def configure_correlation(self, bin_width_s, max_lag_s, start_channel=0,
+                              stop_channel=1):
+        """ Operate the device in T2 mode and correlate the photons of two
+        channels while they arrive, e.g. for an antibunching measurement.
+
+        @param float bin_width_s: width of a lag bin in seconds
+        @param float max_lag_s: largest absolute lag in seconds, the lags
+                                cover [-max_lag_s, max_lag_s)
+        @param int start_channel: optional, channel of the start photons
+        @param int stop_channel: optional, channel of the stop photons
 
-        info_dict = {'elapsed_sweeps': None,
-                     'elapsed_time': None}  # TODO : implement that according to hardware capabilities
-        return self.data_trace, info_dict
+        @return tuple(bin_width_s, max_lag_s): the actual set values
+
+        The measurement is started and stopped with start_measure and
+        stop_measure like the fast counter. Configuring the fast counter
+        again switches back to T3 mode and removes the correlator.
+        """
+        # T2 time tags are in units of the base resolution:
+        bin_width = max(1, int(round(bin_width_s * 1e12 / self.BASERESOLUTION)))
+        max_lag = max(bin_width, int(np.ceil(max_lag_s * 1e12 / self.BASERESOLUTION)))
+        self._wait_for_calibration()
+        with self.threadlock:
+            self.initialize(self.MODE_T2)
+            self._hist_mode = False
+            self._histogram = None
+            self._flim = None
+            self._decoder = PicoHarpTTTRDecoder(mode=self.MODE_T2)
+            self._correlator = TTTRCorrelator(bin_width=bin_width,
+                                              max_lag=max_lag,
+                                              start_channel=start_channel,
+                                              stop_channel=stop_channel)
+        return (self._correlator.bin_width * self.BASERESOLUTION * 1e-12,
+                self._correlator.max_lag * self.BASERESOLUTION * 1e-12)
+
+    def get_correlation(self, normalized=True):
+        """ Get a snapshot of the correlation measured since start_measure.
+
+        @param bool normalized: optional, normalize the coincidences to
+                                uncorrelated light, i.e. return g2(tau)
+
+        @return tuple(numpy.ndarray, numpy.ndarray, dict): lower bin edges
+                    in seconds, g2(tau) or the coincidence counts per bin
+                    and a dict with the photon counts of both channels and
+                    the elapsed time in seconds. (None, None, dict) if no
+                    correlation is configured.
+        """
+        with self.threadlock:
+            self.process_fifo_data()
+            if self._correlator is None:
+                return None, None, {'start_counts': None, 'stop_counts': None,
+                                    'elapsed_time': None}
+            tick_s = self.BASERESOLUTION * 1e-12
+            lags = self._correlator.lags() * tick_s
+            if normalized:
+                data = self._correlator.normalized()
+            else:
+                data = self._correlator.snapshot()
+            info_dict = {'start_counts': self._correlator.start_count,
+                         'stop_counts': self._correlator.stop_count,
+                         'elapsed_time': self._correlator.elapsed_time * tick_s}
+        return lags, data, info_dict
+
+    # =========================================================================
+    #  FLIM imaging in T3 mode with scanner markers
+    # =========================================================================
+
+    def configure_flim(self, pixels_per_line, lines, bin_width_s, record_length_s,
+                       pixel_marker=0, line_marker=1, frame_marker=None):
+        """ Operate the device in T3 mode and sort the photons into the pixels
+        of an image by the pixel and line clocks of a scanner, which are
+        connected to the marker inputs.
+
+        @param int pixels_per_line: number of pixels per line
+        @param int lines: number of lines per frame
+        @param float bin_width_s: width of an arrival time bin in seconds
+        @param float record_length_s: arrival time range in seconds, 0 for no
+                                      arrival time histograms at all (only the
+                                      intensity and mean arrival time images)
+        @param int pixel_marker: optional, marker input (0 to 3) of the pixel
+                                 clock
+        @param int line_marker: optional, marker input of the line clock
+        @param int frame_marker: optional, marker input of the frame clock
+
+        @return tuple(bin_width_s, record_length_s): the actual set values
+
+        The markers are enabled on their rising edges. The memory of the
+        [line, pixel, arrival time] cube is lines * pixels_per_line *
+        record_length_s / bin_width_s * 4 bytes, choose a wide bin width for
+        large images. The measurement is started and stopped with
+        start_measure and stop_measure like the fast counter. Configuring the
+        fast counter again removes the FLIM image.
+        """
+        markers = [pixel_marker, line_marker] + ([] if frame_marker is None else [frame_marker])
+        if any(not 0 <= int(marker) <= 3 for marker in markers) or \
+                len(set(markers)) != len(markers):
+            self.log.error('PicoHarp: The FLIM clocks need distinct marker inputs from 0 to 3, '
+                           'got {0}.'.format(markers))
+            return -1
+        self._wait_for_calibration()
+        with self.threadlock:
+            self._hist_mode = False
+            resolution_ps, rebin, bin_count = self._configure_t3_binning(
+                bin_width_s, max(record_length_s, bin_width_s))
+            if record_length_s <= 0:
+                bin_count = 0
+            enable = [0, 0, 0, 0]
+            for marker in markers:
+                enable[int(marker)] = 1
+            self.tttr_set_marker_edges(1, 1, 1, 1)
+            self.tttr_set_marker_enable(*enable)
+
+            self._histogram = None
+            self._correlator = None
+            self._decoder = PicoHarpTTTRDecoder(mode=self.MODE_T3)
+            try:
+                self._flim = FLIMImage(pixels_per_line=pixels_per_line,
+                                       lines=lines,
+                                       dtime_bins=bin_count,
+                                       rebin=rebin,
+                                       pixel_marker_mask=1 << int(pixel_marker),
+                                       line_marker_mask=1 << int(line_marker),
+                                       frame_marker_mask=0 if frame_marker is None else
+                                       1 << int(frame_marker))
+            except (ValueError, MemoryError) as err:
+                self.log.error('PicoHarp: FLIM image could not be created: {0}'.format(err))
+                self._flim = None
+                return -1
+            self._flim_resolution_s = resolution_ps * 1e-12
+        bin_width_s = rebin * resolution_ps * 1e-12
+        return bin_width_s, bin_count * bin_width_s
+
+    def get_flim_images(self):
+        """ Get the live intensity and fast lifetime image of the FLIM scan.
+
+        @return tuple(numpy.ndarray, numpy.ndarray, dict): photon counts and
+                    mean photon arrival time in seconds (NaN without photons)
+                    per pixel, both of shape [lines, pixels_per_line], and a
+                    dict with the number of frames and discarded photons.
+                    (None, None, dict) if no FLIM image is configured.
+        """
+        with self.threadlock:
+            self.process_fifo_data()
+            if self._flim is None:
+                return None, None, {'frames': None, 'discarded_photons': None}
+            intensity = self._flim.intensity()
+            lifetime = self._flim.mean_arrival_time() * self._flim_resolution_s
+            info_dict = {'frames': self._flim.frames,
+                         'discarded_photons': self._flim.discarded_photons}
+        return intensity, lifetime, info_dict
+
+    def get_flim_data(self):
+        """ Get the arrival time histograms of all pixels of the FLIM scan.
+
+        @return numpy.ndarray: uint32 array of shape [lines, pixels_per_line,
+                               arrival time bins], None if no FLIM image is
+                               configured
+        """
+        with self.threadlock:
+            self.process_fifo_data()
+            if self._flim is None:
+                return None
+            return self._flim.snapshot()
 
     # =========================================================================
     #  Test routine for continuous readout
@@ -1151,41 +1949,212 @@ class PicoHarp300(FastCounterInterface):
         """
         Starts the fast counter.
         """
-        self.lock()
-
-        self.meas_run = True
-
-        # start the device:
-        self.start(int(self._record_length_ns/1e6))
+        self._wait_for_calibration()
+        with self.threadlock:
+            if self.module_state() == 'idle':
+                self.module_state.lock()
+
+            self.meas_run = True
+
+            if self._hist_mode:
+                self.clear_hist_memory()
+                self._hist_accumulator.reset()
+                self._hist_elapsed_offset = 0.0
+                self._hist_overflow = False
+                self.start(self.ACQTMAX)
+                return
 
-        self.sigReadoutPicoharp.emit()
+            # a new measurement starts without any previous overflows and
+            # with an empty histogram:
+            if self._decoder is not None:
+                self._decoder.reset()
+            if self._histogram is not None:
+                self._histogram.reset()
+            if self._correlator is not None:
+                self._correlator.reset()
+            if self._flim is not None:
+                self._flim.reset()
+            self._fifo_ring.reset()
+            self._reader_thread.reset_counters()
+            self._stage_metrics.reset()
+            self._device_flags = 0
+            self._last_metrics_query = (time.perf_counter(), 0)
+
+            # start the device, it is stopped by stop_measure:
+            self.start(self.ACQTMAX)
+
+            self._reader_thread.start()
 
     def stop_measure(self):
-        """ By setting the Flag, the measurement should stop.  """
-        self.meas_run = False
+        """ Stop the FIFO reader thread and the measurement. """
+        with self.threadlock:
+            if self._hist_mode and self.meas_run:
+                # keep the counts and time of this run for a continued measurement:
+                self._read_hist_mode_histogram(refresh=False)
+                self._hist_elapsed_offset += self.get_elepased_meas_time()
+            self.meas_run = False
+            self._stop_reader_thread()
+            if self.module_state() == 'locked':
+                self.stop_device()
+                # analyze what is left in the ring buffer:
+                self.process_fifo_data()
+                self.module_state.unlock()
 
+    def _stop_reader_thread(self):
+        """ Let the FIFO reader thread finish its current read and wait for it. """
+        if self._reader_thread is not None and self._reader_thread.isRunning():
+            self._reader_thread.request_stop()
+            # one FIFO read returns at the latest after the device TIMEOUT:
+            self._reader_thread.wait()
 
-    def get_fresh_data_loop(self):
-        """ This method will be run infinitely until the measurement stops. """
+    def process_fifo_data(self):
+        """ Pull all blocks read by the FIFO reader thread and analyze them.
 
-        # for testing one can also take another array:
-        buffer, actual_counts = self.tttr_read_fifo()
-        #        buffer, actual_counts = [1,2,3,4,5,6,7,8,9], 9
+        @return int: number of processed FIFO blocks.
 
-        # This analysis signel should be analyzed in a queued thread:
-        self.sigAnalyzeData.emit(buffer[0:actual_counts-1], actual_counts)
+        This is called by the consumer of the data (e.g. get_data_trace) and
+        does not depend on the Qt event loop.
+        """
+        blocks = 0
+        if self._fifo_ring is None:
+            return blocks
+        records = self._fifo_ring.peek()
+        while records is not None:
+            if self._ptu_writer is not None:
+                start = time.perf_counter()
+                self._ptu_writer.write(records)
+                self._stage_metrics.record('record', start, records.size)
+            self.analyze_received_data(records, records.size)
+            self._fifo_ring.release()
+            blocks += 1
+            records = self._fifo_ring.peek()
+        return blocks
+
+    def _fifo_info(self):
+        """ Cheap FIFO read path counters for the info_dict of get_data_trace.
+
+        @return dict: records read from the FIFO, records dropped because the
+                      ring buffer was full and blocks waiting in the ring
+        """
+        return {'records_read': self._reader_thread.records_read,
+                'dropped_records': self._fifo_ring.dropped_records,
+                'ring_occupancy': self._fifo_ring.occupancy}
+
+    def get_metrics(self):
+        """ Query the counters of the acquisition and processing path, e.g. to
+        find out where throughput is lost.
+
+        @return dict: with the keys
+            'records_read': records read from the FIFO since the start,
+            'records_per_s': read rate since the previous call of get_metrics,
+            'reads', 'full_reads', 'read_errors': FIFO reads, reads filling a
+                whole TTREADMAX block (the reader does not get ahead of the
+                device) and failed reads,
+            'ring_occupancy', 'ring_peak_occupancy', 'ring_block_count',
+            'dropped_blocks', 'dropped_records': state of the ring buffer
+                between the reader thread and the analysis,
+            'flags': PH_GetFlags bits accumulated since the start,
+            'fifo_full', 'histogram_overflow', 'system_error': the decoded
+                FLAG_FIFOFULL, FLAG_OVERFLOW and FLAG_SYSERROR bits,
+            'warnings': the PH_GetWarnings bits,
+            'stages': latencies of the decode, histogram, flim, correlate and
+                record stages, see StageLatency.to_dict
+
+        The counters are written by the threads owning them only, so reading
+        them does not lock the acquisition. Only the flags and warnings are
+        queried from the device.
+        """
+        if self.connected_to_device:
+            self._device_flags |= self.get_flags()
+            if not self._count_rate_timer.isActive():
+                # the warnings are only valid after reading the count rates:
+                self._update_count_rates()
+            self._device_warnings = self.get_warnings()
+
+        now = time.perf_counter()
+        records_read = self._reader_thread.records_read
+        last_time, last_records = self._last_metrics_query
+        self._last_metrics_query = (now, records_read)
+        records_per_s = (records_read - last_records) / (now - last_time) if now > last_time else 0
+
+        flags = self._device_flags
+        return {'records_read': records_read,
+                'records_per_s': records_per_s,
+                'reads': self._reader_thread.reads,
+                'full_reads': self._reader_thread.full_reads,
+                'read_errors': self._reader_thread.read_errors,
+                'ring_occupancy': self._fifo_ring.occupancy,
+                'ring_peak_occupancy': self._fifo_ring.peak_occupancy,
+                'ring_block_count': self._fifo_ring.block_count,
+                'dropped_blocks': self._fifo_ring.dropped_blocks,
+                'dropped_records': self._fifo_ring.dropped_records,
+                'flags': flags,
+                'fifo_full': bool(flags & ph_constants.FLAG_FIFOFULL),
+                'histogram_overflow': bool(flags & ph_constants.FLAG_OVERFLOW),
+                'system_error': bool(flags & ph_constants.FLAG_SYSERROR),
+                'warnings': self._device_warnings,
+                'stages': self._stage_metrics.snapshot()}
+
+    def start_recording(self, file_path, comment=''):
+        """ Stream all raw TTTR records pulled from the FIFO into a PTU file.
+
+        @param str file_path: path of the PTU file to create
+        @param str comment: optional, comment stored in the file header
 
-        if not self.meas_run:
-            with self.threadlock:
-                self.unlock()
-                self.stop_device()
-                return
+        @return int: error code (0:OK, -1:error)
 
-        print('get new data.')
-        # get the next data:
-        self.sigReadoutPicoharp.emit()
+        The file can be re-analyzed offline with ptu_file.PTUReader, which
+        feeds the records through the same decoder.
+        """
+        if self._mode not in (self.MODE_T2, self.MODE_T3):
+            self.log.error('PicoHarp: Raw records can only be recorded in T2 '
+                           'or T3 mode.')
+            return -1
+        with self.threadlock:
+            self._stop_recording()
+            if self._mode == self.MODE_T2:
+                record_type = 'PicoHarpT2'
+                resolution = self.BASERESOLUTION * 1e-12
+                global_resolution = resolution
+            else:
+                record_type = 'PicoHarpT3'
+                resolution = self.get_resolution() * 1e-12
+                sync_rate = self.get_count_rate(0)
+                global_resolution = 1 / sync_rate if sync_rate > 0 else 0.0
+            try:
+                writer = PTUWriter(file_path,
+                                   record_type=record_type,
+                                   resolution_s=resolution,
+                                   global_resolution_s=global_resolution,
+                                   hardware_info=self.get_hardware_info(),
+                                   comment=comment)
+                writer.open()
+            except OSError:
+                self.log.exception('PicoHarp: Could not create the PTU file '
+                                   '"{0}".'.format(file_path))
+                return -1
+            self._ptu_writer = writer
+        return 0
 
+    def stop_recording(self):
+        """ Stop streaming raw records to the PTU file and close it.
 
+        @return int: number of records written to the file
+        """
+        with self.threadlock:
+            return self._stop_recording()
+
+    def _stop_recording(self):
+        if self._ptu_writer is None:
+            return 0
+        # write the records still waiting in the ring buffer:
+        self.process_fifo_data()
+        writer = self._ptu_writer
+        self._ptu_writer = None
+        writer.close()
+        self.log.info('PicoHarp: {0} records written to "{1}".'
+                      ''.format(writer.number_of_records, writer.file_path))
+        return writer.number_of_records
 
     def analyze_received_data(self, arr_data, actual_counts):
         """ Analyze the actual data obtained from the TTTR mode of the device.
@@ -1193,8 +2162,8 @@ class PicoHarp300(FastCounterInterface):
         @param arr_data: numpy uint32 array with length 'actual_counts'.
         @param actual_counts: int, number of read out events from the buffer.
 
-        Write the obtained arr_data to the predefined array data_trace,
-        initialized in the configure method.
+        The decoded photon records are binned into the time trace histogram
+        created in the configure method.
 
         The received array contains 32bit words. The bit assignment starts from
         the MSB (most significant bit), which is here displayed as the most
@@ -1267,36 +2236,22 @@ class PicoHarp300(FastCounterInterface):
                       the channel-number are set to high (i.e. 1).
         """
 
-        # at first just a simple test
-        time.sleep(0.2)
-
-        self.data_trace[self.count] = actual_counts
-        self.count += 1
-
-        if self.count > self._number_of_gates-1:
-            self.count = 0
-
-        if actual_counts == self.TTREADMAX:
-            self.log.warning('Overflow!')
-
-        print('Data analyzed.')
-
-#        self.result = []
-#        for entry in arr_data[0:actual_counts-1]:
-#
-#            # apply three bitmasks to extract the relavent numbers:
-#            overflow = entry & (2**(32-1) )
-#            marker_ch = entry & (2**(32-2)  + 2**(32-3) + 2**(32-4))
-#            time_tag = entry & (2**32 -1 - 2**(32-1) + 2**(32-2) + 2**(32-3) + 2**(32-4))
-
-
-
-
-
-
-
-
-
-
-
-
+        if self._decoder is None:
+            self._decoder = PicoHarpTTTRDecoder(mode=self._mode)
+
+        # decode the whole block at once, the overflow time is carried over to
+        # the next block by the decoder:
+        start = time.perf_counter()
+        self._last_events = self._decoder.decode(arr_data[:actual_counts])
+        self._stage_metrics.record('decode', start, actual_counts)
+
+        start = time.perf_counter()
+        if self._histogram is not None and self._decoder.mode == self.MODE_T3:
+            self._histogram.add(self._last_events)
+            self._stage_metrics.record('histogram', start, actual_counts)
+        elif self._flim is not None and self._decoder.mode == self.MODE_T3:
+            self._flim.add(self._last_events)
+            self._stage_metrics.record('flim', start, actual_counts)
+        elif self._correlator is not None and self._decoder.mode == self.MODE_T2:
+            self._correlator.add(self._last_events)
+            self._stage_metrics.record('correlate', start, actual_counts)
@@ -0,0 +1,554 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains the qudi hardware module using a PicoHarp 300 in T2 mode as streaming photon
+counter: the time tags of both inputs are binned into count samples of a fixed sample rate.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import ctypes
+import time
+import numpy as np
+from PySide2 import QtCore
+
+from qudi.core.configoption import ConfigOption
+from qudi.core.statusvariable import StatusVar
+from qudi.util.mutex import Mutex
+from qudi.interface.data_instream_interface import DataInStreamInterface, DataInStreamConstraints
+from qudi.interface.data_instream_interface import StreamingMode, StreamChannelType, StreamChannel
+from qudi.hardware.picoquant import ph_constants
+from qudi.hardware.picoquant.device_discovery import load_library, open_device
+from qudi.hardware.picoquant.phlib import PHLib, PHLibError
+from qudi.hardware.picoquant.tttr_decoder import PicoHarpTTTRDecoder
+from qudi.hardware.picoquant.tttr_acquisition import TTTRBlockRing, TTTRReaderThread
+from qudi.hardware.picoquant.tttr_count_trace import TTTRCountTrace
+
+
+class PicoHarp300InStreamer(DataInStreamInterface):
+    """ Streaming count source on top of the PicoHarp 300 T2 mode, e.g. for the time series reader.
+
+    The FIFO is read by a separate thread into a ring buffer of record blocks. The blocks are
+    decoded as they arrive and the photon time tags of the active channels are counted in bins of
+    1 / sample_rate, so count traces with sample rates up to the MHz range are available without
+    any software timing. A sample becomes available once the device time passed the end of its bin,
+    at low count rates this happens at the latest with the next time tag wraparound (about 1 ms).
+    The device has to be used exclusively by this module.
+
+    Example config for copy-paste:
+
+    picoharp300_instream:
+        module.Class: 'picoquant.picoharp300_instream.PicoHarp300InStreamer'
+        deviceID: 0 # a device index from 0 to 7.
+        serial: None # optional, serial number of the device, takes precedence over deviceID. Only with a serial number other device IDs are searched
+        input_cfd: [[10, 7], [10, 7]] # optional, CFD level and zero cross in mV of ch0 and ch1
+        sync_div: 1 # optional, input rate divider of ch0 (1, 2, 4 or 8)
+        fifo_ring_blocks: 32 # optional, number of TTREADMAX blocks buffered between FIFO reader and binning
+    """
+
+    _deviceID = ConfigOption('deviceID', 0, missing='warn')
+    _device_serial = ConfigOption('serial', None)
+    _input_cfd = ConfigOption('input_cfd', [[10, 7], [10, 7]])
+    _sync_div = ConfigOption('sync_div', 1)
+    _fifo_ring_blocks = ConfigOption('fifo_ring_blocks', 32)
+
+    # serial number to device index of the devices seen in previous activations
+    _device_index_cache = StatusVar('device_index_cache', default=dict())
+
+    # in ps, T2 time tags are in units of the base resolution
+    BASERESOLUTION = 4
+    # in Hz
+    MAX_SAMPLE_RATE = 10e6
+    CHANNELS = ('ch0', 'ch1')
+
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self._threadlock = Mutex()
+        self._dll = None
+        self._phlib = None
+        self._fifo_ring = None
+        self._reader_thread = None
+        self._decoder = PicoHarpTTTRDecoder(mode=ph_constants.MODE_T2)
+        self._trace = None
+        self._constraints = None
+
+        # settings
+        self._sample_rate = 1000.0
+        self._bin_width = 1
+        self._buffer_size = 1000000
+        self._use_circular_buffer = True
+        self._streaming_mode = StreamingMode.CONTINUOUS
+        self._stream_length = 0
+        self._active_channels = self.CHANNELS
+        self._is_running = False
+
+    def on_activate(self):
+        """ Open, initialize in T2 mode and calibrate the device. """
+        self._dll = load_library('phlib64')
+        self._phlib = PHLib(self._dll)
+
+        def open_func(index):
+            buf = ctypes.create_string_buffer(16)   # at least 8 byte
+            ret = self._dll.PH_OpenDevice(index, ctypes.byref(buf))
+            return ret, buf.value.decode()
+
+        index_cache = dict(self._device_index_cache)
+        index, serial = open_device(open_func=open_func,
+                                    close_func=self._dll.PH_CloseDevice,
+                                    device_index=self._deviceID,
+                                    serial=self._device_serial,
+                                    index_cache=index_cache,
+                                    max_devices=ph_constants.MAXDEVNUM)
+        if index < 0:
+            raise RuntimeError('PicoHarp300InStreamer: No PicoHarp 300 could be opened.')
+        self._deviceID = index
+        self._device_index_cache = index_cache
+        if self.check(self._dll.PH_Initialize(index, ph_constants.MODE_T2)) < 0 or \
+                self.check(self._dll.PH_Calibrate(index)) < 0:
+            self._dll.PH_CloseDevice(index)
+            raise RuntimeError('PicoHarp300InStreamer: Initialization of the PicoHarp 300 with '
+                               'serial number {0} failed.'.format(serial))
+        for channel, (level, zerocross) in enumerate(self._input_cfd):
+            self.check(self._dll.PH_SetInputCFD(index, channel, int(level), int(zerocross)))
+        self.check(self._dll.PH_SetSyncDiv(index, int(self._sync_div)))
+        self.log.info('PicoHarp300InStreamer: using device {0:d} (serial number {1}).'
+                      ''.format(index, serial))
+
+        self._constraints = DataInStreamConstraints()
+        self._constraints.digital_channels = tuple(
+            StreamChannel(name=ch, type=StreamChannelType.DIGITAL, unit='counts')
+            for ch in self.CHANNELS)
+        self._constraints.analog_channels = tuple()
+        for rate in (self._constraints.digital_sample_rate,
+                     self._constraints.combined_sample_rate):
+            rate.min = 1
+            rate.max = self.MAX_SAMPLE_RATE
+            rate.step = 1
+            rate.unit = 'Hz'
+        self._constraints.read_block_size.min = 1
+        self._constraints.read_block_size.max = 10000000
+        self._constraints.read_block_size.step = 1
+        self._constraints.streaming_modes = (StreamingMode.CONTINUOUS,)
+        self._constraints.data_type = np.float64
+        self._constraints.allow_circular_buffer = True
+
+        self._fifo_ring = TTTRBlockRing(block_count=self._fifo_ring_blocks,
+                                        block_size=ph_constants.TTREADMAX)
+        self._reader_thread = TTTRReaderThread(read_fifo=self._read_fifo_into,
+                                               ring=self._fifo_ring)
+        # bin the blocks as soon as they arrive instead of only on demand:
+        self._reader_thread.sigDataAvailable.connect(self._fifo_data_available,
+                                                     QtCore.Qt.QueuedConnection)
+        self.sample_rate = self._sample_rate
+
+    def on_deactivate(self):
+        """ Stop a running stream and close the device. """
+        self.stop_stream()
+        self._reader_thread.sigDataAvailable.disconnect()
+        self._reader_thread = None
+        self._fifo_ring = None
+        self._trace = None
+        self.check(self._dll.PH_CloseDevice(self._deviceID))
+        self._dll = None
+        self._phlib = None
+
+    def check(self, func_val):
+        """ Log the error codes returned by the library.
+
+        @param int func_val: return error code of the called function
+
+        @return int: the error code
+        """
+        if func_val != 0:
+            self.log.error('Error in PicoHarp300 with errorcode {0}:\n{1}'.format(
+                func_val, ph_constants.ERROR_CODES.get(func_val, 'unknown error')))
+        return func_val
+
+    def _read_fifo_into(self, buffer):
+        """ Read function of the FIFO reader thread, see PicoHarp300._read_fifo_into. """
+        try:
+            return self._phlib.read_fifo(self._deviceID, buffer)
+        except PHLibError as err:
+            return self.check(err.code)
+
+    # =============================================================================================
+    @property
+    def sample_rate(self):
+        """
+        The currently set sample rate, i.e. the inverse bin width (a multiple of the 4 ps base
+        resolution)
+
+        @return float: current sample rate in Hz
+        """
+        return self._sample_rate
+
+    @sample_rate.setter
+    def sample_rate(self, rate):
+        if self._check_settings_change():
+            rate = float(rate)
+            if not 0 < rate <= self.MAX_SAMPLE_RATE:
+                self.log.warning('Sample rate requested ({0:.3e}Hz) is out of bounds. Please '
+                                 'choose a value between 1Hz and {1:.3e}Hz. Value will be clipped '
+                                 'to the closest boundary.'.format(rate, self.MAX_SAMPLE_RATE))
+                rate = max(min(self.MAX_SAMPLE_RATE, rate), 1)
+            self._bin_width = max(1, int(round(1e12 / (rate * self.BASERESOLUTION))))
+            self._sample_rate = 1e12 / (self._bin_width * self.BASERESOLUTION)
+
+    @property
+    def data_type(self):
+        return np.float64
+
+    @property
+    def buffer_size(self):
+        """
+        The currently set buffer size in samples per channel.
+
+        @return int: current buffer size in samples per channel
+        """
+        return self._buffer_size
+
+    @buffer_size.setter
+    def buffer_size(self, size):
+        if self._check_settings_change():
+            size = int(size)
+            if size < 1:
+                self.log.error('Buffer size smaller than 1 makes no sense. Tried to set {0} as '
+                               'buffer size and failed.'.format(size))
+                return
+            self._buffer_size = size
+
+    @property
+    def use_circular_buffer(self):
+        return self._use_circular_buffer
+
+    @use_circular_buffer.setter
+    def use_circular_buffer(self, flag):
+        if self._check_settings_change():
+            self._use_circular_buffer = bool(flag)
+
+    @property
+    def streaming_mode(self):
+        return self._streaming_mode
+
+    @streaming_mode.setter
+    def streaming_mode(self, mode):
+        if self._check_settings_change():
+            mode = StreamingMode(mode)
+            if mode not in self._constraints.streaming_modes:
+                self.log.error('Unknown streaming mode "{0}" encountered.\nValid modes are: {1}.'
+                               ''.format(mode, self._constraints.streaming_modes))
+                return
+            self._streaming_mode = mode
+
+    @property
+    def stream_length(self):
+        """ Ignored, only continuous streaming is supported. """
+        return self._stream_length
+
+    @stream_length.setter
+    def stream_length(self, length):
+        if self._check_settings_change():
+            length = int(length)
+            if length < 1:
+                self.log.error('Stream_length must be a positive integer >= 1.')
+                return
+            self._stream_length = length
+
+    @property
+    def number_of_channels(self):
+        return len(self._active_channels)
+
+    @property
+    def active_channels(self):
+        return tuple(ch.copy() for ch in self._constraints.digital_channels
+                     if ch.name in self._active_channels)
+
+    @active_channels.setter
+    def active_channels(self, channels):
+        if self._check_settings_change():
+            channels = tuple(channels)
+            if not channels or any(ch not in self.CHANNELS for ch in channels):
+                self.log.error('Invalid channel to stream from encountered: {0}.\nValid channels '
+                               'are: {1}'.format(channels, self.CHANNELS))
+                return
+            # keep the channel order of the device, the sample rows follow it
+            self._active_channels = tuple(ch for ch in self.CHANNELS if ch in channels)
+
+    @property
+    def available_channels(self):
+        return tuple(ch.copy() for ch in self._constraints.digital_channels)
+
+    @property
+    def available_samples(self):
+        """
+        Number of complete samples per channel ready to read. The records read from the FIFO so
+        far are binned first.
+
+        @return int: Number of available samples per channel
+        """
+        with self._threadlock:
+            if self._trace is None:
+                return 0
+            self._bin_fifo_blocks()
+            return self._trace.available
+
+    @property
+    def buffer_overflown(self):
+        with self._threadlock:
+            return False if self._trace is None else self._trace.overflown
+
+    @property
+    def is_running(self):
+        return self._is_running
+
+    @property
+    def all_settings(self):
+        return {'sample_rate': self._sample_rate,
+                'streaming_mode': self._streaming_mode,
+                'active_channels': self.active_channels,
+                'stream_length': self._stream_length,
+                'buffer_size': self._buffer_size,
+                'use_circular_buffer': self._use_circular_buffer}
+
+    def configure(self, sample_rate=None, streaming_mode=None, active_channels=None,
+                  stream_length=None, buffer_size=None, use_circular_buffer=None):
+        """
+        Method to configure all possible settings of the data input stream.
+
+        @param float sample_rate: The sample rate in Hz at which data points are acquired
+        @param StreamingMode streaming_mode: The streaming mode to use (finite or continuous)
+        @param iterable active_channels: Iterable of channel names (str) to be read from.
+        @param int stream_length: In case of a finite data stream, the total number of
+                                            samples to read per channel
+        @param int buffer_size: The size of the data buffer to pre-allocate in samples per channel
+        @param bool use_circular_buffer: Use circular buffering (True) or stop upon buffer overflow
+                                         (False)
+
+        @return dict: All current settings in a dict. Keywords are the same as kwarg names.
+        """
+        if self._check_settings_change():
+            if sample_rate is not None:
+                self.sample_rate = sample_rate
+            if streaming_mode is not None:
+                self.streaming_mode = streaming_mode
+            if active_channels is not None:
+                self.active_channels = active_channels
+            if stream_length is not None:
+                self.stream_length = stream_length
+            if buffer_size is not None:
+                self.buffer_size = buffer_size
+            if use_circular_buffer is not None:
+                self.use_circular_buffer = use_circular_buffer
+        return self.all_settings
+
+    def get_constraints(self):
+        return self._constraints.copy()
+
+    def start_stream(self):
+        """
+        Start the measurement of the device and the FIFO reader thread.
+
+        @return int: error code (0: OK, -1: Error)
+        """
+        with self._threadlock:
+            if self._is_running:
+                self.log.warning('Unable to start input stream. It is already running.')
+                return 0
+            channels = [self.CHANNELS.index(ch) for ch in self._active_channels]
+            self._trace = TTTRCountTrace(bin_width=self._bin_width,
+                                         channels=channels,
+                                         buffer_size=self._buffer_size,
+                                         dtype=self.data_type)
+            self._decoder.reset()
+            self._fifo_ring.reset()
+            if self.check(self._dll.PH_StartMeas(self._deviceID, ph_constants.ACQTMAX)) < 0:
+                return -1
+            self._reader_thread.start()
+            self._is_running = True
+            if self.module_state() == 'idle':
+                self.module_state.lock()
+        return 0
+
+    def stop_stream(self):
+        """
+        Stop the measurement and the FIFO reader thread. The samples binned so far can still be
+        read.
+
+        @return int: error code (0: OK, -1: Error)
+        """
+        with self._threadlock:
+            if not self._is_running:
+                return 0
+            if self._reader_thread.isRunning():
+                self._reader_thread.request_stop()
+                # one FIFO read returns at the latest after the device timeout:
+                self._reader_thread.wait()
+            ret = self.check(self._dll.PH_StopMeas(self._deviceID))
+            self._bin_fifo_blocks()
+            self._is_running = False
+            if self.module_state() == 'locked':
+                self.module_state.unlock()
+        return 0 if ret == 0 else -1
+
+    def _bin_fifo_blocks(self):
+        """ Decode and bin the record blocks read by the FIFO reader thread. Call with the
+        threadlock held.
+        """
+        records = self._fifo_ring.peek()
+        while records is not None:
+            events = self._decoder.decode(records)
+            self._fifo_ring.release()
+            self._trace.add(events, time_reached=self._decoder.overflow_time)
+            records = self._fifo_ring.peek()
+
+    @QtCore.Slot()
+    def _fifo_data_available(self):
+        """ Bin the newly read record blocks. Without a circular buffer, an overflow of the sample
+        buffer stops the stream.
+        """
+        with self._threadlock:
+            if not self._is_running:
+                return
+            self._bin_fifo_blocks()
+            stop = self._trace.overflown and not self._use_circular_buffer
+        if stop:
+            self.log.error('PicoHarp300InStreamer: sample buffer overflown, stopping the stream.')
+            self.stop_stream()
+
+    def _samples_view(self, buffer, number_of_samples):
+        """ Check a read buffer and get a (channels, samples) view of it.
+
+        @return tuple(numpy.ndarray, int): the view (None on error) and the number of samples
+        """
+        if not isinstance(buffer, np.ndarray) or buffer.dtype != self.data_type:
+            self.log.error('buffer must be numpy.ndarray with dtype {0}. Read failed.'
+                           ''.format(self.data_type))
+            return None, 0
+        if buffer.ndim == 2:
+            if buffer.shape[0] != self.number_of_channels:
+                self.log.error('Configured number of channels ({0:d}) does not match first '
+                               'dimension of 2D buffer array ({1:d}).'
+                               ''.format(self.number_of_channels, buffer.shape[0]))
+                return None, 0
+            view = buffer
+        elif buffer.ndim == 1:
+            samples = buffer.size // self.number_of_channels
+            view = buffer[:samples * self.number_of_channels].reshape(
+                (self.number_of_channels, samples))
+        else:
+            self.log.error('Buffer must be a 1D or 2D numpy.ndarray.')
+            return None, 0
+        if number_of_samples is None:
+            number_of_samples = view.shape[1]
+        return view, min(int(number_of_samples), view.shape[1])
+
+    def read_data_into_buffer(self, buffer, number_of_samples=None):
+        """
+        Read data from the stream buffer into a 1D/2D numpy array given as parameter, see
+        DataInStreamInterface.read_data_into_buffer. Waits until the samples are complete, at most
+        twice their acquisition time plus 1 s.
+
+        @param numpy.ndarray buffer: The numpy array to write the samples to
+        @param int number_of_samples: optional, number of samples to read per channel. If omitted,
+                                      this number will be derived from buffer axis 1 size.
+
+        @return int: Number of samples read into buffer; negative value indicates error
+                     (e.g. read timeout)
+        """
+        if self._trace is None:
+            self.log.error('Unable to read data. Device is not running.')
+            return -1
+        view, number_of_samples = self._samples_view(buffer, number_of_samples)
+        if view is None:
+            return -1
+        if number_of_samples < 1:
+            return 0
+        deadline = time.perf_counter() + 2 * number_of_samples / self._sample_rate + 1
+        while self.available_samples < number_of_samples:
+            if not self._is_running or time.perf_counter() > deadline:
+                self.log.error('Read timeout: only {0:d} of {1:d} samples available.'
+                               ''.format(self.available_samples, number_of_samples))
+                return -1
+            time.sleep(0.001)
+        with self._threadlock:
+            return self._trace.read_into(view, number_of_samples)
+
+    def read_available_data_into_buffer(self, buffer):
+        """
+        Read all currently available samples (as many as fit) into a 1D/2D numpy array, see
+        DataInStreamInterface.read_available_data_into_buffer.
+
+        @param numpy.ndarray buffer: The numpy array to write the samples to
+
+        @return int: Number of samples read into buffer; negative value indicates error
+        """
+        if self._trace is None:
+            self.log.error('Unable to read data. Device is not running.')
+            return -1
+        view, number_of_samples = self._samples_view(buffer, None)
+        if view is None:
+            return -1
+        with self._threadlock:
+            self._bin_fifo_blocks()
+            return self._trace.read_into(view, number_of_samples)
+
+    def read_data(self, number_of_samples=None):
+        """
+        Read data from the stream buffer into a new 2D numpy array of shape
+        (number_of_channels, number_of_samples), see DataInStreamInterface.read_data.
+
+        @param int number_of_samples: optional, number of samples to read per channel. If omitted,
+                                      all available samples are read from buffer.
+
+        @return numpy.ndarray: The read samples
+        """
+        if self._trace is None:
+            self.log.error('Unable to read data. Device is not running.')
+            return np.empty((0, 0), dtype=self.data_type)
+        if number_of_samples is None:
+            number_of_samples = self.available_samples
+        data = np.empty((self.number_of_channels, int(number_of_samples)), dtype=self.data_type)
+        read_samples = self.read_data_into_buffer(data, number_of_samples=number_of_samples)
+        if read_samples != number_of_samples:
+            return np.empty((0, 0), dtype=self.data_type)
+        return data
+
+    def read_single_point(self):
+        """
+        Get the newest complete sample of each active channel.
+
+        @return numpy.ndarray: 1D array containing one sample for each channel. Empty array
+                               indicates error.
+        """
+        if self._trace is None:
+            self.log.error('Unable to read data. Device is not running.')
+            return np.empty(0, dtype=self.data_type)
+        with self._threadlock:
+            self._bin_fifo_blocks()
+            return self._trace.latest()
+
+    def _check_settings_change(self):
+        """
+        Helper method to check if streamer settings can be changed, i.e. if the streamer is idle.
+        Throw a warning if the streamer is running.
+
+        @return bool: Flag indicating if settings can be changed (True) or not (False)
+        """
+        if self._is_running:
+            self.log.warning('Unable to change streamer settings while streamer is running. '
+                             'New settings ignored.')
+            return False
+        return True
@@ -0,0 +1,244 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains the qudi hardware module reading several PicoHarp 300 devices in T2 mode in
+parallel and merging their photon records into one time-ordered stream.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import ctypes
+import threading
+
+from qudi.core.configoption import ConfigOption
+from qudi.core.module import Base
+from qudi.util.mutex import Mutex
+from qudi.hardware.picoquant import ph_constants
+from qudi.hardware.picoquant.device_discovery import load_library
+from qudi.hardware.picoquant.phlib import PHLib, PHLibError
+from qudi.hardware.picoquant.tttr_decoder import PicoHarpTTTRDecoder
+from qudi.hardware.picoquant.tttr_acquisition import TTTRBlockRing, TTTRReaderThread
+from qudi.hardware.picoquant.tttr_merge import TTTRStreamMerger
+
+
+class _PicoHarpStream:
+    """ FIFO read path of one device: ring buffer, reader thread and decoder.
+
+    The PHLib binding keeps an out-parameter for PH_ReadFiFo per device, so the reader threads of
+    different devices never share any state.
+    """
+
+    def __init__(self, phlib, device_index, ring_blocks, check):
+        self.device_index = device_index
+        self._phlib = phlib
+        self._check = check
+        self.ring = TTTRBlockRing(block_count=ring_blocks, block_size=ph_constants.TTREADMAX)
+        self.reader_thread = TTTRReaderThread(read_fifo=self._read_fifo_into, ring=self.ring)
+        self.decoder = PicoHarpTTTRDecoder(mode=ph_constants.MODE_T2)
+
+    def _read_fifo_into(self, buffer):
+        try:
+            return self._phlib.read_fifo(self.device_index, buffer)
+        except PHLibError as err:
+            return self._check(err.code, self.device_index)
+
+    def reset(self):
+        self.decoder.reset()
+        self.ring.reset()
+
+    def stop_reader(self):
+        if self.reader_thread.isRunning():
+            self.reader_thread.request_stop()
+            # one FIFO read returns at the latest after the device timeout:
+            self.reader_thread.wait()
+
+
+class PicoHarp300Multi(Base):
+    """ Hardware module reading up to MAXDEVNUM PicoHarp 300 devices in T2 mode at once.
+
+    The devices are opened, initialized and calibrated concurrently. During a measurement every
+    device has its own FIFO reader thread and ring buffer, so the readout rate scales with the
+    number of devices. get_merged_events decodes the blocks read so far and merges the photons of
+    all devices into one time-ordered stream, correcting each device by its sync offset.
+
+    Example config for copy-paste:
+
+    picoharp300_multi:
+        module.Class: 'picoquant.picoharp300_multi.PicoHarp300Multi'
+        device_ids: [0, 1] # device indices from 0 to 7
+        sync_offsets: [0, 0] # optional, time offset of each device in ps
+        fifo_ring_blocks: 32 # optional, number of TTREADMAX blocks buffered per device
+        acquisition_time: 360000000 # optional, acquisition time in ms, stopped by stop_measure
+    """
+
+    _device_ids = ConfigOption('device_ids', default=[0], missing='warn')
+    _sync_offsets = ConfigOption('sync_offsets', default=None)
+    _fifo_ring_blocks = ConfigOption('fifo_ring_blocks', default=32)
+    _acquisition_time = ConfigOption('acquisition_time', default=ph_constants.ACQTMAX)
+
+    # in ps, T2 time tags are in units of the base resolution
+    BASERESOLUTION = 4
+
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self._threadlock = Mutex()
+        self._dll = None
+        self._streams = list()
+        self._merger = None
+        self._running = False
+
+    def on_activate(self):
+        """ Open, initialize and calibrate all configured devices concurrently. """
+        device_ids = [int(index) for index in self._device_ids]
+        if len(set(device_ids)) != len(device_ids) or \
+                any(not 0 <= index < ph_constants.MAXDEVNUM for index in device_ids):
+            raise ValueError('PicoHarp300Multi needs distinct device indices from 0 to {0:d}, got '
+                             '{1}.'.format(ph_constants.MAXDEVNUM - 1, device_ids))
+        offsets_ps = self._sync_offsets if self._sync_offsets else [0] * len(device_ids)
+        if len(offsets_ps) != len(device_ids):
+            raise ValueError('PicoHarp300Multi needs one sync offset per device.')
+
+        # the library is loaded once per process:
+        self._dll = load_library('phlib64')
+
+        # calibration takes a while for every device, so do it for all of them at the same time:
+        results = dict()
+        threads = [threading.Thread(target=self._open_device, args=(index, results),
+                                    name='PicoHarp300Multi-open-{0:d}'.format(index))
+                   for index in device_ids]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        failed = [index for index in device_ids if results.get(index, -1) < 0]
+        if failed:
+            for index in device_ids:
+                if index not in failed:
+                    self._dll.PH_CloseDevice(index)
+            raise RuntimeError('PicoHarp300Multi could not open the devices {0}.'.format(failed))
+
+        phlib = PHLib(self._dll)
+        self._streams = [_PicoHarpStream(phlib=phlib,
+                                         device_index=index,
+                                         ring_blocks=self._fifo_ring_blocks,
+                                         check=self._check)
+                         for index in device_ids]
+        self._merger = TTTRStreamMerger(
+            stream_count=len(device_ids),
+            offsets=[int(round(offset / self.BASERESOLUTION)) for offset in offsets_ps]
+        )
+
+    def on_deactivate(self):
+        """ Stop a running measurement and close all devices. """
+        self.stop_measure()
+        for stream in self._streams:
+            self._check(self._dll.PH_CloseDevice(stream.device_index), stream.device_index)
+        self._streams = list()
+        self._merger = None
+        self._dll = None
+
+    def _open_device(self, index, results):
+        """ Open, initialize in T2 mode and calibrate a single device. Runs in its own thread.
+
+        @param int index: device index
+        @param dict results: error code of each device index, filled by this method
+        """
+        serial = ctypes.create_string_buffer(16)
+        ret = self._check(self._dll.PH_OpenDevice(index, ctypes.byref(serial)), index)
+        if ret >= 0:
+            ret = self._check(self._dll.PH_Initialize(index, ph_constants.MODE_T2), index)
+            if ret >= 0:
+                ret = self._check(self._dll.PH_Calibrate(index), index)
+            if ret < 0:
+                self._dll.PH_CloseDevice(index)
+            else:
+                self.log.info('PicoHarp300Multi: device {0:d} (serial {1}) ready.'
+                              ''.format(index, serial.value.decode()))
+        results[index] = ret
+
+    def _check(self, func_val, device_index):
+        """ Log the error codes returned by the library.
+
+        @param int func_val: return error code of the called function
+        @param int device_index: index of the device the function was called for
+
+        @return int: the error code
+        """
+        if func_val != 0:
+            self.log.error('Error in PicoHarp300 device {0:d} with errorcode {1}:\n{2}'.format(
+                device_index, func_val, ph_constants.ERROR_CODES.get(func_val, 'unknown error')))
+        return func_val
+
+    @property
+    def device_ids(self):
+        return [stream.device_index for stream in self._streams]
+
+    @property
+    def is_running(self):
+        return self._running
+
+    def start_measure(self):
+        """ Start all devices and their FIFO reader threads. """
+        with self._threadlock:
+            if self._running:
+                return
+            self._merger.reset()
+            for stream in self._streams:
+                stream.reset()
+            for stream in self._streams:
+                self._check(self._dll.PH_StartMeas(stream.device_index,
+                                                   int(self._acquisition_time)),
+                            stream.device_index)
+            for stream in self._streams:
+                stream.reader_thread.start()
+            self._running = True
+            if self.module_state() == 'idle':
+                self.module_state.lock()
+
+    def stop_measure(self):
+        """ Stop all devices and their FIFO reader threads. The records read so far can still be
+        pulled with get_merged_events.
+        """
+        with self._threadlock:
+            if not self._running:
+                return
+            for stream in self._streams:
+                stream.reader_thread.request_stop()
+            for stream in self._streams:
+                stream.stop_reader()
+                self._check(self._dll.PH_StopMeas(stream.device_index), stream.device_index)
+            self._running = False
+            if self.module_state() == 'locked':
+                self.module_state.unlock()
+
+    def get_merged_events(self):
+        """ Decode the records read from all devices so far and merge them in time order.
+
+        @return MergedTTTREvents: photons, whose time stamps are in units of BASERESOLUTION and
+                                  corrected by the sync offset of their device. While the
+                                  measurement runs, photons later than the time reached by the
+                                  slowest device are held back for the next call.
+        """
+        with self._threadlock:
+            for stream_index, stream in enumerate(self._streams):
+                records = stream.ring.peek()
+                while records is not None:
+                    events = stream.decoder.decode(records)
+                    self._merger.add(stream_index, events,
+                                     time_reached=stream.decoder.overflow_time)
+                    stream.ring.release()
+                    records = stream.ring.peek()
+            return self._merger.merge(flush=not self._running)
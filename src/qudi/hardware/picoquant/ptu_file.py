@@ -0,0 +1,333 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains a streaming writer and a memory-mapped reader for raw TTTR records in the
+PicoQuant unified TTTR file format (PTU).
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import os
+import struct
+import time
+import numpy as np
+
+from qudi.hardware.picoquant.tttr_decoder import PicoHarpTTTRDecoder, HydraHarpT3Decoder
+
+__all__ = ['PTUWriter', 'PTUReader', 'RECORD_TYPES']
+
+# Tag types of the PTU header
+TY_EMPTY8 = 0xFFFF0008
+TY_BOOL8 = 0x00000008
+TY_INT8 = 0x10000008
+TY_BITSET64 = 0x11000008
+TY_COLOR8 = 0x12000008
+TY_FLOAT8 = 0x20000008
+TY_TDATETIME = 0x21000008
+TY_FLOAT8ARRAY = 0x2001FFFF
+TY_ANSISTRING = 0x4001FFFF
+TY_WIDESTRING = 0x4002FFFF
+TY_BINARYBLOB = 0xFFFFFFFF
+
+# Record types (tag TTResultFormat_TTTRRecType) and the measurement mode they belong to
+RECORD_TYPES = {'PicoHarpT2': (0x00010203, 2),
+                'PicoHarpT3': (0x00010303, 3),
+                'HydraHarpT3': (0x00010304, 3),
+                'HydraHarp2T3': (0x01010304, 3)}
+
+_MAGIC = b'PQTTTR\x00\x00'
+_VERSION = b'1.0.00\x00\x00'
+_TAG_STRUCT = struct.Struct('<32siIq')
+# days between the TDateTime epoch (1899-12-30) and the unix epoch
+_TDATETIME_UNIX_OFFSET = 25569
+
+
+class PTUWriter:
+    """ Streaming writer for raw TTTR records.
+
+    The records passed to write() are collected in a staging buffer and written to disk in large
+    chunks. The header is padded so the records start at a multiple of the chunk alignment, so all
+    chunk writes are aligned as well. The number of records is written to the header on close().
+
+    Usage:
+        with PTUWriter(path, 'PicoHarpT3', resolution_s=4e-12, global_resolution_s=1e-7) as writer:
+            writer.write(records)
+    """
+    ALIGNMENT = 4096
+
+    def __init__(self, file_path, record_type, resolution_s, global_resolution_s,
+                 hardware_info=None, comment='', chunk_records=1048576):
+        """
+        @param str file_path: path of the file to create
+        @param str record_type: one of the keys of RECORD_TYPES, e.g. 'PicoHarpT3'
+        @param float resolution_s: resolution of the time tags (T2) or dtime (T3) in seconds
+        @param float global_resolution_s: resolution of the T2 time tags or sync period (T3) in s
+        @param tuple hardware_info: optional, (model, part number, version) of the device
+        @param str comment: optional, comment stored in the header
+        @param int chunk_records: number of records written to disk at once
+        """
+        if record_type not in RECORD_TYPES:
+            raise ValueError('Unknown PTU record type "{0}". Available types are: {1}'
+                             ''.format(record_type, list(RECORD_TYPES)))
+        self._file_path = file_path
+        self._record_type = record_type
+        self._resolution_s = float(resolution_s)
+        self._global_resolution_s = float(global_resolution_s)
+        self._hardware_info = tuple(hardware_info) if hardware_info else ('', '', '')
+        self._comment = str(comment)
+        # the staging buffer holds a multiple of the alignment:
+        chunk_records = max(int(chunk_records), self.ALIGNMENT // 4)
+        chunk_records -= chunk_records % (self.ALIGNMENT // 4)
+        self._staging = np.empty(chunk_records, dtype=np.uint32)
+        self._staged = 0
+        self._file = None
+        self._records_offset = 0
+        self.number_of_records = 0
+
+    @property
+    def file_path(self):
+        return self._file_path
+
+    @property
+    def is_open(self):
+        return self._file is not None
+
+    def __enter__(self):
+        self.open()
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+    def open(self):
+        """ Create the file and write the header. """
+        if self._file is not None:
+            return
+        self._file = open(self._file_path, 'wb', buffering=0)
+        self._staged = 0
+        self.number_of_records = 0
+        self._file.write(self._build_header())
+        self._records_offset = self._file.tell()
+
+    def write(self, records):
+        """ Append raw records.
+
+        @param numpy.ndarray records: uint32 records as read from the FIFO
+        """
+        records = np.asarray(records, dtype=np.uint32)
+        position = 0
+        while position < records.size:
+            count = min(records.size - position, self._staging.size - self._staged)
+            self._staging[self._staged:self._staged + count] = records[position:position + count]
+            self._staged += count
+            position += count
+            if self._staged == self._staging.size:
+                self._flush()
+        self.number_of_records += records.size
+
+    def close(self):
+        """ Write the remaining records, the number of records and close the file. """
+        if self._file is None:
+            return
+        try:
+            self._flush()
+            self._file.seek(self._number_of_records_offset)
+            self._file.write(struct.pack('<q', self.number_of_records))
+        finally:
+            self._file.close()
+            self._file = None
+
+    def _flush(self):
+        if self._staged > 0:
+            self._file.write(self._staging[:self._staged].tobytes())
+            self._staged = 0
+
+    def _build_header(self):
+        type_code, mode = RECORD_TYPES[self._record_type]
+        model, part_number, version = self._hardware_info
+        now = _TDATETIME_UNIX_OFFSET + time.time() / 86400
+        tags = [_tag('File_GUID', TY_ANSISTRING, '{{{0}}}'.format(os.urandom(16).hex())),
+                _tag('File_CreatingTime', TY_TDATETIME, now),
+                _tag('CreatorSW_Name', TY_ANSISTRING, 'qudi'),
+                _tag('HW_Type', TY_ANSISTRING, model),
+                _tag('HW_PartNo', TY_ANSISTRING, part_number),
+                _tag('HW_Version', TY_ANSISTRING, version),
+                _tag('Measurement_Mode', TY_INT8, mode),
+                _tag('Measurement_SubMode', TY_INT8, 0),
+                _tag('MeasDesc_Resolution', TY_FLOAT8, self._resolution_s),
+                _tag('MeasDesc_GlobalResolution', TY_FLOAT8, self._global_resolution_s),
+                _tag('TTResultFormat_TTTRRecType', TY_INT8, type_code),
+                _tag('TTResultFormat_BitsPerRecord', TY_INT8, 32)]
+        header = _MAGIC + _VERSION + b''.join(tags)
+        self._number_of_records_offset = len(header) + _TAG_STRUCT.size - 8
+        header += _tag('TTResult_NumberOfRecords', TY_INT8, 0)
+
+        # pad the comment, so the records start aligned after the Header_End tag:
+        end_tag = _tag('Header_End', TY_EMPTY8, 0)
+        comment = self._comment.encode('utf-8') + b'\x00'
+        unpadded = len(header) + _TAG_STRUCT.size + len(end_tag) + len(comment)
+        comment += b'\x00' * ((-unpadded) % self.ALIGNMENT)
+        header += _tag('File_Comment', TY_ANSISTRING, comment) + end_tag
+        return header
+
+
+class PTUReader:
+    """ Memory-mapped reader for the raw TTTR records of a PTU file.
+
+    The records are not loaded into memory; iterating over blocks() or decoded_blocks() only
+    touches the part of the file currently processed, so multi-GB files can be re-analyzed at
+    disk speed.
+    """
+
+    def __init__(self, file_path):
+        """
+        @param str file_path: path of the PTU file to open
+        """
+        self._file_path = file_path
+        self.tags = dict()
+        with open(file_path, 'rb') as file:
+            if file.read(8) != _MAGIC:
+                raise ValueError('"{0}" is not a PTU file.'.format(file_path))
+            self.version = file.read(8).rstrip(b'\x00').decode()
+            while True:
+                ident, index, type_code, value = _TAG_STRUCT.unpack(file.read(_TAG_STRUCT.size))
+                ident = ident.rstrip(b'\x00').decode()
+                if type_code in (TY_ANSISTRING, TY_WIDESTRING, TY_BINARYBLOB, TY_FLOAT8ARRAY):
+                    raw = file.read(value)
+                    if type_code == TY_ANSISTRING:
+                        value = raw.split(b'\x00', 1)[0].decode('utf-8', errors='replace')
+                    elif type_code == TY_WIDESTRING:
+                        value = raw.decode('utf-16-le', errors='replace').rstrip('\x00')
+                    elif type_code == TY_FLOAT8ARRAY:
+                        value = np.frombuffer(raw, dtype='<f8')
+                    else:
+                        value = raw
+                elif type_code in (TY_FLOAT8, TY_TDATETIME):
+                    value = struct.unpack('<d', struct.pack('<q', value))[0]
+                elif type_code == TY_BOOL8:
+                    value = bool(value)
+                if ident == 'Header_End':
+                    break
+                self.tags[ident if index < 0 else '{0}({1})'.format(ident, index)] = value
+            self._records_offset = file.tell()
+            available = (os.fstat(file.fileno()).st_size - self._records_offset) // 4
+
+        type_code = self.tags.get('TTResultFormat_TTTRRecType')
+        self.record_type = None
+        for name, (code, _) in RECORD_TYPES.items():
+            if code == type_code:
+                self.record_type = name
+        number_of_records = self.tags.get('TTResult_NumberOfRecords', available)
+        # a file of an interrupted recording may not contain the number of records:
+        self.number_of_records = available if number_of_records <= 0 else min(number_of_records,
+                                                                              available)
+        if self.number_of_records > 0:
+            self.records = np.memmap(file_path, dtype='<u4', mode='r',
+                                     offset=self._records_offset,
+                                     shape=(self.number_of_records,))
+        else:
+            self.records = np.zeros(0, dtype=np.uint32)
+
+    @property
+    def file_path(self):
+        return self._file_path
+
+    @property
+    def resolution(self):
+        """ Resolution of the time tags (T2) or dtime (T3) in seconds. """
+        return self.tags.get('MeasDesc_Resolution')
+
+    @property
+    def global_resolution(self):
+        """ Resolution of the T2 time tags or sync period (T3) in seconds. """
+        return self.tags.get('MeasDesc_GlobalResolution')
+
+    def create_decoder(self):
+        """ Create the decoder matching the record type of the file.
+
+        @return object: PicoHarpTTTRDecoder or HydraHarpT3Decoder
+        """
+        if self.record_type == 'PicoHarpT2':
+            return PicoHarpTTTRDecoder(mode=2)
+        if self.record_type == 'PicoHarpT3':
+            return PicoHarpTTTRDecoder(mode=3)
+        if self.record_type == 'HydraHarpT3':
+            return HydraHarpT3Decoder(version=1)
+        if self.record_type == 'HydraHarp2T3':
+            return HydraHarpT3Decoder(version=2)
+        raise ValueError('No decoder available for the TTTR record type {0} of "{1}".'
+                         ''.format(self.tags.get('TTResultFormat_TTTRRecType'), self._file_path))
+
+    def blocks(self, block_size=1048576):
+        """ Iterate over the raw records in blocks.
+
+        @param int block_size: number of records per block
+
+        @return generator: yields read-only uint32 arrays mapped to the file
+        """
+        block_size = int(block_size)
+        for start in range(0, self.number_of_records, block_size):
+            yield self.records[start:start + block_size]
+
+    def decoded_blocks(self, block_size=1048576, decoder=None):
+        """ Decode the file block by block with the same decoder used during the acquisition.
+
+        @param int block_size: number of records per block
+        @param object decoder: optional, decoder to use (create_decoder() if not given)
+
+        @return generator: yields a TTTREvents object per block
+        """
+        if decoder is None:
+            decoder = self.create_decoder()
+        decoder.reset()
+        for block in self.blocks(block_size):
+            yield decoder.decode(block)
+
+    def close(self):
+        """ Release the memory map. """
+        mmap = getattr(self.records, '_mmap', None)
+        self.records = np.zeros(0, dtype=np.uint32)
+        self.number_of_records = 0
+        if mmap is not None:
+            mmap.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+
+def _tag(ident, type_code, value, index=-1):
+    """ Pack a single tag of the PTU header.
+
+    @param str ident: name of the tag
+    @param int type_code: one of the TY_* tag types
+    @param value: value of the tag, str or bytes for TY_ANSISTRING, float for TY_FLOAT8 and
+                  TY_TDATETIME, int otherwise
+    @param int index: index of the tag for array-like tags, -1 otherwise
+
+    @return bytes: the packed tag
+    """
+    ident = ident.encode('ascii')
+    if type_code == TY_ANSISTRING:
+        data = value if isinstance(value, bytes) else value.encode('utf-8') + b'\x00'
+        # string data is padded to a multiple of 8 bytes:
+        data += b'\x00' * ((-len(data)) % 8)
+        return _TAG_STRUCT.pack(ident, index, type_code, len(data)) + data
+    if type_code in (TY_FLOAT8, TY_TDATETIME):
+        value = struct.unpack('<q', struct.pack('<d', value))[0]
+    return _TAG_STRUCT.pack(ident, index, type_code, int(value))
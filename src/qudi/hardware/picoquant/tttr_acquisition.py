@@ -0,0 +1,254 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains helper classes to continuously read the TTTR records from the FIFO of
+PicoQuant devices in a dedicated thread.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+from collections import deque
+import numpy as np
+from qtpy import QtCore
+
+__all__ = ['TTTRBufferPool', 'TTTRBlockRing', 'TTTRReaderThread']
+
+
+class TTTRBufferPool:
+    """ Fixed set of reusable record buffers for FIFO reads.
+
+    A buffer taken with acquire() must be handed back with release() once its content has been
+    consumed. Acquiring and releasing may happen in different threads.
+    If all buffers are in use, acquire() falls back to a temporary buffer, which is counted in
+    misses. A steadily increasing number of misses means the pool is too small.
+    """
+
+    def __init__(self, buffer_count=4, buffer_size=131072):
+        """
+        @param int buffer_count: number of buffers in the pool
+        @param int buffer_size: number of records per buffer (usually TTREADMAX)
+        """
+        self._buffer_size = int(buffer_size)
+        self._buffers = [np.zeros(self._buffer_size, dtype=np.uint32)
+                         for _ in range(int(buffer_count))]
+        self._buffer_ids = {id(buffer): index for index, buffer in enumerate(self._buffers)}
+        self._free = deque(range(len(self._buffers)))
+        self.misses = 0
+
+    @property
+    def buffer_size(self):
+        return self._buffer_size
+
+    @property
+    def free_buffers(self):
+        return len(self._free)
+
+    def acquire(self):
+        """ Take a buffer out of the pool.
+
+        @return numpy.ndarray: uint32 array with buffer_size entries. The content is not cleared.
+        """
+        try:
+            return self._buffers[self._free.popleft()]
+        except IndexError:
+            self.misses += 1
+            return np.empty(self._buffer_size, dtype=np.uint32)
+
+    def release(self, buffer):
+        """ Hand a buffer (or a view of it) back to the pool.
+
+        @param numpy.ndarray buffer: the buffer as returned by acquire or a view of it
+        """
+        index = self._buffer_ids.get(id(buffer))
+        if index is None and isinstance(buffer, np.ndarray) and buffer.base is not None:
+            index = self._buffer_ids.get(id(buffer.base))
+        if index is not None and index not in self._free:
+            self._free.append(index)
+
+
+class TTTRBlockRing:
+    """ Single-producer/single-consumer ring buffer of preallocated TTTR record blocks.
+
+    The producer (reader thread) only ever writes the head index and the backpressure counters,
+    the consumer only ever writes the tail index. Therefore no lock is needed to pass blocks from
+    one thread to the other.
+
+    If the consumer does not keep up and the ring is full, the producer still has to empty the
+    hardware FIFO. The records are then read into a scratch block and dropped, which is counted in
+    dropped_blocks and dropped_records.
+    """
+
+    def __init__(self, block_count=32, block_size=131072):
+        """
+        @param int block_count: number of blocks the ring can hold
+        @param int block_size: maximum number of records per block (usually TTREADMAX)
+        """
+        block_count = int(block_count)
+        block_size = int(block_size)
+        if block_count < 1 or block_size < 1:
+            raise ValueError('TTTRBlockRing needs at least one block with at least one record.')
+        self._block_count = block_count
+        self._blocks = np.zeros((block_count, block_size), dtype=np.uint32)
+        # persistent views so handing out a block does not create a new array object:
+        self._block_views = [self._blocks[slot] for slot in range(block_count)]
+        self._counts = np.zeros(block_count, dtype=np.int64)
+        self._scratch = np.zeros(block_size, dtype=np.uint32)
+        # total number of committed (head) and released (tail) blocks
+        self._head = 0
+        self._tail = 0
+        # backpressure counters
+        self.dropped_blocks = 0
+        self.dropped_records = 0
+        self.peak_occupancy = 0
+
+    @property
+    def block_count(self):
+        return self._block_count
+
+    @property
+    def block_size(self):
+        return self._scratch.size
+
+    @property
+    def occupancy(self):
+        """ Number of blocks waiting to be consumed. """
+        return self._head - self._tail
+
+    def reset(self):
+        """ Empty the ring and the backpressure counters. Must not be called while the producer is
+        running.
+        """
+        self._head = 0
+        self._tail = 0
+        self.dropped_blocks = 0
+        self.dropped_records = 0
+        self.peak_occupancy = 0
+
+    # Producer side
+
+    def acquire_write(self):
+        """ Get the next free block to read records into.
+
+        @return tuple(int, numpy.ndarray): the slot index (-1 if the ring is full and the records
+                                           will be dropped) and the buffer to fill
+        """
+        if self._head - self._tail >= self._block_count:
+            return -1, self._scratch
+        slot = self._head % self._block_count
+        return slot, self._block_views[slot]
+
+    def commit(self, slot, count):
+        """ Hand a filled block over to the consumer.
+
+        @param int slot: slot index as returned by acquire_write
+        @param int count: number of valid records in the block
+        """
+        if count <= 0:
+            return
+        if slot < 0:
+            self.dropped_blocks += 1
+            self.dropped_records += count
+            return
+        self._counts[slot] = count
+        self._head += 1
+        occupancy = self._head - self._tail
+        if occupancy > self.peak_occupancy:
+            self.peak_occupancy = occupancy
+
+    # Consumer side
+
+    def peek(self):
+        """ Get the oldest block not consumed yet without removing it from the ring.
+
+        @return numpy.ndarray: view of the valid records of the block or None if the ring is empty
+        """
+        if self._tail == self._head:
+            return None
+        slot = self._tail % self._block_count
+        return self._blocks[slot, :self._counts[slot]]
+
+    def release(self):
+        """ Give the block returned by the last call of peek back to the producer. """
+        if self._tail < self._head:
+            self._tail += 1
+
+
+class TTTRReaderThread(QtCore.QThread):
+    """ Thread continuously reading the FIFO of a PicoQuant device into a TTTRBlockRing.
+
+    The read function is called in a tight loop and must block until records are available or a
+    timeout passed (like PH_ReadFiFo does). ctypes releases the GIL during the library call, so the
+    consumer can decode and analyse the data in parallel.
+
+    sigDataAvailable is emitted whenever a block is committed to an empty ring, so a consumer
+    connected to it (queued) is woken up once per batch of blocks instead of polling the ring.
+
+    The counters reads, records_read and full_reads are only written by the thread itself. A read
+    filling the whole block means the FIFO held at least one block, i.e. the reader is not ahead
+    of the device; steadily increasing full_reads are a sign of an approaching FIFO overrun.
+    """
+
+    sigDataAvailable = QtCore.Signal()
+
+    def __init__(self, read_fifo, ring, parent=None):
+        """
+        @param callable read_fifo: function taking a uint32 buffer, filling it with records and
+                                   returning the number of records read (negative on error)
+        @param TTTRBlockRing ring: the ring buffer to fill
+        """
+        super().__init__(parent)
+        self._read_fifo = read_fifo
+        self._ring = ring
+        self._stop_requested = False
+        self.read_errors = 0
+        self.reads = 0
+        self.records_read = 0
+        self.full_reads = 0
+
+    @property
+    def ring(self):
+        return self._ring
+
+    def request_stop(self):
+        """ Let the read loop finish after the current FIFO read. """
+        self._stop_requested = True
+
+    def start(self, *args, **kwargs):
+        self._stop_requested = False
+        super().start(*args, **kwargs)
+
+    def reset_counters(self):
+        """ Zero the read counters. Must not be called while the thread is running. """
+        self.read_errors = 0
+        self.reads = 0
+        self.records_read = 0
+        self.full_reads = 0
+
+    def run(self):
+        ring = self._ring
+        while not self._stop_requested:
+            slot, buffer = ring.acquire_write()
+            count = self._read_fifo(buffer)
+            if count < 0:
+                self.read_errors += 1
+                break
+            self.reads += 1
+            self.records_read += count
+            if count == buffer.size:
+                self.full_reads += 1
+            ring.commit(slot, count)
+            if slot >= 0 and ring.occupancy == 1:
+                self.sigDataAvailable.emit()
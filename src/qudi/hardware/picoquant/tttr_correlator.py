@@ -0,0 +1,183 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains a streaming start-multistop correlator for the decoded T2 records of PicoQuant
+devices, e.g. to measure the second order autocorrelation g2(tau) of a Hanbury Brown-Twiss setup.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import numpy as np
+
+__all__ = ['TTTRCorrelator']
+
+
+class TTTRCorrelator:
+    """ Histogram of the time differences between the photons of a start and a stop channel.
+
+    Every start photon is correlated with all stop photons within the lag range
+    [-max_lag, max_lag) (start-multistop), i.e. lag = time(stop) - time(start). Each decoded
+    record block is correlated once when it is added, so taking a snapshot only costs a copy of the
+    bins and g2(tau) can be shown while the measurement is running.
+
+    Pairs may span consecutive blocks: the photons within max_lag of the end of the last block are
+    kept and correlated with the photons of the next block. Every pair is counted exactly once, as
+    the photons of a new block are paired with each other and with the kept photons only.
+    """
+
+    def __init__(self, bin_width, max_lag, start_channel=0, stop_channel=1):
+        """
+        @param int bin_width: width of a lag bin in units of the time tags
+        @param int max_lag: largest absolute lag in units of the time tags, rounded up to a
+                            multiple of bin_width
+        @param int start_channel: channel of the start photons
+        @param int stop_channel: channel of the stop photons
+        """
+        bin_width = int(bin_width)
+        max_lag = int(max_lag)
+        if bin_width < 1 or max_lag < 1:
+            raise ValueError('TTTRCorrelator needs a bin width and a maximum lag of at least one '
+                             'time tag unit.')
+        self._bin_width = bin_width
+        self._half_bins = -(-max_lag // bin_width)
+        self._max_lag = self._half_bins * bin_width
+        self._start_channel = int(start_channel)
+        self._stop_channel = int(stop_channel)
+        self._histogram = np.zeros(2 * self._half_bins, dtype=np.int64)
+        self._empty = np.empty(0, dtype=np.int64)
+        self.reset()
+
+    @property
+    def bin_width(self):
+        return self._bin_width
+
+    @property
+    def max_lag(self):
+        return self._max_lag
+
+    @property
+    def bin_count(self):
+        return self._histogram.size
+
+    @property
+    def start_channel(self):
+        return self._start_channel
+
+    @property
+    def stop_channel(self):
+        return self._stop_channel
+
+    @property
+    def start_count(self):
+        """ Number of start photons added so far. """
+        return self._start_count
+
+    @property
+    def stop_count(self):
+        """ Number of stop photons added so far. """
+        return self._stop_count
+
+    @property
+    def elapsed_time(self):
+        """ Time span between the first and the last photon added so far, in time tag units. """
+        if self._first_time is None:
+            return 0
+        return self._last_time - self._first_time
+
+    def reset(self):
+        """ Clear all bins and forget the photons kept from the last block. """
+        self._histogram[...] = 0
+        self._kept_starts = self._empty
+        self._kept_stops = self._empty
+        self._start_count = 0
+        self._stop_count = 0
+        self._first_time = None
+        self._last_time = None
+
+    def lags(self):
+        """ Get the lower edges of the lag bins.
+
+        @return numpy.ndarray: int64 array with the lower edge of each bin in time tag units
+        """
+        return np.arange(-self._half_bins, self._half_bins, dtype=np.int64) * self._bin_width
+
+    def add(self, events):
+        """ Correlate a block of decoded T2 records.
+
+        @param TTTREvents events: decoded records, blocks must be added in the order they were read
+        """
+        if events.dtime is not None:
+            raise ValueError('TTTRCorrelator can only correlate T2 records.')
+        if events.time.size == 0:
+            return
+        if self._first_time is None:
+            self._first_time = int(events.time[0])
+        self._last_time = int(events.time[-1])
+
+        new_starts = events.time[events.channel == self._start_channel]
+        new_stops = events.time[events.channel == self._stop_channel]
+        self._start_count += new_starts.size
+        self._stop_count += new_stops.size
+
+        # new starts with the kept and the new stops, new stops with the kept starts only:
+        if self._kept_stops.size > 0:
+            stops = np.concatenate((self._kept_stops, new_stops))
+        else:
+            stops = new_stops
+        self._correlate(new_starts, stops)
+        self._correlate(self._kept_starts, new_stops)
+
+        # photons which can still pair with a photon of the next block, whose time tags are not
+        # smaller than the last time tag of this block:
+        starts = np.concatenate((self._kept_starts, new_starts))
+        self._kept_starts = starts[starts > self._last_time - self._max_lag]
+        self._kept_stops = stops[stops >= self._last_time - self._max_lag]
+
+    def _correlate(self, starts, stops):
+        """ Bin the lags of all pairs of sorted start and stop times within the lag range. """
+        if starts.size == 0 or stops.size == 0:
+            return
+        first = np.searchsorted(stops, starts - self._max_lag, side='left')
+        last = np.searchsorted(stops, starts + self._max_lag, side='left')
+        pairs = last - first
+        total = int(pairs.sum())
+        if total == 0:
+            return
+        # index of the stop of every pair, running from first to last - 1 for each start:
+        pair_start = np.repeat(np.arange(starts.size), pairs)
+        offsets = np.arange(total) - np.repeat(np.cumsum(pairs) - pairs, pairs)
+        lags = stops[first[pair_start] + offsets] - starts[pair_start]
+        bins = (lags + self._max_lag) // self._bin_width
+        self._histogram += np.bincount(bins, minlength=self._histogram.size)
+
+    def snapshot(self):
+        """ Get a copy of the current correlation histogram.
+
+        @return numpy.ndarray: int64 array of shape [bin_count], see lags() for the bin edges
+        """
+        return self._histogram.copy()
+
+    def normalized(self):
+        """ Get the current correlation histogram normalized to uncorrelated (Poissonian) light.
+
+        @return numpy.ndarray: float64 array of shape [bin_count], g2(tau) going to 1 for lags much
+                               longer than all correlation times of the source
+        """
+        elapsed = self.elapsed_time
+        pair_rate = self._start_count * self._stop_count * self._bin_width
+        if elapsed <= 0 or pair_rate == 0:
+            return np.zeros(self._histogram.size, dtype=np.float64)
+        return self._histogram * (elapsed / pair_rate)
@@ -0,0 +1,181 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains the binning of decoded T2 photon time tags into count samples of a fixed sample
+rate, buffered in a ring buffer for streaming readout.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import numpy as np
+
+__all__ = ['TTTRCountTrace']
+
+
+class TTTRCountTrace:
+    """ Photon counts per channel in consecutive bins of fixed width, i.e. a count rate trace
+    sampled at 1 / bin_width.
+
+    Bin k covers the time tags [k * bin_width, (k + 1) * bin_width). A bin is complete, and
+    therefore available as a sample, as soon as the time reached by the device (the last
+    wraparound or record time) lies beyond its end. Photons of incomplete bins are kept until the
+    bin is complete, so the samples are the same no matter how the records are split into blocks.
+
+    The complete samples are kept in a ring buffer of buffer_size samples per channel. If it
+    overflows, the oldest unread samples are overwritten and the overflown flag is set.
+    """
+
+    def __init__(self, bin_width, channels, buffer_size, dtype=np.float64):
+        """
+        @param int bin_width: bin width in time tag units (T2: base resolution)
+        @param iterable channels: detector channel numbers to count, one sample row per channel
+        @param int buffer_size: number of samples per channel the ring buffer can hold
+        @param type dtype: optional, numpy data type of the samples
+        """
+        bin_width = int(bin_width)
+        buffer_size = int(buffer_size)
+        channels = np.asarray(tuple(channels), dtype=np.int64)
+        if bin_width < 1 or buffer_size < 1 or channels.size < 1:
+            raise ValueError('TTTRCountTrace needs a positive bin width, buffer size and at least '
+                             'one channel.')
+        self._bin_width = bin_width
+        self._channels = channels
+        # channel number to sample row, -1 for channels that are not counted
+        self._row_lookup = np.full(max(16, int(channels.max()) + 1), -1, dtype=np.int64)
+        self._row_lookup[channels] = np.arange(channels.size)
+        self._buffer = np.zeros((channels.size, buffer_size), dtype=dtype)
+        self.reset()
+
+    @property
+    def bin_width(self):
+        return self._bin_width
+
+    @property
+    def channel_count(self):
+        return self._channels.size
+
+    @property
+    def buffer_size(self):
+        return self._buffer.shape[1]
+
+    @property
+    def available(self):
+        """ Number of complete samples per channel not read yet. """
+        return self._available
+
+    @property
+    def overflown(self):
+        return self._overflown
+
+    @property
+    def completed_bins(self):
+        """ Total number of complete samples since the last reset. """
+        return self._completed
+
+    def reset(self):
+        """ Discard all samples and start the next bin 0 at time tag 0. """
+        self._buffer[...] = 0
+        self._pending = np.zeros((self._channels.size, 0), dtype=np.int64)
+        self._completed = 0
+        self._write_pos = 0
+        self._available = 0
+        self._overflown = False
+
+    def add(self, events, time_reached):
+        """ Count a block of decoded records and complete all bins ending before time_reached.
+
+        @param TTTREvents events: decoded T2 records, blocks must be added in the order they were
+                                  read
+        @param int time_reached: absolute time tag reached by the device, e.g. the overflow time of
+                                 the decoder or the time of the last record
+
+        @return int: number of samples completed by this block
+        """
+        if events.time.size > 0:
+            time_reached = max(int(time_reached), int(events.time[-1]))
+        rows = self._row_lookup[np.minimum(events.channel, self._row_lookup.size - 1)]
+        counted = rows >= 0
+        bins = events.time[counted] // self._bin_width - self._completed
+        rows = rows[counted]
+        # photons of bins completed before (e.g. late records of a merged stream) are dropped
+        in_range = bins >= 0
+        bins = bins[in_range]
+        rows = rows[in_range]
+
+        complete = max(time_reached // self._bin_width - self._completed, 0)
+        length = max(complete, self._pending.shape[1], int(bins.max()) + 1 if bins.size else 0)
+        counts = np.bincount(rows * length + bins, minlength=self._channels.size * length)
+        counts = counts.reshape((self._channels.size, length))
+        counts[:, :self._pending.shape[1]] += self._pending
+
+        self._pending = counts[:, complete:].copy()
+        if complete > 0:
+            self._push(counts[:, :complete])
+        self._completed += complete
+        return complete
+
+    def _push(self, samples):
+        size = self.buffer_size
+        count = samples.shape[1]
+        lost = count > size
+        if lost:
+            # only the newest samples fit
+            samples = samples[:, count - size:]
+            count = size
+        end = self._write_pos + count
+        if end <= size:
+            self._buffer[:, self._write_pos:end] = samples
+        else:
+            split = size - self._write_pos
+            self._buffer[:, self._write_pos:] = samples[:, :split]
+            self._buffer[:, :end - size] = samples[:, split:]
+        self._write_pos = end % size
+        self._available += count
+        if lost or self._available > size:
+            self._available = size
+            self._overflown = True
+
+    def latest(self):
+        """ Get the newest complete sample without consuming it.
+
+        @return numpy.ndarray: 1D array with one value per channel, zeros before the first sample
+        """
+        if self._completed == 0:
+            return np.zeros(self._channels.size, dtype=self._buffer.dtype)
+        return self._buffer[:, (self._write_pos - 1) % self.buffer_size].copy()
+
+    def read_into(self, buffer, number_of_samples):
+        """ Move the oldest unread samples into buffer.
+
+        @param numpy.ndarray buffer: 2D array of shape (channel_count, >= number_of_samples)
+        @param int number_of_samples: number of samples per channel to read
+
+        @return int: number of samples read, at most the available ones
+        """
+        size = self.buffer_size
+        count = min(int(number_of_samples), self._available)
+        if count < 1:
+            return 0
+        start = (self._write_pos - self._available) % size
+        end = start + count
+        if end <= size:
+            buffer[:, :count] = self._buffer[:, start:end]
+        else:
+            split = size - start
+            buffer[:, :split] = self._buffer[:, start:]
+            buffer[:, split:count] = self._buffer[:, :end - size]
+        self._available -= count
+        return count
@@ -0,0 +1,248 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains decoders for the time-tagged time-resolved (TTTR) event records read from the
+FIFO of PicoQuant devices.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import numpy as np
+
+__all__ = ['TTTREvents', 'PicoHarpTTTRDecoder', 'HydraHarpT3Decoder']
+
+
+class TTTREvents:
+    """ Container for a block of decoded TTTR records.
+
+    All time stamps are absolute, i.e. the overflow records of all previously decoded blocks are
+    already taken into account.
+
+    @attr numpy.ndarray channel: uint8 array with the detector channel of each photon record
+    @attr numpy.ndarray time: int64 array with the absolute time of each photon record.
+                              T2: time tag in units of the base resolution,
+                              T3: number of the sync period the photon arrived in.
+    @attr numpy.ndarray dtime: uint16 array with the start-stop time of each photon record in units
+                               of the current resolution (T3 only, None for T2).
+    @attr numpy.ndarray marker_bits: uint8 array with the marker bit pattern of each marker record
+    @attr numpy.ndarray marker_time: int64 array with the absolute time of each marker record
+                                     (same units as "time")
+    @attr numpy.ndarray photon_index: int64 array with the position of each photon record in the
+                                      decoded record block
+    @attr numpy.ndarray marker_index: int64 array with the position of each marker record in the
+                                      decoded record block
+    @attr int overflows: number of overflow records in the decoded record block
+    """
+    __slots__ = ('channel', 'time', 'dtime', 'marker_bits', 'marker_time', 'photon_index',
+                 'marker_index', 'overflows')
+
+    def __init__(self, channel, time, dtime, marker_bits, marker_time, photon_index,
+                 marker_index, overflows):
+        self.channel = channel
+        self.time = time
+        self.dtime = dtime
+        self.marker_bits = marker_bits
+        self.marker_time = marker_time
+        self.photon_index = photon_index
+        self.marker_index = marker_index
+        self.overflows = overflows
+
+    def __len__(self):
+        return self.channel.size
+
+
+class PicoHarpTTTRDecoder:
+    """ Vectorized decoder for the 32 bit event records of the PicoHarp 300 in T2 and T3 mode.
+
+    The decoder keeps track of the overflow records, so consecutive record blocks read from the
+    FIFO must be passed to decode() in the order they were read. Call reset() before decoding the
+    records of a new measurement.
+
+    PicoHarp T2 format:
+        [ 4 bit channel | 28 bit time tag ]
+        channel 15 marks a special record. If the lower 4 bits of the time tag are zero, the record
+        is an overflow (time tag wrapped around by T2_WRAPAROUND), otherwise these bits are the
+        external marker bits.
+
+    PicoHarp T3 format:
+        [ 4 bit channel | 12 bit start-stop time (dtime) | 16 bit sync counter (nsync) ]
+        channel 15 marks a special record. If dtime is zero, the record is an overflow (sync
+        counter wrapped around by T3_WRAPAROUND), otherwise the lower 4 bits of dtime are the
+        external marker bits. Photon records carry the channels 1 to 4.
+    """
+    T2_WRAPAROUND = 210698240
+    T3_WRAPAROUND = 65536
+
+    _SPECIAL_CHANNEL = 0xF
+
+    def __init__(self, mode=3):
+        """
+        @param int mode: the TTTR mode of the device, 2 for T2 mode, 3 for T3 mode
+        """
+        if mode not in (2, 3):
+            raise ValueError('PicoHarp TTTR records can only be decoded in T2 (2) or T3 (3) mode '
+                             'but mode {0} was given.'.format(mode))
+        self._mode = mode
+        self._wraparound = self.T2_WRAPAROUND if mode == 2 else self.T3_WRAPAROUND
+        self._overflow_time = 0
+
+    @property
+    def mode(self):
+        return self._mode
+
+    @property
+    def overflow_time(self):
+        """ The absolute time offset accumulated from all overflow records decoded so far. """
+        return self._overflow_time
+
+    def reset(self):
+        """ Forget the overflow records of previously decoded blocks. """
+        self._overflow_time = 0
+
+    def restart(self):
+        """ Continue decoding after the device was restarted, i.e. its time tags start at 0 again.
+
+        The absolute times of the new run continue one wraparound period after the overflows
+        decoded so far, so they are later than all previously decoded records and accumulators
+        like TTTRCorrelator see monotonic time tags.
+        """
+        self._overflow_time += self._wraparound
+
+    def decode(self, records):
+        """ Decode a block of TTTR records.
+
+        @param numpy.ndarray records: uint32 array of the records as read from the FIFO
+
+        @return TTTREvents: the decoded photon and marker records
+        """
+        records = np.asarray(records, dtype=np.uint32)
+        channel = (records >> 28).astype(np.uint8)
+        if self._mode == 2:
+            time_tag = records & 0x0FFFFFFF
+            marker_bits = (records & 0xF).astype(np.uint8)
+        else:
+            time_tag = records & 0xFFFF
+            dtime = ((records >> 16) & 0xFFF).astype(np.uint16)
+            marker_bits = (dtime & 0xF).astype(np.uint8)
+
+        special = channel == self._SPECIAL_CHANNEL
+        if self._mode == 2:
+            overflow = special & (marker_bits == 0)
+        else:
+            overflow = special & (dtime == 0)
+        is_marker = special & ~overflow
+
+        # The overflow records preceding (and including) each record determine its time offset.
+        # An overflow record itself is never a photon or marker, so including it does not matter.
+        overflow_count = np.cumsum(overflow, dtype=np.int64)
+        absolute_time = time_tag.astype(np.int64)
+        absolute_time += overflow_count * self._wraparound
+        absolute_time += self._overflow_time
+
+        overflows = int(overflow_count[-1]) if overflow_count.size > 0 else 0
+        self._overflow_time += overflows * self._wraparound
+
+        photon_index = np.flatnonzero(~special)
+        marker_index = np.flatnonzero(is_marker)
+        return TTTREvents(channel=channel[photon_index],
+                          time=absolute_time[photon_index],
+                          dtime=None if self._mode == 2 else dtime[photon_index],
+                          marker_bits=marker_bits[marker_index],
+                          marker_time=absolute_time[marker_index],
+                          photon_index=photon_index,
+                          marker_index=marker_index,
+                          overflows=overflows)
+
+
+class HydraHarpT3Decoder:
+    """ Vectorized decoder for the 32 bit event records of the HydraHarp 400 in T3 mode.
+
+    Like PicoHarpTTTRDecoder, consecutive record blocks must be decoded in the order they were
+    read and reset() must be called before decoding the records of a new measurement.
+
+    HydraHarp T3 format (record format version 2):
+        [ 1 bit special | 6 bit channel | 15 bit start-stop time (dtime) | 10 bit nsync ]
+        Special records with channel 63 are overflows. In version 2, nsync holds the number of
+        sync counter wraparounds (T3_WRAPAROUND) the record stands for (0 means 1, as in
+        version 1). Special records with the channels 1 to 15 are markers, the channel holding the
+        marker bits. Photon records carry the 0 based input channel.
+    """
+    T3_WRAPAROUND = 1024
+
+    _OVERFLOW_CHANNEL = 0x3F
+
+    def __init__(self, version=2):
+        """
+        @param int version: record format version, 1 for HydraHarp V1 firmware, 2 otherwise
+        """
+        if version not in (1, 2):
+            raise ValueError('HydraHarp T3 records can only be decoded in format version 1 or 2 '
+                             'but version {0} was given.'.format(version))
+        self._version = version
+        self._overflow_time = 0
+
+    @property
+    def mode(self):
+        return 3
+
+    @property
+    def overflow_time(self):
+        """ The absolute time offset accumulated from all overflow records decoded so far. """
+        return self._overflow_time
+
+    def reset(self):
+        """ Forget the overflow records of previously decoded blocks. """
+        self._overflow_time = 0
+
+    def decode(self, records):
+        """ Decode a block of T3 records.
+
+        @param numpy.ndarray records: uint32 array of the records as read from the FIFO
+
+        @return TTTREvents: the decoded photon and marker records
+        """
+        records = np.asarray(records, dtype=np.uint32)
+        special = (records >> 31).astype(bool)
+        channel = ((records >> 25) & 0x3F).astype(np.uint8)
+        dtime = ((records >> 10) & 0x7FFF).astype(np.uint16)
+        nsync = (records & 0x3FF).astype(np.int64)
+
+        overflow = special & (channel == self._OVERFLOW_CHANNEL)
+        is_marker = special & (channel >= 1) & (channel <= 15)
+
+        if self._version == 1:
+            wraps = overflow.astype(np.int64)
+        else:
+            wraps = np.where(overflow, np.maximum(nsync, 1), 0)
+        wrap_count = np.cumsum(wraps)
+        absolute_time = nsync
+        absolute_time += wrap_count * self.T3_WRAPAROUND
+        absolute_time += self._overflow_time
+
+        overflows = int(np.count_nonzero(overflow))
+        if wrap_count.size > 0:
+            self._overflow_time += int(wrap_count[-1]) * self.T3_WRAPAROUND
+
+        photon_index = np.flatnonzero(~special)
+        marker_index = np.flatnonzero(is_marker)
+        return TTTREvents(channel=channel[photon_index],
+                          time=absolute_time[photon_index],
+                          dtime=dtime[photon_index],
+                          marker_bits=channel[marker_index],
+                          marker_time=absolute_time[marker_index],
+                          photon_index=photon_index,
+                          marker_index=marker_index,
+                          overflows=overflows)
@@ -0,0 +1,198 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains the accumulator turning decoded T3 records and the pixel, line and frame clock
+markers of a scanner into a fluorescence lifetime imaging (FLIM) data set.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import numpy as np
+
+__all__ = ['FLIMImage']
+
+
+class FLIMImage:
+    """ Photon arrival time histogram per image pixel, built from T3 records and scanner markers.
+
+    The scanner clocks are connected to the marker inputs:
+        - a line marker starts the next line of the image (and the pixel count of that line),
+        - a pixel marker starts the next pixel of the current line,
+        - an optional frame marker starts the next frame at line 0. Without frame markers, the
+          lines wrap around after the given number of lines.
+    If a single marker record carries several of these bits, they are applied in the order frame,
+    line, pixel, so a record with the line and the pixel bit starts pixel 0 of the next line.
+    Photons before the first line marker, between the last pixel of a line and the next line
+    marker (retrace) or beyond the last line of a frame are discarded. The frames are accumulated.
+
+    Each decoded record block is assigned to the pixels once when it is added. Besides the
+    [line, pixel, dtime bin] cube, the photon count and the sum of the arrival times of each pixel
+    are accumulated, so the intensity image and the fast lifetime (mean arrival time) image are
+    available live at full dtime resolution. The memory of the cube is bounded by combining
+    several dtime units into one bin (rebin) and limiting the number of bins.
+    """
+
+    def __init__(self, pixels_per_line, lines, dtime_bins, rebin=1, pixel_marker_mask=0x1,
+                 line_marker_mask=0x2, frame_marker_mask=0x0):
+        """
+        @param int pixels_per_line: number of pixels per line
+        @param int lines: number of lines per frame
+        @param int dtime_bins: number of arrival time bins per pixel (0 for no cube at all, only
+                               the intensity and mean arrival time images)
+        @param int rebin: number of dtime units (device resolution) combined into one bin
+        @param int pixel_marker_mask: bit mask of the marker inputs starting the next pixel
+        @param int line_marker_mask: bit mask of the marker inputs starting the next line
+        @param int frame_marker_mask: bit mask of the marker inputs starting the next frame, 0 if
+                                      there is no frame clock
+        """
+        pixels_per_line = int(pixels_per_line)
+        lines = int(lines)
+        dtime_bins = int(dtime_bins)
+        rebin = int(rebin)
+        if pixels_per_line < 1 or lines < 1 or dtime_bins < 0 or rebin < 1:
+            raise ValueError('FLIMImage needs at least one pixel and line, a non-negative number '
+                             'of dtime bins and a rebin factor of at least 1.')
+        if pixel_marker_mask == 0 or line_marker_mask == 0:
+            raise ValueError('FLIMImage needs a pixel and a line marker.')
+        if (pixel_marker_mask & line_marker_mask) or (pixel_marker_mask & frame_marker_mask) or \
+                (line_marker_mask & frame_marker_mask):
+            raise ValueError('FLIMImage marker masks must not share marker inputs.')
+        self._pixels_per_line = pixels_per_line
+        self._lines = lines
+        self._dtime_bins = dtime_bins
+        self._rebin = rebin
+        self._pixel_mask = int(pixel_marker_mask)
+        self._line_mask = int(line_marker_mask)
+        self._frame_mask = int(frame_marker_mask)
+        self._counts = np.zeros((lines, pixels_per_line), dtype=np.int64)
+        self._dtime_sums = np.zeros((lines, pixels_per_line), dtype=np.int64)
+        self._cube = np.zeros((lines, pixels_per_line, dtime_bins), dtype=np.uint32)
+        self.reset()
+
+    @property
+    def shape(self):
+        """ Shape of the cube: [lines, pixels_per_line, dtime_bins] """
+        return self._cube.shape
+
+    @property
+    def rebin(self):
+        return self._rebin
+
+    @property
+    def frames(self):
+        """ Number of frame markers (with a frame clock) or started frames (without). """
+        if self._frame_mask:
+            return self._frame_markers
+        return max(self._line_markers - 1, -1) // self._lines + 1
+
+    @property
+    def discarded_photons(self):
+        return self._discarded
+
+    def reset(self):
+        """ Clear the images and the cube and wait for the next line marker. """
+        self._counts[...] = 0
+        self._dtime_sums[...] = 0
+        self._cube[...] = 0
+        # total number of pixel and line markers, the line markers at the start of the current
+        # frame and the pixel markers at the start of the current line
+        self._pixel_markers = 0
+        self._line_markers = 0
+        self._frame_markers = 0
+        self._frame_start_lines = 0
+        self._line_start_pixels = 0
+        self._discarded = 0
+
+    def add(self, events):
+        """ Assign a block of decoded T3 records to the image pixels.
+
+        @param TTTREvents events: decoded records, blocks must be added in the order they were read
+        """
+        if events.dtime is None:
+            raise ValueError('FLIMImage can only image T3 records.')
+
+        bits = events.marker_bits
+        is_frame = ((bits & self._frame_mask) != 0).astype(np.int64)
+        is_line = ((bits & self._line_mask) != 0).astype(np.int64)
+        is_pixel = ((bits & self._pixel_mask) != 0).astype(np.int64)
+
+        # state after each marker record, preceded by the state at the start of the block
+        line_markers = np.cumsum(np.concatenate(([self._line_markers], is_line)))
+        pixel_markers = np.cumsum(np.concatenate(([self._pixel_markers], is_pixel)))
+        # marker counts at the last frame and line start, forward filled (the counts never
+        # decrease); a frame starts before the line marker of the same record, a line before the
+        # pixel marker
+        frame_start = np.concatenate(([self._frame_start_lines],
+                                      np.where(is_frame, line_markers[1:] - is_line, -1)))
+        np.maximum.accumulate(frame_start, out=frame_start)
+        line_start = np.concatenate(([self._line_start_pixels],
+                                     np.where(is_line, pixel_markers[1:] - is_pixel, -1)))
+        np.maximum.accumulate(line_start, out=line_start)
+        line_index = line_markers - frame_start - 1
+        pixel_index = pixel_markers - line_start - 1
+
+        self._line_markers = int(line_markers[-1])
+        self._pixel_markers = int(pixel_markers[-1])
+        self._frame_start_lines = int(frame_start[-1])
+        self._line_start_pixels = int(line_start[-1])
+        self._frame_markers += int(is_frame.sum())
+
+        # state of each photon from the last marker record before it
+        state = np.searchsorted(events.marker_index, events.photon_index)
+        lines = line_index[state]
+        pixels = pixel_index[state]
+        if not self._frame_mask:
+            lines = np.where(lines >= 0, lines % self._lines, -1)
+        valid = (lines >= 0) & (lines < self._lines) & (pixels >= 0) & \
+                (pixels < self._pixels_per_line)
+        self._discarded += int(valid.size - np.count_nonzero(valid))
+
+        pixel = lines[valid] * self._pixels_per_line + pixels[valid]
+        dtime = events.dtime[valid].astype(np.int64)
+        self._counts.reshape(-1)[:] += np.bincount(pixel, minlength=self._counts.size)
+        self._dtime_sums.reshape(-1)[:] += np.bincount(pixel, weights=dtime,
+                                                       minlength=self._counts.size).astype(np.int64)
+
+        if self._dtime_bins > 0:
+            bins = dtime // self._rebin
+            in_range = bins < self._dtime_bins
+            # only the occupied cube bins are touched, the cube can be much larger than a block
+            flat, counts = np.unique(pixel[in_range] * self._dtime_bins + bins[in_range],
+                                     return_counts=True)
+            self._cube.reshape(-1)[flat] += counts.astype(np.uint32)
+
+    def intensity(self):
+        """ Get a copy of the photon counts per pixel.
+
+        @return numpy.ndarray: int64 array of shape [lines, pixels_per_line]
+        """
+        return self._counts.copy()
+
+    def mean_arrival_time(self):
+        """ Get the fast lifetime image: the mean photon arrival time after the sync pulse.
+
+        @return numpy.ndarray: float64 array of shape [lines, pixels_per_line] in dtime units
+                               (device resolution), NaN for pixels without photons
+        """
+        with np.errstate(invalid='ignore', divide='ignore'):
+            return np.where(self._counts > 0, self._dtime_sums / self._counts, np.nan)
+
+    def snapshot(self):
+        """ Get a copy of the arrival time histograms of all pixels.
+
+        @return numpy.ndarray: uint32 array of shape [lines, pixels_per_line, dtime_bins]
+        """
+        return self._cube.copy()
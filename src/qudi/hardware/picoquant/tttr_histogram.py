@@ -0,0 +1,319 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains the accumulators turning decoded T3 records or histogram reads of PicoQuant
+devices into the time trace histogram of a fast counter.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import numpy as np
+
+__all__ = ['TTTRHistogram', 'IncrementalHistogram']
+
+
+class TTTRHistogram:
+    """ Histogram of the start-stop times (dtime) of T3 photon records.
+
+    Each decoded record block is binned once when it is added, so taking a snapshot of the
+    histogram only costs a copy of the bins, independent of the number of photons measured.
+
+    Ungated, the histogram has the shape [bin_count] and every sync period is one sweep.
+    Gated, the histogram has the shape [number_of_gates, bin_count]. Every marker record matching
+    gate_marker_mask starts the next gate; photons are accumulated into that gate until the next
+    such marker arrives. After number_of_gates markers, the sequence starts again with gate 0 and
+    one sweep is completed. Photons arriving before the first marker cannot be assigned to a gate
+    and are discarded.
+
+    Optionally, the photons in a signal and a reference window of each laser pulse are counted on
+    the fly as well (see set_windows), so a pulsed analysis can read a few sums per laser pulse
+    instead of the whole histogram.
+
+    With a router (e.g. PHR800), the channel of each photon record is the routing channel 1 to
+    channel_count. Every routing channel can then be histogrammed separately, shifted by its own
+    offset, which prepends a channel axis to the histogram shape. All channels are binned with a
+    single bincount of the combined index.
+    """
+
+    def __init__(self, bin_count, rebin=1, number_of_gates=0, gate_marker_mask=0xF,
+                 channel_count=0, channel_offsets=None):
+        """
+        @param int bin_count: number of time bins (per gate)
+        @param int rebin: number of dtime units (device resolution) combined into one time bin
+        @param int number_of_gates: number of gates, 0 for an ungated histogram
+        @param int gate_marker_mask: bit mask of the marker inputs starting a new gate
+        @param int channel_count: number of routing channels histogrammed separately, 0 to
+                                  histogram the photons of all channels together
+        @param list channel_offsets: optional, dtime units added to the photons of each routing
+                                     channel before binning, e.g. to compensate cable delays
+        """
+        bin_count = int(bin_count)
+        rebin = int(rebin)
+        number_of_gates = int(number_of_gates)
+        channel_count = int(channel_count)
+        if bin_count < 1 or rebin < 1 or number_of_gates < 0 or channel_count < 0:
+            raise ValueError('TTTRHistogram needs at least one bin, a rebin factor of at least 1 '
+                             'and a non-negative number of gates and channels.')
+        self._bin_count = bin_count
+        self._rebin = rebin
+        self._number_of_gates = number_of_gates
+        self._gate_marker_mask = int(gate_marker_mask)
+        self._channel_count = channel_count
+        self._channel_offsets = None
+        if channel_count > 0 and channel_offsets is not None and np.any(channel_offsets):
+            self._channel_offsets = np.asarray(channel_offsets, dtype=np.intp)
+            if self._channel_offsets.shape != (channel_count,):
+                raise ValueError('TTTRHistogram needs one offset per routing channel.')
+        shape = (bin_count,)
+        if number_of_gates > 0:
+            shape = (number_of_gates,) + shape
+        # number of bins of a single channel:
+        self._channel_size = int(np.prod(shape))
+        if channel_count > 0:
+            shape = (channel_count,) + shape
+        self._histogram = np.zeros(shape, dtype=np.int64)
+        # flat view to add the bincount result of gated and ungated data the same way:
+        self._flat_histogram = self._histogram.reshape(-1)
+        self._gate_markers = 0
+        # gate markers counted before the current run, see restart
+        self._run_start_markers = 0
+        self._last_sync = -1
+        # (lookup table flat bin -> laser pulse index, sums per laser pulse) of the signal and
+        # the reference window, empty if no windows are set
+        self._windows = list()
+
+    @property
+    def bin_count(self):
+        return self._bin_count
+
+    @property
+    def rebin(self):
+        return self._rebin
+
+    @property
+    def number_of_gates(self):
+        return self._number_of_gates
+
+    @property
+    def is_gated(self):
+        return self._number_of_gates > 0
+
+    @property
+    def channel_count(self):
+        return self._channel_count
+
+    @property
+    def elapsed_sweeps(self):
+        """ Number of completed gate sequences (gated) or sync periods (ungated). """
+        if self.is_gated:
+            return self._gate_markers // self._number_of_gates
+        return self._last_sync + 1
+
+    def reset(self):
+        """ Clear all bins and the sweep counter. """
+        self._histogram[...] = 0
+        self._gate_markers = 0
+        self._run_start_markers = 0
+        self._last_sync = -1
+        for _, sums in self._windows:
+            sums[...] = 0
+
+    def restart(self):
+        """ Keep the bins but start a new run of the device, e.g. to continue a paused measurement.
+
+        The sweep interrupted by the pause is dropped from the sweep counter, the first gate
+        marker of the new run starts gate 0 again and photons arriving before it are discarded.
+        """
+        if self.is_gated:
+            self._gate_markers -= self._gate_markers % self._number_of_gates
+        self._run_start_markers = self._gate_markers
+
+    def add(self, events):
+        """ Bin a block of decoded T3 records.
+
+        @param TTTREvents events: decoded records, blocks must be added in the order they were read
+        """
+        if events.dtime is None:
+            raise ValueError('TTTRHistogram can only bin T3 records.')
+
+        if events.time.size > 0:
+            self._last_sync = max(self._last_sync, int(events.time[-1]))
+        if events.marker_time.size > 0:
+            self._last_sync = max(self._last_sync, int(events.marker_time[-1]))
+
+        bins = events.dtime.astype(np.intp)
+        if self._channel_count > 0:
+            channel_index = events.channel.astype(np.intp) - 1
+            valid = (channel_index >= 0) & (channel_index < self._channel_count)
+            if self._channel_offsets is not None:
+                bins += self._channel_offsets[np.where(valid, channel_index, 0)]
+                valid &= bins >= 0
+        if self._rebin > 1:
+            bins //= self._rebin
+        if self._channel_count > 0:
+            valid &= bins < self._bin_count
+        else:
+            valid = bins < self._bin_count
+
+        if self.is_gated:
+            gate_marker_index = events.marker_index[
+                (events.marker_bits & self._gate_marker_mask) != 0]
+            # number of gate markers before each photon since the start of the measurement:
+            markers = np.searchsorted(gate_marker_index, events.photon_index)
+            markers += self._gate_markers
+            self._gate_markers += gate_marker_index.size
+            valid &= markers > self._run_start_markers
+            bins += ((markers - 1) % self._number_of_gates) * self._bin_count
+        if self._channel_count > 0:
+            bins += channel_index * self._channel_size
+
+        bins = bins[valid]
+        self._flat_histogram += np.bincount(bins, minlength=self._flat_histogram.size)
+        for lut, sums in self._windows:
+            lasers = lut[bins]
+            sums += np.bincount(lasers[lasers >= 0], minlength=sums.size)
+
+    @property
+    def has_windows(self):
+        return len(self._windows) > 0
+
+    def set_windows(self, signal_windows, reference_windows=None):
+        """ Count the photons in a signal and a reference window of each laser pulse on the fly.
+
+        @param numpy.ndarray signal_windows: [start, end) bins of the signal window of each laser
+                                             pulse, shape [number_of_lasers, 2]. Gated or with
+                                             routing channels, the bins index the flattened
+                                             histogram.
+        @param numpy.ndarray reference_windows: optional, reference windows in the same format
+
+        The sums are initialized from the photons histogrammed so far, so they always cover the
+        whole measurement. The windows of different laser pulses must not overlap.
+        """
+        signal_windows = np.asarray(signal_windows, dtype=np.int64).reshape(-1, 2)
+        if reference_windows is None:
+            reference_windows = np.zeros(signal_windows.shape, dtype=np.int64)
+        reference_windows = np.asarray(reference_windows, dtype=np.int64).reshape(-1, 2)
+        if signal_windows.shape != reference_windows.shape:
+            raise ValueError('TTTRHistogram needs one signal and one reference window per laser '
+                             'pulse.')
+
+        prefix_sum = np.zeros(self._flat_histogram.size + 1, dtype=np.int64)
+        np.cumsum(self._flat_histogram, out=prefix_sum[1:])
+        self._windows = list()
+        for windows in (signal_windows, reference_windows):
+            windows = np.clip(windows, 0, self._flat_histogram.size)
+            lut = np.full(self._flat_histogram.size, -1, dtype=np.intp)
+            for laser, (start, end) in enumerate(windows):
+                lut[start:end] = laser
+            sums = prefix_sum[windows[:, 1]] - prefix_sum[windows[:, 0]]
+            sums[windows[:, 1] < windows[:, 0]] = 0
+            self._windows.append((lut, sums))
+
+    def clear_windows(self):
+        """ Stop counting the photons in the laser pulse windows. """
+        self._windows = list()
+
+    def window_sums(self):
+        """ Get a copy of the photon counts in the laser pulse windows.
+
+        @return tuple(numpy.ndarray, numpy.ndarray): int64 signal and reference window sums per
+                                                     laser pulse, None if no windows are set
+        """
+        if not self._windows:
+            return None
+        return self._windows[0][1].copy(), self._windows[1][1].copy()
+
+    def snapshot(self):
+        """ Get a copy of the current histogram.
+
+        @return numpy.ndarray: int64 array of shape [bin_count] or [number_of_gates, bin_count],
+                               with routing channels [channel_count, bin_count] or
+                               [channel_count, number_of_gates, bin_count]
+        """
+        return self._histogram.copy()
+
+
+class IncrementalHistogram:
+    """ Running int64 sum of the increments read from an on-device histogram.
+
+    Devices which can clear their histogram memory when it is read (e.g. HH_GetHistogram) deliver
+    the increment since the previous read directly, see add_delta(). For devices which cannot,
+    add_snapshot() derives the increment from two consecutive reads of the device memory. In both
+    cases the (32 bit or narrower) device bins never have to hold the counts of the whole
+    integration, and the last increment can be handed on to consumers updating incrementally.
+    """
+
+    def __init__(self, shape):
+        """
+        @param int|tuple shape: shape of the histogram, e.g. bin_count or (number_of_gates, bins)
+        """
+        self._total = np.zeros(shape, dtype=np.int64)
+        self._delta = np.zeros(shape, dtype=np.int64)
+        self._last_snapshot = np.zeros(shape, dtype=np.int64)
+
+    @property
+    def shape(self):
+        return self._total.shape
+
+    @property
+    def total(self):
+        """ The accumulated histogram. It is updated in place by every add. """
+        return self._total
+
+    @property
+    def delta(self):
+        """ The increment added by the last add. It is updated in place by every add. """
+        return self._delta
+
+    def reset(self):
+        """ Clear the accumulated histogram, e.g. together with the device memory. """
+        self._total[...] = 0
+        self._delta[...] = 0
+        self._last_snapshot[...] = 0
+
+    def mark_cleared(self):
+        """ Tell that the device memory has been cleared, e.g. for a measurement restart, so the
+        next snapshot is a full increment. The accumulated histogram is kept.
+        """
+        self._last_snapshot[...] = 0
+
+    def add_delta(self, delta):
+        """ Accumulate the increment read from a device clearing its memory on read.
+
+        @param numpy.ndarray delta: counts since the previous read
+
+        @return numpy.ndarray: the accumulated histogram
+        """
+        np.copyto(self._delta, delta, casting='safe')
+        self._total += self._delta
+        return self._total
+
+    def add_snapshot(self, snapshot):
+        """ Accumulate the increment between this and the previous read of the device memory.
+
+        @param numpy.ndarray snapshot: the current content of the device memory
+
+        @return numpy.ndarray: the accumulated histogram
+
+        If a bin decreased, the device memory has been cleared since the previous read and the
+        whole snapshot is the increment.
+        """
+        np.subtract(snapshot, self._last_snapshot, out=self._delta)
+        if (self._delta < 0).any():
+            np.copyto(self._delta, snapshot, casting='safe')
+        np.copyto(self._last_snapshot, snapshot, casting='safe')
+        self._total += self._delta
+        return self._total
@@ -0,0 +1,151 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains the merger combining the decoded TTTR record streams of several PicoQuant
+devices into a single time-ordered stream.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import numpy as np
+
+__all__ = ['MergedTTTREvents', 'TTTRStreamMerger']
+
+
+class MergedTTTREvents:
+    """ Time-ordered photon records of several devices.
+
+    @attr numpy.ndarray time: int64 array with the offset corrected absolute time of each photon
+    @attr numpy.ndarray channel: uint8 array with the detector channel of each photon
+    @attr numpy.ndarray device: uint8 array with the stream (device) index of each photon
+    """
+    __slots__ = ('time', 'channel', 'device')
+
+    def __init__(self, time, channel, device):
+        self.time = time
+        self.channel = channel
+        self.device = device
+
+    def __len__(self):
+        return self.time.size
+
+
+class TTTRStreamMerger:
+    """ k-way merge of the decoded photon records of several independent devices.
+
+    Every stream is time-ordered by itself, but the streams arrive in blocks of different lengths
+    and at different times. A photon can only be emitted once no stream can deliver an earlier one
+    anymore, i.e. up to the smallest time all streams have reached so far (watermark). Later
+    photons are kept until the slowest stream has caught up.
+
+    The clocks of the devices start at different times, so a constant offset per stream is added
+    to its time stamps, e.g. measured from the delay of a common sync or marker signal.
+    """
+
+    def __init__(self, stream_count, offsets=None):
+        """
+        @param int stream_count: number of merged streams (devices)
+        @param list offsets: optional, time offset of each stream in time tag units (default 0)
+        """
+        stream_count = int(stream_count)
+        if stream_count < 1:
+            raise ValueError('TTTRStreamMerger needs at least one stream.')
+        if offsets is None:
+            offsets = [0] * stream_count
+        if len(offsets) != stream_count:
+            raise ValueError('TTTRStreamMerger needs one offset per stream, got {0:d} offsets for '
+                             '{1:d} streams.'.format(len(offsets), stream_count))
+        self._stream_count = stream_count
+        self._offsets = [int(offset) for offset in offsets]
+        self.reset()
+
+    @property
+    def stream_count(self):
+        return self._stream_count
+
+    @property
+    def offsets(self):
+        return list(self._offsets)
+
+    @property
+    def pending(self):
+        """ Number of photons waiting for the slowest stream. """
+        return sum(times.size for times, _ in self._pending)
+
+    def reset(self):
+        """ Drop all pending photons and restart all streams at time zero. """
+        self._pending = [(np.empty(0, dtype=np.int64), np.empty(0, dtype=np.uint8))
+                         for _ in range(self._stream_count)]
+        self._watermarks = [None] * self._stream_count
+
+    def add(self, stream, events, time_reached=None):
+        """ Add a block of decoded records of one stream.
+
+        @param int stream: index of the stream (device)
+        @param TTTREvents events: decoded records, blocks of a stream must be added in the order
+                                  they were read
+        @param int time_reached: optional, time (without offset) the device is known to have
+                                 reached, e.g. the overflow time of its decoder. Lets a stream
+                                 without photons advance the watermark.
+        """
+        offset = self._offsets[stream]
+        watermark = self._watermarks[stream]
+        if events.time.size > 0:
+            times, channels = self._pending[stream]
+            self._pending[stream] = (np.concatenate((times, events.time + offset)),
+                                     np.concatenate((channels, events.channel)))
+            watermark = int(events.time[-1]) + offset
+        if time_reached is not None:
+            reached = int(time_reached) + offset
+            watermark = reached if watermark is None else max(watermark, reached)
+        self._watermarks[stream] = watermark
+
+    def merge(self, flush=False):
+        """ Take all photons which can be emitted in time order.
+
+        @param bool flush: optional, emit all pending photons regardless of the watermark, e.g.
+                           after the measurement has been stopped
+
+        @return MergedTTTREvents: time-ordered photons of all streams
+        """
+        if flush:
+            limit = None
+        elif any(watermark is None for watermark in self._watermarks):
+            limit = -1
+        else:
+            limit = min(self._watermarks)
+
+        times = list()
+        channels = list()
+        devices = list()
+        for stream, (stream_times, stream_channels) in enumerate(self._pending):
+            if limit is None:
+                count = stream_times.size
+            elif limit < 0:
+                count = 0
+            else:
+                count = int(np.searchsorted(stream_times, limit, side='right'))
+            times.append(stream_times[:count])
+            channels.append(stream_channels[:count])
+            devices.append(np.full(count, stream, dtype=np.uint8))
+            self._pending[stream] = (stream_times[count:], stream_channels[count:])
+
+        time = np.concatenate(times)
+        # the streams are sorted runs, which a stable sort merges in about linear time:
+        order = np.argsort(time, kind='stable')
+        return MergedTTTREvents(time=time[order],
+                                channel=np.concatenate(channels)[order],
+                                device=np.concatenate(devices)[order])
@@ -0,0 +1,151 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains a generator of synthetic PicoHarp 300 T2 and T3 FIFO records, e.g. to benchmark
+or test the decoding and histogramming without a device.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import numpy as np
+
+from qudi.hardware.picoquant.tttr_decoder import PicoHarpTTTRDecoder
+
+__all__ = ['SyntheticTTTRGenerator']
+
+
+class SyntheticTTTRGenerator:
+    """ Generates PicoHarp 300 FIFO records with the bit layout of PicoHarpTTTRDecoder.
+
+    Photons are a Poisson process with the given count rate, spread evenly over the given channels.
+    Markers are an independent Poisson process. Overflow records are inserted whenever the time tag
+    (T2) or the sync counter (T3) wraps around, one record per wraparound like the device does.
+    Optional gaps without any photons (e.g. a blocked detector) produce runs of overflow records.
+    In T3 mode the start-stop times follow an exponential decay after the sync pulse.
+
+    Consecutive calls of generate() continue the same record stream, so the blocks can be fed to a
+    decoder one after the other.
+    """
+
+    def __init__(self, mode=3, count_rate=1e6, channels=None, marker_rate=0.0, marker_bits=0x1,
+                 sync_rate=10e6, resolution_s=4e-12, lifetime_s=12e-9, gap_rate=0.0,
+                 gap_length_s=0.0, seed=None):
+        """
+        @param int mode: TTTR mode, 2 for T2 and 3 for T3
+        @param float count_rate: mean photon rate in counts/s over all channels
+        @param list channels: optional, photon channels (default: [0, 1] for T2, [1] for T3)
+        @param float marker_rate: optional, mean rate of marker records in 1/s
+        @param int marker_bits: optional, marker bit pattern of the marker records (1 to 15)
+        @param float sync_rate: optional, sync rate in Hz, the time unit of T3 records
+        @param float resolution_s: optional, time tag unit of T2 records or dtime unit of T3
+                                   records in seconds
+        @param float lifetime_s: optional, decay time of the T3 start-stop times in seconds
+        @param float gap_rate: optional, mean rate of gaps without photons in 1/s
+        @param float gap_length_s: optional, length of each gap in seconds
+        @param int seed: optional, seed of the random number generator
+        """
+        if mode not in (2, 3):
+            raise ValueError('SyntheticTTTRGenerator supports T2 (2) and T3 (3) mode only.')
+        if count_rate <= 0:
+            raise ValueError('SyntheticTTTRGenerator needs a positive count rate.')
+        if not 0 < int(marker_bits) <= 0xF:
+            raise ValueError('SyntheticTTTRGenerator marker bits must be within [1, 15].')
+        self._mode = mode
+        if channels is None:
+            channels = [0, 1] if mode == 2 else [1]
+        self._channels = np.asarray(channels, dtype=np.uint32)
+        self._marker_bits = int(marker_bits)
+        self._resolution_s = float(resolution_s)
+        self._lifetime_s = float(lifetime_s)
+        if mode == 2:
+            self._tick_s = self._resolution_s
+            self._wraparound = PicoHarpTTTRDecoder.T2_WRAPAROUND
+        else:
+            self._tick_s = 1 / float(sync_rate)
+            self._wraparound = PicoHarpTTTRDecoder.T3_WRAPAROUND
+        # mean photon interval, marker rate and gaps in ticks:
+        self._mean_interval = 1 / (float(count_rate) * self._tick_s)
+        self._marker_rate = float(marker_rate) * self._tick_s
+        self._gap_probability = min(float(gap_rate) / float(count_rate), 1.0)
+        self._gap_length = int(round(float(gap_length_s) / self._tick_s))
+        self._rng = np.random.default_rng(seed)
+        self.reset()
+
+    @property
+    def mode(self):
+        return self._mode
+
+    @property
+    def tick_s(self):
+        """ Time unit of the absolute record times (T2: time tag unit, T3: sync period). """
+        return self._tick_s
+
+    @property
+    def time(self):
+        """ Absolute time of the last generated record in ticks. """
+        return self._time
+
+    def reset(self):
+        """ Restart the record stream at time zero. """
+        self._time = 0
+
+    def generate(self, photons):
+        """ Generate the records of the next photons and the markers and overflows in between.
+
+        @param int photons: number of photon records to generate
+
+        @return numpy.ndarray: uint32 array of FIFO records (photons, markers and overflows)
+        """
+        photons = int(photons)
+        intervals = np.floor(self._rng.exponential(self._mean_interval, photons)).astype(np.int64)
+        if self._gap_probability > 0 and self._gap_length > 0:
+            intervals += (self._rng.random(photons) < self._gap_probability) * self._gap_length
+        photon_time = self._time + np.cumsum(intervals)
+        end_time = int(photon_time[-1]) if photons > 0 else self._time
+        channel = self._channels[self._rng.integers(0, self._channels.size, photons)]
+
+        markers = self._rng.poisson(self._marker_rate * (end_time - self._time))
+        marker_time = np.sort(self._rng.integers(self._time, end_time + 1, markers))
+
+        # interleave photons and markers in time order, markers last for equal times
+        time = np.concatenate((photon_time, marker_time))
+        is_marker = np.concatenate((np.zeros(photons, dtype=bool), np.ones(markers, dtype=bool)))
+        order = np.argsort(time, kind='stable')
+        time = time[order]
+        is_marker = is_marker[order]
+        channel = np.concatenate((channel, np.full(markers, 0xF, dtype=np.uint32)))[order]
+
+        if self._mode == 2:
+            # the lower 4 bits of the time tag of a marker record are the marker bits
+            time[is_marker] = (time[is_marker] & ~np.int64(0xF)) | self._marker_bits
+            tag = (time % self._wraparound).astype(np.uint32)
+            records = (channel << 28) | tag
+        else:
+            dtime = np.floor(self._rng.exponential(self._lifetime_s / self._resolution_s,
+                                                   time.size)).astype(np.uint32)
+            np.minimum(dtime, 0xFFF, out=dtime)
+            dtime[is_marker] = self._marker_bits
+            nsync = (time % self._wraparound).astype(np.uint32)
+            records = (channel << 28) | (dtime << 16) | nsync
+
+        # every wraparound since the previous record is preceded by one overflow record
+        wraps = time // self._wraparound
+        overflows = np.diff(wraps, prepend=self._time // self._wraparound)
+        output = np.full(records.size + int(overflows.sum()), np.uint32(0xF << 28),
+                         dtype=np.uint32)
+        output[np.cumsum(overflows + 1) - 1] = records
+        self._time = end_time
+        return output
@@ -159,7 +159,8 @@ class FastCounterInterface(Base):
     def get_data_trace(self):
         """ Polls the current timetrace data from the fast counter.
 
-        Return value is a numpy array (dtype = int64).
+        Return value is a numpy array (dtype = int64). Hardware may optionally return its internal
+        uint32 histogram buffer instead, which is overwritten by the next call of this method.
         The binning, specified by calling configure() in forehand, must be
         taken care of in this hardware class. A possible overflow of the
         histogram bins must be caught here and taken care of.
@@ -171,6 +172,8 @@ class FastCounterInterface(Base):
         info_dict is a dictionary with keys :
             - 'elapsed_sweeps' : the elapsed number of sweeps
             - 'elapsed_time' : the elapsed time in seconds
+            - 'delta' : optional, the counts added to the timetrace since the previous call, for
+                        hardware reading its histogram incrementally
 
         If the hardware does not support these features, the values should be None
         """
@@ -27,6 +27,23 @@ import importlib
 from qudi.util.helpers import natural_sort, iter_modules_recursive
 
 
+def window_sums_analysis(sums_func):
+    """
+    Decorator for analysis methods whose result only depends on the number of counts and bins in
+    the signal window (parameters signal_start, signal_end) and optionally the reference window
+    (parameters norm_start, norm_end) of each laser pulse.
+
+    sums_func(signal_sum, signal_len, reference_sum, reference_len) must compute the same
+    (signal, error) tuple as the decorated method from these numbers (numpy arrays with one entry
+    per laser pulse). It allows to analyse window sums counted on the fly from photon events
+    without extracting the laser pulses from a timetrace, see PulseAnalyzer.analyse_window_sums.
+    """
+    def decorator(method):
+        method.window_sums_func = sums_func
+        return method
+    return decorator
+
+
 class PulseAnalyzerBase:
     """
     All analyzer classes to import from must inherit exclusively from this base class.
@@ -234,6 +251,43 @@ class PulseAnalyzer(PulseAnalyzerBase):
         kwargs = self._get_analysis_method_kwargs(analysis_method)
         return analysis_method(laser_data=laser_data, **kwargs)
 
+    @property
+    def window_sums_supported(self):
+        """
+        @return bool: True if the currently selected analysis method can analyse window sums
+        """
+        method = self._analysis_methods.get(self._current_analysis_method)
+        return getattr(method, 'window_sums_func', None) is not None
+
+    def get_analysis_windows(self):
+        """
+        Get the signal and reference window of the currently selected analysis method.
+
+        @return dict: 'signal_start', 'signal_end' and, if the method uses a reference window,
+                      'norm_start' and 'norm_end' in seconds relative to the laser pulse start.
+                      None if the method does not support window sums.
+        """
+        if not self.window_sums_supported:
+            return None
+        method = self._analysis_methods[self._current_analysis_method]
+        kwargs = self._get_analysis_method_kwargs(method)
+        return {key: kwargs[key] for key in ('signal_start', 'signal_end', 'norm_start', 'norm_end')
+                if key in kwargs}
+
+    def analyse_window_sums(self, signal_sum, signal_len, reference_sum, reference_len):
+        """
+        Analyse per laser pulse window sums with the currently selected analysis method.
+
+        @param numpy.ndarray signal_sum: counts in the signal window of each laser pulse
+        @param numpy.ndarray signal_len: number of bins in the signal window of each laser pulse
+        @param numpy.ndarray reference_sum: counts in the reference window of each laser pulse
+        @param numpy.ndarray reference_len: number of bins in the reference window of each pulse
+        @return (numpy.ndarray, numpy.ndarray): signal data and measurement error like
+                                                analyse_laser_pulses
+        """
+        method = self._analysis_methods[self._current_analysis_method]
+        return method.window_sums_func(signal_sum, signal_len, reference_sum, reference_len)
+
     def _get_analysis_method_kwargs(self, method):
         """
         Get the proper values for keyword arguments other than "laser_data" for <method>.
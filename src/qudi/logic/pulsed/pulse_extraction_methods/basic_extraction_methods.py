@@ -22,7 +22,7 @@ If not, see <https://www.gnu.org/licenses/>.
 import numpy as np
 from scipy import ndimage
 
-from qudi.logic.pulsed.pulse_extractor import PulseExtractorBase
+from qudi.logic.pulsed.pulse_extractor import PulseExtractorBase, cacheable_flanks
 
 
 class BasicPulseExtractor(PulseExtractorBase):
@@ -84,6 +84,7 @@ class BasicPulseExtractor(PulseExtractorBase):
 
         return return_dict
 
+    @cacheable_flanks
     def ungated_conv_deriv(self, count_data, conv_std_dev=20.0):
         """ Detects the laser pulses in the ungated timetrace data and extracts
             them.
@@ -114,7 +115,9 @@ class BasicPulseExtractor(PulseExtractorBase):
             array is searched iteratively for a maximum and a minimum, and after
             finding those the array entries within the 4 times
             self.conv_std_dev (2*self.conv_std_dev to the left and
-            2*self.conv_std_dev) are set to zero.
+            2*self.conv_std_dev) are set to zero. The search walks through the
+            once sorted array instead of passing over it for every flank (see
+            _find_flanks).
 
             The crucial part is the knowledge of the number of laser pulses and
             the choice of the appropriate std_dev for the gauss filter.
@@ -134,8 +137,9 @@ class BasicPulseExtractor(PulseExtractorBase):
             return return_dict
 
         # apply gaussian filter to remove noise and compute the gradient of the timetrace sum
+        count_data_float = count_data.astype(float)
         try:
-            conv = ndimage.filters.gaussian_filter1d(count_data.astype(float), conv_std_dev)
+            conv = ndimage.gaussian_filter1d(count_data_float, conv_std_dev)
         except:
             conv = np.zeros(count_data.size)
         try:
@@ -153,7 +157,7 @@ class BasicPulseExtractor(PulseExtractorBase):
         # (i.e. maxima or minima, which are the inflection points in the pulse) are distorted by
         # a large conv_std_dev value.
         try:
-            conv = ndimage.filters.gaussian_filter1d(count_data.astype(float), 10)
+            conv = ndimage.gaussian_filter1d(count_data_float, 10)
         except:
             conv = np.zeros(count_data.size)
         try:
@@ -161,75 +165,10 @@ class BasicPulseExtractor(PulseExtractorBase):
         except:
             conv_deriv_ref = np.zeros(conv.size)
 
-        # initialize arrays to contain indices for all rising and falling
-        # flanks, respectively
-        rising_ind = np.empty(number_of_lasers, dtype='int64')
-        falling_ind = np.empty(number_of_lasers, dtype='int64')
-
-        # Find as many rising and falling flanks as there are laser pulses in
-        # the trace:
-        for i in range(number_of_lasers):
-            # save the index of the absolute maximum of the derived time trace
-            # as rising edge position
-            rising_ind[i] = np.argmax(conv_deriv)
-
-            # refine the rising edge detection, by using a small and fixed
-            # conv_std_dev parameter to find the inflection point more precise
-            start_ind = int(rising_ind[i] - conv_std_dev)
-            if start_ind < 0:
-                start_ind = 0
-
-            stop_ind = int(rising_ind[i] + conv_std_dev)
-            if stop_ind > len(conv_deriv):
-                stop_ind = len(conv_deriv)
-
-            if start_ind == stop_ind:
-                stop_ind = start_ind + 1
-
-            rising_ind[i] = start_ind + np.argmax(conv_deriv_ref[start_ind:stop_ind])
-
-            # set this position and the surrounding of the saved edge to 0 to
-            # avoid a second detection
-            if rising_ind[i] < 2 * conv_std_dev:
-                del_ind_start = 0
-            else:
-                del_ind_start = rising_ind[i] - int(2 * conv_std_dev)
-            if (conv_deriv.size - rising_ind[i]) < 2 * conv_std_dev:
-                del_ind_stop = conv_deriv.size - 1
-            else:
-                del_ind_stop = rising_ind[i] + int(2 * conv_std_dev)
-                conv_deriv[del_ind_start:del_ind_stop] = 0
-
-            # save the index of the absolute minimum of the derived time trace
-            # as falling edge position
-            falling_ind[i] = np.argmin(conv_deriv)
-
-            # refine the falling edge detection, by using a small and fixed
-            # conv_std_dev parameter to find the inflection point more precise
-            start_ind = int(falling_ind[i] - conv_std_dev)
-            if start_ind < 0:
-                start_ind = 0
-
-            stop_ind = int(falling_ind[i] + conv_std_dev)
-            if stop_ind > len(conv_deriv):
-                stop_ind = len(conv_deriv)
-
-            if start_ind == stop_ind:
-                stop_ind = start_ind + 1
-
-            falling_ind[i] = start_ind + np.argmin(conv_deriv_ref[start_ind:stop_ind])
-
-            # set this position and the sourrounding of the saved flank to 0 to
-            #  avoid a second detection
-            if falling_ind[i] < 2 * conv_std_dev:
-                del_ind_start = 0
-            else:
-                del_ind_start = falling_ind[i] - int(2 * conv_std_dev)
-            if (conv_deriv.size - falling_ind[i]) < 2 * conv_std_dev:
-                del_ind_stop = conv_deriv.size - 1
-            else:
-                del_ind_stop = falling_ind[i] + int(2 * conv_std_dev)
-            conv_deriv[del_ind_start:del_ind_stop] = 0
+        # Find as many rising (maxima of the derivative) and falling (minima) flanks as there are
+        # laser pulses in the trace
+        rising_ind, falling_ind = _find_flanks(conv_deriv, conv_deriv_ref, number_of_lasers,
+                                               conv_std_dev)
 
         # sort all indices of rising and falling flanks
         rising_ind.sort()
@@ -426,4 +365,78 @@ class BasicPulseExtractor(PulseExtractorBase):
                        'laser_indices_rising': np.arange(len(count_data)),
                        'laser_indices_falling': np.arange(len(count_data))}
 
-        return return_dict
\ No newline at end of file
+        return return_dict
+
+def _find_flanks(deriv, deriv_ref, number_of_flanks, conv_std_dev):
+    """ Find the rising and falling flanks as the maxima and minima of a derived time trace.
+
+    @param numpy.ndarray deriv: the derivative of the smoothed time trace
+    @param numpy.ndarray deriv_ref: the derivative of the time trace smoothed with a small, fixed
+                                    width, used to refine the flank positions
+    @param int number_of_flanks: number of rising and of falling flanks to find
+    @param float conv_std_dev: the standard deviation of the gaussian used for smoothing
+
+    @return tuple(numpy.ndarray, numpy.ndarray): int64 arrays with the rising and the falling
+                                                 flank positions in the order they were found
+
+    The flanks are found like by the iterative search over deriv: alternately the global maximum
+    (rising flank) and minimum (falling flank) is taken, refined with deriv_ref and the
+    surrounding (2 * conv_std_dev) of the refined position is set to zero before the next search.
+    A rising flank closer than 2 * conv_std_dev to the end of the trace is not zeroed, as before.
+
+    Instead of setting the entries to zero and passing over the whole array for every flank,
+    deriv is sorted once in both directions. Each search continues in its order, skipping the
+    zeroed positions, and compares the value found with the zero of the zeroed positions, which
+    wins on equal values if it lies before it (like argmax and argmin).
+    """
+    size = deriv.size
+    suppress = 2 * conv_std_dev
+    descending = np.argsort(-deriv, kind='stable')
+    ascending = np.argsort(deriv, kind='stable')
+    zeroed = np.zeros(size, dtype=bool)
+    # the smallest zeroed position, size while there is none
+    first_zeroed = size
+    next_candidate = {1: 0, -1: 0}
+
+    def extremum(order, sign):
+        """ argmax of sign * deriv with the zeroed positions set to 0. """
+        pos = next_candidate[sign]
+        while pos < size and zeroed[order[pos]]:
+            pos += 1
+        next_candidate[sign] = pos
+        if pos == size:
+            return first_zeroed
+        index = int(order[pos])
+        value = sign * deriv[index]
+        if first_zeroed < size and (value < 0 or (value == 0 and first_zeroed < index)):
+            return first_zeroed
+        return index
+
+    def refine(index, arg_func):
+        start_ind = max(int(index - conv_std_dev), 0)
+        stop_ind = min(int(index + conv_std_dev), size)
+        if start_ind == stop_ind:
+            stop_ind = start_ind + 1
+        return start_ind + int(arg_func(deriv_ref[start_ind:stop_ind]))
+
+    def set_zero(index, near_end):
+        nonlocal first_zeroed
+        del_ind_start = 0 if index < suppress else index - int(suppress)
+        if (size - index) < suppress:
+            if not near_end:
+                return
+            del_ind_stop = size - 1
+        else:
+            del_ind_stop = index + int(suppress)
+        if del_ind_stop > del_ind_start:
+            zeroed[del_ind_start:del_ind_stop] = True
+            first_zeroed = min(first_zeroed, del_ind_start)
+
+    rising = np.empty(number_of_flanks, dtype='int64')
+    falling = np.empty(number_of_flanks, dtype='int64')
+    for i in range(number_of_flanks):
+        rising[i] = refine(extremum(descending, 1), np.argmax)
+        set_zero(rising[i], near_end=False)
+        falling[i] = refine(extremum(ascending, -1), np.argmin)
+        set_zero(falling[i], near_end=True)
+    return rising, falling
@@ -23,10 +23,26 @@ import os
 import sys
 import inspect
 import importlib
+import numpy as np
 
 from qudi.util.helpers import natural_sort, iter_modules_recursive
 
 
+def cacheable_flanks(method):
+    """
+    Decorator for ungated extraction methods whose laser pulses are fully determined by the
+    returned flank indices, i.e. laser pulse i is
+        count_data[laser_indices_rising[i]:laser_indices_rising[i] + laser_length]
+    with laser_length = max(laser_indices_falling - laser_indices_rising), zero-padded at the end
+    of the trace.
+
+    PulseExtractor then locks in the flank positions once they are detected reliably and only
+    slices the laser pulses on subsequent calls.
+    """
+    method.cacheable_flanks = True
+    return method
+
+
 class PulseExtractorBase:
     """
     All extractor classes to import from must inherit exclusively from this base class.
@@ -91,6 +107,12 @@ class PulseExtractor(PulseExtractorBase):
         self._parameters = dict()
         # Currently selected extraction method
         self._current_extraction_method = None
+        # flank positions (count data shape, rising indices, falling indices) of the last
+        # extraction and the ones locked in after two agreeing extractions
+        self._last_flanks = None
+        self._locked_flanks = None
+        # maximum deviation in bins for two extractions to agree
+        self.flank_tolerance = 1
 
         # import extraction modules from default namespace package
         # "qudi.logic.pulse_extraction_methods"
@@ -187,6 +209,9 @@ class PulseExtractor(PulseExtractorBase):
         if not isinstance(settings_dict, dict):
             return
 
+        # the flanks have to be detected again with the new settings
+        self.invalidate_flank_cache()
+
         # go through all key-value pairs in settings_dict and update self._parameters and
         # self._current_extraction_method accordingly. Ignore unknown parameters.
         for parameter, value in settings_dict.items():
@@ -248,9 +273,90 @@ class PulseExtractor(PulseExtractorBase):
             extraction_method = self._gated_extraction_methods[self._current_extraction_method]
         else:
             extraction_method = self._ungated_extraction_methods[self._current_extraction_method]
+
+        if not self.is_gated and getattr(extraction_method, 'cacheable_flanks', False):
+            if self._locked_flanks is not None and self._locked_flanks[0] == count_data.shape:
+                return self._slice_laser_pulses(count_data,
+                                                self._locked_flanks[1],
+                                                self._locked_flanks[2])
+            kwargs = self._get_extraction_method_kwargs(extraction_method)
+            return_dict = extraction_method(count_data=count_data, **kwargs)
+            self._update_flank_cache(count_data, return_dict)
+            return return_dict
+
         kwargs = self._get_extraction_method_kwargs(extraction_method)
         return extraction_method(count_data=count_data, **kwargs)
 
+    @property
+    def flanks_locked(self):
+        """
+        @return bool: True if the flank positions are locked in and extraction only slices the
+                      laser pulses.
+        """
+        return self._locked_flanks is not None
+
+    @property
+    def locked_flanks(self):
+        """
+        @return tuple(numpy.ndarray, numpy.ndarray): copies of the locked rising and falling flank
+                                                     indices, None if the flanks are not locked
+        """
+        if self._locked_flanks is None:
+            return None
+        return self._locked_flanks[1].copy(), self._locked_flanks[2].copy()
+
+    def invalidate_flank_cache(self):
+        """
+        Forget the cached flank positions. Needs to be called whenever the pulse sequence, the
+        extraction settings or the fast counter settings change.
+        """
+        self._last_flanks = None
+        self._locked_flanks = None
+
+    def _update_flank_cache(self, count_data, return_dict):
+        """
+        Lock in the flank positions of an extraction if they agree with the previous extraction.
+        Two subsequent extractions on an accumulated timetrace only agree once the signal to noise
+        ratio is good enough for a stable detection.
+
+        @param numpy.ndarray count_data: the timetrace the flanks were extracted from
+        @param dict return_dict: result dictionary of the extraction method
+        """
+        rising = np.asarray(return_dict.get('laser_indices_rising', []), dtype='int64')
+        falling = np.asarray(return_dict.get('laser_indices_falling', []), dtype='int64')
+        laser_counts = return_dict.get('laser_counts_arr')
+        if rising.size == 0 or rising.size != falling.size or laser_counts is None or \
+                not laser_counts.any():
+            self._last_flanks = None
+            return
+
+        flanks = (count_data.shape, rising.copy(), falling.copy())
+        last = self._last_flanks
+        if last is not None and last[0] == flanks[0] and last[1].size == rising.size and \
+                np.max(np.abs(last[1] - rising)) <= self.flank_tolerance and \
+                np.max(np.abs(last[2] - falling)) <= self.flank_tolerance:
+            self._locked_flanks = flanks
+        self._last_flanks = flanks
+
+    @staticmethod
+    def _slice_laser_pulses(count_data, rising_ind, falling_ind):
+        """
+        Gather the laser pulses from the timetrace at known flank positions.
+
+        @param numpy.ndarray count_data: 1D timetrace
+        @param numpy.ndarray rising_ind: sorted indices of the rising flanks
+        @param numpy.ndarray falling_ind: sorted indices of the falling flanks
+        @return dict: result dictionary in the format of the extraction methods
+        """
+        laser_length = max(int(np.max(falling_ind - rising_ind)), 0)
+        index = rising_ind[:, np.newaxis] + np.arange(laser_length)
+        laser_arr = np.take(count_data, index, mode='clip').astype('int64')
+        # zero-pad laser pulses reaching beyond the end of the timetrace
+        laser_arr[index >= count_data.size] = 0
+        return {'laser_counts_arr': laser_arr,
+                'laser_indices_rising': rising_ind.copy(),
+                'laser_indices_falling': falling_ind.copy()}
+
     def _get_extraction_method_kwargs(self, method):
         """
         Get the proper values for keyword arguments other than "count_data" for <method>.
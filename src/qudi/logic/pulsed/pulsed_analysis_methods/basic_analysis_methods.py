@@ -21,7 +21,83 @@ If not, see <https://www.gnu.org/licenses/>.
 
 import numpy as np
 
-from qudi.logic.pulsed.pulse_analyzer import PulseAnalyzerBase
+from qudi.logic.pulsed.pulse_analyzer import PulseAnalyzerBase, window_sums_analysis
+
+
+def _window_sums(laser_data, start_bin, end_bin):
+    """
+    Sum up the bins [start_bin:end_bin] of all laser pulses in a single vectorized reduction.
+    Integer counts are accumulated in int64.
+
+    @param 2D numpy.ndarray laser_data: laser pulses, dim 0: laser pulse; dim 1: time bin
+    @param int start_bin: first bin of the window
+    @param int end_bin: bin after the last bin of the window
+
+    @return numpy.ndarray, int: sum per laser pulse, number of bins in the window
+    """
+    window = laser_data[:, start_bin:end_bin]
+    dtype = np.int64 if np.issubdtype(window.dtype, np.integer) else None
+    return window.sum(axis=1, dtype=dtype), window.shape[1]
+
+
+def _window_means(window_sum, window_len):
+    """ Mean count per bin of each window, 0 for empty windows. """
+    window_len = np.broadcast_to(window_len, np.shape(window_sum))
+    window_mean = np.zeros(np.shape(window_sum), dtype=float)
+    np.divide(window_sum, window_len, out=window_mean, where=window_len != 0)
+    return window_mean
+
+
+def _mean_norm_from_sums(signal_sum, signal_len, reference_sum, reference_len):
+    """ Signal mean normalized by the reference mean, see BasicPulseAnalyzer.analyse_mean_norm """
+    signal_mean = _window_means(signal_sum, signal_len)
+    reference_mean = _window_means(reference_sum, reference_len)
+
+    # Calculate normalized signal while avoiding division by zero
+    valid = (reference_mean > 0) & (signal_mean >= 0)
+    signal_data = np.zeros(signal_mean.shape, dtype=float)
+    np.divide(signal_mean, reference_mean, out=signal_data, where=valid)
+
+    # Calculate measurement error while avoiding division by zero
+    valid = (reference_sum > 0) & (signal_sum > 0)
+    error_data = np.zeros(signal_mean.shape, dtype=float)
+    # calculate with respect to gaussian error 'evolution'
+    error_data[valid] = signal_data[valid] * np.sqrt(1 / signal_sum[valid] +
+                                                     1 / reference_sum[valid])
+    return signal_data, error_data
+
+
+def _sum_from_sums(signal_sum, signal_len, reference_sum, reference_len):
+    """ Signal window sum, see BasicPulseAnalyzer.analyse_sum """
+    # Avoid numpy C type variables overflow and NaN values
+    valid = signal_sum >= 0
+    signal_data = np.zeros(np.shape(signal_sum), dtype=float)
+    error_data = np.zeros(np.shape(signal_sum), dtype=float)
+    signal_data[valid] = signal_sum[valid]
+    error_data[valid] = np.sqrt(signal_data[valid])
+    return signal_data, error_data
+
+
+def _mean_from_sums(signal_sum, signal_len, reference_sum, reference_len):
+    """ Signal window mean, see BasicPulseAnalyzer.analyse_mean """
+    signal_len = np.broadcast_to(signal_len, np.shape(signal_sum))
+    # Avoid numpy C type variables overflow, NaN values and empty windows
+    valid = (signal_sum >= 0) & (signal_len > 0)
+    signal_data = np.zeros(np.shape(signal_sum), dtype=float)
+    error_data = np.zeros(np.shape(signal_sum), dtype=float)
+    signal_data[valid] = signal_sum[valid] / signal_len[valid]
+    error_data[valid] = np.sqrt(signal_sum[valid]) / signal_len[valid]
+    return signal_data, error_data
+
+
+def _mean_reference_from_sums(signal_sum, signal_len, reference_sum, reference_len):
+    """ Signal mean minus reference mean, see BasicPulseAnalyzer.analyse_mean_reference """
+    signal_data = _window_means(signal_sum, signal_len) - _window_means(reference_sum,
+                                                                        reference_len)
+    # calculate with respect to gaussian error 'evolution'
+    with np.errstate(divide='ignore', invalid='ignore'):
+        error_data = signal_data * np.sqrt(1 / np.abs(signal_sum) + 1 / np.abs(reference_sum))
+    return signal_data, error_data
 
 
 class BasicPulseAnalyzer(PulseAnalyzerBase):
@@ -31,6 +107,7 @@ class BasicPulseAnalyzer(PulseAnalyzerBase):
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
 
+    @window_sums_analysis(_mean_norm_from_sums)
     def analyse_mean_norm(self, laser_data, signal_start=0.0, signal_end=200e-9, norm_start=300e-9,
                           norm_end=500e-9):
         """
@@ -56,37 +133,13 @@ class BasicPulseAnalyzer(PulseAnalyzerBase):
         norm_start_bin = round(norm_start / bin_width)
         norm_end_bin = round(norm_end / bin_width)
 
-        # initialize data arrays for signal and measurement error
-        signal_data = np.empty(num_of_lasers, dtype=float)
-        error_data = np.empty(num_of_lasers, dtype=float)
-
-        # loop over all laser pulses and analyze them
-        for ii, laser_arr in enumerate(laser_data):
-            # calculate the sum and mean of the data in the normalization window
-            tmp_data = laser_arr[norm_start_bin:norm_end_bin]
-            reference_sum = np.sum(tmp_data)
-            reference_mean = (reference_sum / len(tmp_data)) if len(tmp_data) != 0 else 0.0
-
-            # calculate the sum and mean of the data in the signal window
-            tmp_data = laser_arr[signal_start_bin:signal_end_bin]
-            signal_sum = np.sum(tmp_data)
-            signal_mean = (signal_sum / len(tmp_data)) if len(tmp_data) != 0 else 0.0
-
-            # Calculate normalized signal while avoiding division by zero
-            if reference_mean > 0 and signal_mean >= 0:
-                signal_data[ii] = signal_mean / reference_mean
-            else:
-                signal_data[ii] = 0.0
-
-            # Calculate measurement error while avoiding division by zero
-            if reference_sum > 0 and signal_sum > 0:
-                # calculate with respect to gaussian error 'evolution'
-                error_data[ii] = signal_data[ii] * np.sqrt(1 / signal_sum + 1 / reference_sum)
-            else:
-                error_data[ii] = 0.0
-
-        return signal_data, error_data
+        # calculate the sum and mean of the data in the normalization and signal window of all
+        # laser pulses at once
+        reference_sum, reference_len = _window_sums(laser_data, norm_start_bin, norm_end_bin)
+        signal_sum, signal_len = _window_sums(laser_data, signal_start_bin, signal_end_bin)
+        return _mean_norm_from_sums(signal_sum, signal_len, reference_sum, reference_len)
 
+    @window_sums_analysis(_sum_from_sums)
     def analyse_sum(self, laser_data, signal_start=0.0, signal_end=200e-9):
         """
         @param laser_data:
@@ -106,26 +159,11 @@ class BasicPulseAnalyzer(PulseAnalyzerBase):
         signal_start_bin = round(signal_start / bin_width)
         signal_end_bin = round(signal_end / bin_width)
 
-        # initialize data arrays for signal and measurement error
-        signal_data = np.empty(num_of_lasers, dtype=float)
-        error_data = np.empty(num_of_lasers, dtype=float)
-
-        # loop over all laser pulses and analyze them
-        for ii, laser_arr in enumerate(laser_data):
-            # calculate the sum of the data in the signal window
-            signal = laser_arr[signal_start_bin:signal_end_bin].sum()
-            signal_error = np.sqrt(signal)
-
-            # Avoid numpy C type variables overflow and NaN values
-            if signal < 0 or signal != signal:
-                signal_data[ii] = 0.0
-                error_data[ii] = 0.0
-            else:
-                signal_data[ii] = signal
-                error_data[ii] = signal_error
-
-        return signal_data, error_data
+        # calculate the sum of the data in the signal window of all laser pulses at once
+        signal_sum, signal_len = _window_sums(laser_data, signal_start_bin, signal_end_bin)
+        return _sum_from_sums(signal_sum, signal_len, None, None)
 
+    @window_sums_analysis(_mean_from_sums)
     def analyse_mean(self, laser_data, signal_start=0.0, signal_end=200e-9):
         """
 
@@ -146,26 +184,9 @@ class BasicPulseAnalyzer(PulseAnalyzerBase):
         signal_start_bin = round(signal_start / bin_width)
         signal_end_bin = round(signal_end / bin_width)
 
-        # initialize data arrays for signal and measurement error
-        signal_data = np.empty(num_of_lasers, dtype=float)
-        error_data = np.empty(num_of_lasers, dtype=float)
-
-        # loop over all laser pulses and analyze them
-        for ii, laser_arr in enumerate(laser_data):
-            # calculate the mean of the data in the signal window
-            signal = laser_arr[signal_start_bin:signal_end_bin].mean()
-            signal_sum = laser_arr[signal_start_bin:signal_end_bin].sum()
-            signal_error = np.sqrt(signal_sum) / (signal_end_bin - signal_start_bin)
-
-            # Avoid numpy C type variables overflow and NaN values
-            if signal < 0 or signal != signal:
-                signal_data[ii] = 0.0
-                error_data[ii] = 0.0
-            else:
-                signal_data[ii] = signal
-                error_data[ii] = signal_error
-
-        return signal_data, error_data
+        # calculate the sum and mean of the data in the signal window of all laser pulses at once
+        signal_sum, signal_len = _window_sums(laser_data, signal_start_bin, signal_end_bin)
+        return _mean_from_sums(signal_sum, signal_len, None, None)
 
     def analyse_pass_through(self, laser_data):
         """
@@ -184,6 +205,7 @@ class BasicPulseAnalyzer(PulseAnalyzerBase):
             data = np.ravel(laser_data)
         return data, np.zeros_like(length)
 
+    @window_sums_analysis(_mean_reference_from_sums)
     def analyse_mean_reference(self, laser_data, signal_start=0.0, signal_end=200e-9, norm_start=300e-9,
                           norm_end=500e-9):
         """
@@ -214,25 +236,8 @@ class BasicPulseAnalyzer(PulseAnalyzerBase):
         norm_start_bin = round(norm_start / bin_width)
         norm_end_bin = round(norm_end / bin_width)
 
-        # initialize data arrays for signal and measurement error
-        signal_data = np.empty(num_of_lasers, dtype=float)
-        error_data = np.empty(num_of_lasers, dtype=float)
-
-        # loop over all laser pulses and analyze them
-        for ii, laser_arr in enumerate(laser_data):
-            # calculate the sum and mean of the data in the normalization window
-            tmp_data = laser_arr[norm_start_bin:norm_end_bin]
-            reference_sum = np.sum(tmp_data)
-            reference_mean = (reference_sum / len(tmp_data)) if len(tmp_data) != 0 else 0.0
-
-            # calculate the sum and mean of the data in the signal window
-            tmp_data = laser_arr[signal_start_bin:signal_end_bin]
-            signal_sum = np.sum(tmp_data)
-            signal_mean = (signal_sum / len(tmp_data)) if len(tmp_data) != 0 else 0.0
-
-            signal_data[ii] = signal_mean - reference_mean
-
-            # calculate with respect to gaussian error 'evolution'
-            error_data[ii] = signal_data[ii] * np.sqrt(1 / abs(signal_sum) + 1 / abs(reference_sum))
-
-        return signal_data, error_data
+        # calculate the sum and mean of the data in the normalization and signal window of all
+        # laser pulses at once
+        reference_sum, reference_len = _window_sums(laser_data, norm_start_bin, norm_end_bin)
+        signal_sum, signal_len = _window_sums(laser_data, signal_start_bin, signal_end_bin)
+        return _mean_reference_from_sums(signal_sum, signal_len, reference_sum, reference_len)
@@ -0,0 +1,100 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains the worker running laser pulse extraction and analysis of the pulsed measurement
+logic in a dedicated thread.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+from PySide2 import QtCore
+
+from qudi.util.mutex import Mutex
+
+__all__ = ['PulsedAnalysisWorker']
+
+
+class PulsedAnalysisWorker(QtCore.QObject):
+    """ Pipeline stage processing raw data snapshots outside of the logic thread.
+
+    The logic submits a raw data snapshot after every acquisition and continues immediately. The
+    worker thread processes the snapshots one after the other with the given process function and
+    emits each result with sigResultReady.
+
+    Raw data of a fast counter accumulates, so only the newest snapshot is of interest: if the
+    worker is still busy when a new snapshot is submitted, a snapshot waiting to be processed is
+    replaced, which is counted in skipped_jobs.
+    """
+
+    # job id, result of the process function
+    sigResultReady = QtCore.Signal(int, object)
+    _sigProcess = QtCore.Signal()
+
+    def __init__(self, process_func, parent=None):
+        """
+        @param callable process_func: function called with the submitted arguments in the worker
+                                      thread, returning the result to emit (None for no result)
+        """
+        super().__init__(parent)
+        self._process_func = process_func
+        self._lock = Mutex()
+        self._pending = None
+        self._busy = False
+        self.skipped_jobs = 0
+        self._sigProcess.connect(self._process, QtCore.Qt.QueuedConnection)
+
+    @property
+    def is_busy(self):
+        with self._lock:
+            return self._busy
+
+    def submit(self, job_id, *args):
+        """ Queue a job for the worker thread. Returns immediately.
+
+        @param int job_id: id emitted together with the result, e.g. to discard outdated results
+        @param args: arguments of the process function
+        """
+        with self._lock:
+            if self._pending is not None:
+                self.skipped_jobs += 1
+            self._pending = (job_id, args)
+            if self._busy:
+                return
+            self._busy = True
+        self._sigProcess.emit()
+
+    def clear(self):
+        """ Drop the job waiting to be processed, if any. """
+        with self._lock:
+            self._pending = None
+
+    @QtCore.Slot()
+    def _process(self):
+        while True:
+            with self._lock:
+                job = self._pending
+                self._pending = None
+                if job is None:
+                    self._busy = False
+                    return
+            job_id, args = job
+            try:
+                result = self._process_func(*args)
+            except:
+                # the process function has to report its errors itself, the worker must survive
+                result = None
+            if result is not None:
+                self.sigResultReady.emit(job_id, result)
@@ -388,6 +388,10 @@ class PulsedMasterLogic(LogicBase):
     def laser_data(self):
         return self.pulsedmeasurementlogic().laser_data
 
+    @property
+    def shared_data_name(self):
+        return self.pulsedmeasurementlogic().shared_data_name
+
     @property
     def alternative_data_type(self):
         return self.pulsedmeasurementlogic().alternative_data_type
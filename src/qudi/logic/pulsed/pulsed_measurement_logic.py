@@ -31,6 +31,8 @@ from qudi.core.configoption import ConfigOption
 from qudi.core.statusvariable import StatusVar
 from qudi.core.module import LogicBase
 from qudi.util.mutex import Mutex
+from qudi.util.stage_metrics import StageMetrics
+from qudi.util.shared_array import SharedArrayPublisher
 from qudi.util.network import netobtain
 from qudi.util.datafitting import FitConfigurationsModel, FitContainer
 from qudi.util.math import compute_ft
@@ -39,6 +41,7 @@ from qudi.util.units import ScaledFloat
 from qudi.util.colordefs import QudiMatplotlibStyle
 from qudi.logic.pulsed.pulse_extractor import PulseExtractor
 from qudi.logic.pulsed.pulse_analyzer import PulseAnalyzer
+from qudi.logic.pulsed.pulsed_analysis_worker import PulsedAnalysisWorker
 
 
 def _data_storage_from_cfg_option(cfg_str):
@@ -63,6 +66,9 @@ class PulsedMeasurementLogic(LogicBase):
         raw_data_save_type: 'text'
         #additional_extraction_path: # optional
         #additional_analysis_path:   # optional
+        #pipelined_analysis: False   # optional, extract and analyse in a worker thread
+        #event_mode_analysis: False  # optional, analyse photon counts per laser pulse window
+        #shared_memory_transport: False  # optional, publish the data arrays into shared memory
         connect:
             fastcounter: 'fast_counter_dummy'
             pulsegenerator: 'pulser_dummy'
@@ -83,6 +89,17 @@ class PulsedMeasurementLogic(LogicBase):
                                              default='text',
                                              converter=_data_storage_from_cfg_option)
     _save_thumbnails = ConfigOption(name='save_thumbnails', default=True)
+    # Run laser pulse extraction and analysis in a worker thread. Only the fast counter readout
+    # happens in the timer tick, so the threadlock is held only very briefly.
+    _pipelined_analysis = ConfigOption(name='pipelined_analysis', default=False)
+    # Let fast counters supporting it (e.g. PicoHarp300 in T3 mode) count the photons in the
+    # analysis windows of every laser pulse as they arrive, once the laser flanks are locked.
+    # The analysis then only reads these sums instead of the whole time trace.
+    _event_mode_analysis = ConfigOption(name='event_mode_analysis', default=False)
+    # Publish the measurement data arrays into a shared memory segment on every update, so GUIs
+    # and other modules running in another process on the same computer map the arrays instead
+    # of receiving serialized copies over the remote connection (see shared_data_name).
+    _shared_memory_transport = ConfigOption(name='shared_memory_transport', default=False)
 
     # status variables
     # ext. microwave settings
@@ -144,6 +161,10 @@ class PulsedMeasurementLogic(LogicBase):
     sigStartTimer = QtCore.Signal()
     sigStopTimer = QtCore.Signal()
 
+    # measurement data arrays published by the shared memory transport
+    SHARED_DATA_NAMES = ('signal_data', 'signal_alt_data', 'measurement_error', 'laser_data',
+                         'raw_data')
+
     __default_fit_configs = (
         {'name': 'Gaussian Dip',
          'model': 'Gaussian',
@@ -227,6 +248,19 @@ class PulsedMeasurementLogic(LogicBase):
 
         # threading
         self._threadlock = Mutex()
+        # serializes extraction/analysis with changes of their settings
+        self._analysis_lock = Mutex()
+        self._analysis_thread = None
+        self._analysis_worker = None
+        # id of the newest raw data snapshot, results of older snapshots are discarded
+        self._analysis_job_id = 0
+        # event mode analysis state, see _enable_event_windows
+        self._event_windows_active = False
+        self._event_window_bins = None
+        # latencies of fast counter readout, extraction and analysis, see get_pipeline_metrics
+        self._stage_metrics = StageMetrics(('fetch', 'extract', 'analyze'))
+        # shared memory copy of the measurement data, see _emit_measurement_data_updated
+        self._shared_data = None
 
         # measurement data
         self.signal_data = np.empty((2, 0), dtype=float)
@@ -237,6 +271,7 @@ class PulsedMeasurementLogic(LogicBase):
 
         self._saved_raw_data = dict()  # temporary saved raw data
         self._recalled_raw_data_tag = None  # the currently recalled raw data dict key
+        self._accumulated_raw_data = None  # recalled plus current raw data, updated by deltas
 
         # Paused measurement flag
         self.__is_paused = False
@@ -266,6 +301,20 @@ class PulsedMeasurementLogic(LogicBase):
         self.__analysis_timer.timeout.connect(self._pulsed_analysis_loop,
                                               QtCore.Qt.QueuedConnection)
 
+        # Worker thread for extraction and analysis
+        if self._pipelined_analysis:
+            self._analysis_thread = self._qudi_main.thread_manager.get_new_thread(
+                name='{0}-analysis'.format(self.module_name))
+            if self._analysis_thread is None:
+                self.log.error('Unable to create analysis worker thread. Falling back to analysis '
+                               'in the timer tick.')
+            else:
+                self._analysis_worker = PulsedAnalysisWorker(self._process_raw_data)
+                self._analysis_worker.moveToThread(self._analysis_thread)
+                self._analysis_worker.sigResultReady.connect(self._apply_analysis_result,
+                                                             QtCore.Qt.QueuedConnection)
+                self._analysis_thread.start()
+
         # Fitting
         self.fit_config_model = FitConfigurationsModel(parent=self)
         self.fit_config_model.load_configs(self._fit_configs)
@@ -300,6 +349,10 @@ class PulsedMeasurementLogic(LogicBase):
         # recalled saved raw data dict key
         self._recalled_raw_data_tag = None
 
+        if self._shared_memory_transport:
+            self._shared_data = SharedArrayPublisher(self.SHARED_DATA_NAMES)
+            self._publish_shared_data()
+
         # Connect internal signals
         self.sigStartTimer.connect(self.__analysis_timer.start, QtCore.Qt.QueuedConnection)
         self.sigStopTimer.connect(self.__analysis_timer.stop, QtCore.Qt.QueuedConnection)
@@ -313,6 +366,17 @@ class PulsedMeasurementLogic(LogicBase):
         self.__analysis_timer.timeout.disconnect()
         self.sigStartTimer.disconnect()
         self.sigStopTimer.disconnect()
+        if self._analysis_worker is not None:
+            self._analysis_worker.clear()
+            self._analysis_worker.sigResultReady.disconnect()
+            thread_manager = self._qudi_main.thread_manager
+            thread_manager.quit_thread(self._analysis_thread)
+            thread_manager.join_thread(self._analysis_thread)
+            self._analysis_worker = None
+            self._analysis_thread = None
+        if self._shared_data is not None:
+            self._shared_data.close()
+            self._shared_data = None
         return
 
     @extraction_parameters.representer
@@ -390,6 +454,11 @@ class PulsedMeasurementLogic(LogicBase):
                 else:
                     self.__fast_counter_gates = 0
 
+            # the laser flanks have to be detected again for new fast counter settings, the
+            # analysis worker extracts (and caches) them under the analysis lock:
+            with self._analysis_lock:
+                self._pulseextractor.invalidate_flank_cache()
+
             # Apply the settings to hardware
             self.__fast_counter_binwidth, \
             self.__fast_counter_record_length, \
@@ -467,6 +536,47 @@ class PulsedMeasurementLogic(LogicBase):
     @property
     def elapsed_time(self):
         return self.__elapsed_time
+
+    @property
+    def shared_data_name(self):
+        """ Name of the shared memory segment with the measurement data, to be mapped with
+        qudi.util.shared_array.SharedArrayReader. None if the shared memory transport is disabled.
+        The segment is replaced (and the reader closed) if the data outgrows it.
+        """
+        return None if self._shared_data is None else self._shared_data.name
+
+    @property
+    def shared_data_version(self):
+        """ Version of the data in the shared memory segment, -1 if the transport is disabled. """
+        return -1 if self._shared_data is None else self._shared_data.version
+
+    def _publish_shared_data(self):
+        self._shared_data.publish(**{name: getattr(self, name) for name in self.SHARED_DATA_NAMES})
+
+    def _emit_measurement_data_updated(self):
+        """ Publish the measurement data into the shared memory segment (if enabled) before the
+        consumers are notified. The data arrays are replaced instead of modified in place (see
+        _swap_analysis_result), so this needs no lock.
+        """
+        if self._shared_data is not None:
+            self._publish_shared_data()
+        self.sigMeasurementDataUpdated.emit()
+
+    def get_pipeline_metrics(self):
+        """ Query the latencies of the analysis pipeline, e.g. to find out where throughput is lost.
+
+        @return dict: 'stages' with the latencies of the fast counter readout (fetch), laser pulse
+                      extraction (extract) and analysis (analyze), see StageLatency.to_dict,
+                      'skipped_jobs' with the raw data snapshots the pipelined analysis had no
+                      time for and 'fast_counter' with the metrics of the fast counter hardware,
+                      if it provides get_metrics (None otherwise)
+        """
+        fastcounter = self._fastcounter()
+        return {'stages': self._stage_metrics.snapshot(),
+                'skipped_jobs': 0 if self._analysis_worker is None else
+                self._analysis_worker.skipped_jobs,
+                'fast_counter': fastcounter.get_metrics() if hasattr(fastcounter, 'get_metrics')
+                else None}
     ############################################################################
 
     ############################################################################
@@ -763,8 +873,9 @@ class PulsedMeasurementLogic(LogicBase):
                 settings_dict[key] = num_bins_fast * self.fast_counter_settings['bin_width']
 
         # Use threadlock to update settings during a running measurement
-        with self._threadlock:
+        with self._threadlock, self._analysis_lock:
             self._pulseanalyzer.analysis_settings = settings_dict
+            self._disable_event_windows()
             self.sigAnalysisSettingsUpdated.emit(self.analysis_settings)
         return
 
@@ -788,8 +899,9 @@ class PulsedMeasurementLogic(LogicBase):
             settings_dict.update(kwargs)
 
         # Use threadlock to update settings during a running measurement
-        with self._threadlock:
+        with self._threadlock, self._analysis_lock:
             self._pulseextractor.extraction_settings = settings_dict
+            self._disable_event_windows()
             self.sigExtractionSettingsUpdated.emit(self.extraction_settings)
         return
 
@@ -843,6 +955,10 @@ class PulsedMeasurementLogic(LogicBase):
                 if 'alternating' in settings_dict:
                     self._alternating = bool(settings_dict.get('alternating'))
 
+        # the pulse sequence may have changed, so the laser flanks have to be detected again
+        with self._threadlock, self._analysis_lock:
+            self._pulseextractor.invalidate_flank_cache()
+
         # Perform sanity checks on settings
         self._measurement_settings_sanity_check()
 
@@ -891,10 +1007,19 @@ class PulsedMeasurementLogic(LogicBase):
                 self.do_fit('No Fit', False)
                 self.do_fit('No Fit', True)
 
-                # initialize data arrays
+                # initialize data arrays and discard pending results of the previous measurement
                 self._initialize_data_arrays()
+                with self._analysis_lock:
+                    self._pulseextractor.invalidate_flank_cache()
+                self._disable_event_windows()
+                self._analysis_job_id += 1
+                if self._analysis_worker is not None:
+                    self._analysis_worker.clear()
+                    self._analysis_worker.skipped_jobs = 0
+                self._stage_metrics.reset()
 
                 # recall stashed raw data
+                self._accumulated_raw_data = None
                 if stashed_raw_data_tag in self._saved_raw_data:
                     self._recalled_raw_data_tag = stashed_raw_data_tag
                     self.log.info('Starting pulsed measurement with stashed raw data "{0}".'
@@ -934,7 +1059,7 @@ class PulsedMeasurementLogic(LogicBase):
         """
         # Get raw data and analyze it a last time just before stopping the measurement.
         try:
-            self._pulsed_analysis_loop()
+            self._pulsed_analysis_loop(synchronous=True)
         except:
             pass
 
@@ -952,7 +1077,8 @@ class PulsedMeasurementLogic(LogicBase):
 
                 # stash raw data if requested
                 if stash_raw_data_tag:
-                    self._saved_raw_data[stash_raw_data_tag] = (self.raw_data.copy(),
+                    # stashed data is accumulated later on, so keep it as int64:
+                    self._saved_raw_data[stash_raw_data_tag] = (self.raw_data.astype('int64'),
                                                                 {'elapsed_sweeps': self.__elapsed_sweeps,
                                                                  'elapsed_time': self.__elapsed_time})
                 self._recalled_raw_data_tag = None
@@ -1073,7 +1199,7 @@ class PulsedMeasurementLogic(LogicBase):
                 self._alternative_data_type = alt_data_type
 
             self._compute_alt_data()
-            self.sigMeasurementDataUpdated.emit()
+            self._emit_measurement_data_updated()
         return
 
     @QtCore.Slot()
@@ -1081,7 +1207,7 @@ class PulsedMeasurementLogic(LogicBase):
         """ Analyse and display the data
         """
         if self.module_state() == 'locked':
-            self._pulsed_analysis_loop()
+            self._pulsed_analysis_loop(synchronous=True)
         return
 
     @QtCore.Slot(str)
@@ -1201,83 +1327,280 @@ class PulsedMeasurementLogic(LogicBase):
         return
 
     @QtCore.Slot()
-    def _pulsed_analysis_loop(self):
+    def _pulsed_analysis_loop(self, synchronous=False):
         """ Acquires laser pulses from fast counter,
             calculates fluorescence signal and creates plots.
+
+        With pipelined_analysis enabled, only the fast counter readout happens here. Extraction and
+        analysis of the raw data snapshot run in the worker thread and the result is swapped in by
+        _apply_analysis_result.
+        In event mode (see _enable_event_windows), only the window sums per laser pulse are read
+        and analysed.
+
+        @param bool synchronous: Analyse in this thread even if pipelined_analysis is enabled
         """
         with self._threadlock:
             if self.module_state() == 'locked':
-                # Update elapsed time
+                if self._event_windows_active and not synchronous:
+                    # only the window sums of all laser pulses are read from the fast counter
+                    if not self._analyse_event_windows():
+                        self._disable_event_windows()
+
+                if synchronous or not self._event_windows_active:
+                    # Get counter raw data (including recalled raw data from previous measurement)
+                    start = time.perf_counter()
+                    fc_data, info_dict = self._get_raw_data()
+                    self._stage_metrics.record('fetch', start)
+                    self.raw_data = fc_data
+                    self.__elapsed_sweeps = info_dict['elapsed_sweeps']
+                    self.__elapsed_time = info_dict['elapsed_time']
+                    self._analysis_job_id += 1
+
+                    if self._analysis_worker is not None and not synchronous:
+                        # the fast counter may reuse its buffer, so the worker gets its own copy,
+                        # and the settings the result is built from are taken here as well:
+                        self._analysis_worker.submit(self._analysis_job_id, np.array(fc_data),
+                                                     self._get_analysis_settings())
+                        self.sigTimerUpdated.emit(self.__elapsed_time, self.__elapsed_sweeps,
+                                                  self.__timer_interval)
+                        return
 
-                self._extract_laser_pulses()
+                    result = self._process_raw_data(fc_data)
+                    if result is not None:
+                        self._swap_analysis_result(result)
+                        self._enable_event_windows()
 
-                tmp_signal, tmp_error = self._analyze_laser_pulses()
+            # emit signals
+            self.sigTimerUpdated.emit(self.__elapsed_time, self.__elapsed_sweeps,
+                                      self.__timer_interval)
+            self._emit_measurement_data_updated()
+            return
 
-                # exclude laser pulses to ignore
-                if len(self._laser_ignore_list) > 0:
-                    # Convert relative negative indices into absolute positive indices
-                    while self._laser_ignore_list[0] < 0:
-                        neg_index = self._laser_ignore_list[0]
-                        self._laser_ignore_list[0] = len(tmp_signal) + neg_index
-                        self._laser_ignore_list.sort()
+    @QtCore.Slot(int, object)
+    def _apply_analysis_result(self, job_id, result):
+        """ Swap in the result of the analysis worker thread, unless it is outdated already.
+        """
+        with self._threadlock:
+            if job_id != self._analysis_job_id:
+                return
+            self._swap_analysis_result(result)
+            self._enable_event_windows()
+        self._emit_measurement_data_updated()
+        return
 
-                    tmp_signal = np.delete(tmp_signal, self._laser_ignore_list)
-                    tmp_error = np.delete(tmp_error, self._laser_ignore_list)
+    def _swap_analysis_result(self, result):
+        """ Replace the measurement data arrays by the ones of an analysis result. The arrays are
+        never modified in place, so the lock only needs to cover the swap.
+        """
+        self.laser_data = result['laser_data']
+        self.signal_data = result['signal_data']
+        self.measurement_error = result['measurement_error']
+        self.signal_alt_data = result['signal_alt_data']
+        return
 
-                # order data according to alternating flag
-                if self._alternating:
-                    if len(self.signal_data[0]) != len(tmp_signal[::2]):
-                        self.log.error('Length of controlled variable ({0}) does not match length of number of readout '
-                                       'pulses ({1}).'.format(len(self.signal_data[0]), len(tmp_signal[::2])))
-                        return
-                    self.signal_data[1] = tmp_signal[::2]
-                    self.signal_data[2] = tmp_signal[1::2]
-                    self.measurement_error[1] = tmp_error[::2]
-                    self.measurement_error[2] = tmp_error[1::2]
-                else:
-                    if len(self.signal_data[0]) != len(tmp_signal):
-                        self.log.error('Length of controlled variable ({0}) does not match length of number of readout '
-                                       'pulses ({1}).'.format(len(self.signal_data[0]), len(tmp_signal)))
-                        return
-                    self.signal_data[1] = tmp_signal
-                    self.measurement_error[1] = tmp_error
+    def _get_analysis_settings(self):
+        """
+        Snapshot of the measurement settings the analysis result is built from. The settings are
+        only changed in the thread of this logic, which also submits the jobs of the analysis
+        worker, so the worker never sees half old and half new settings.
+
+        @return dict: 'laser_ignore_list', 'controlled_variable', 'alternating' and
+                      'alternative_data_type'
+        """
+        return {'laser_ignore_list': tuple(self._laser_ignore_list),
+                'controlled_variable': np.array(self._controlled_variable, dtype=float),
+                'alternating': self._alternating,
+                'alternative_data_type': self._alternative_data_type}
+
+    def _process_raw_data(self, raw_data, settings=None):
+        """
+        Extract and analyse the laser pulses of a raw data snapshot and compute the signal arrays.
+        Does not touch the measurement data of this logic, so it can run in the analysis worker
+        thread.
+
+        @param numpy.ndarray raw_data: raw count data of the fast counter
+        @param dict settings: optional, measurement settings (see _get_analysis_settings), taken
+                              now if not given
+        @return dict: new 'laser_data', 'signal_data', 'measurement_error' and 'signal_alt_data'
+                      arrays, None on error
+        """
+        if settings is None:
+            settings = self._get_analysis_settings()
+        with self._analysis_lock:
+            try:
+                # extract laser pulses from raw data
+                start = time.perf_counter()
+                return_dict = self._pulseextractor.extract_laser_pulses(raw_data)
+                laser_data = return_dict['laser_counts_arr']
+                self._stage_metrics.record('extract', start, raw_data.size)
+                start = time.perf_counter()
+                tmp_signal, tmp_error = self._analyze_laser_pulses(laser_data)
+                self._stage_metrics.record('analyze', start, laser_data.shape[0])
+            except:
+                self.log.exception('Extraction/analysis of laser pulses failed:')
+                return None
+        return self._build_analysis_result(laser_data, tmp_signal, tmp_error, settings)
+
+    def _build_analysis_result(self, laser_data, tmp_signal, tmp_error, settings):
+        """
+        Sort the analysed signal per laser pulse into new signal data arrays.
 
+        @param numpy.ndarray laser_data: the laser pulses the signal was analysed from
+        @param numpy.ndarray tmp_signal: signal per laser pulse
+        @param numpy.ndarray tmp_error: measurement error per laser pulse
+        @param dict settings: measurement settings, see _get_analysis_settings
+        @return dict: result dictionary like _process_raw_data, None on error
+        """
+        # exclude laser pulses to ignore
+        if len(settings['laser_ignore_list']) > 0:
+            # Convert relative negative indices into absolute positive indices
+            ignore_list = sorted(ind + len(tmp_signal) if ind < 0 else ind
+                                 for ind in settings['laser_ignore_list'])
+            tmp_signal = np.delete(tmp_signal, ignore_list)
+            tmp_error = np.delete(tmp_error, ignore_list)
+
+        controlled_variable = settings['controlled_variable']
+        alternating = settings['alternating']
+        signal_dim = 3 if alternating else 2
+        signal_data = np.empty((signal_dim, len(controlled_variable)), dtype=float)
+        measurement_error = np.empty((signal_dim, len(controlled_variable)), dtype=float)
+        signal_data[0] = controlled_variable
+        measurement_error[0] = controlled_variable
+
+        # order data according to alternating flag
+        if alternating:
+            if len(controlled_variable) != len(tmp_signal[::2]):
+                self.log.error('Length of controlled variable ({0}) does not match length of number of readout '
+                               'pulses ({1}).'.format(len(controlled_variable), len(tmp_signal[::2])))
+                return None
+            signal_data[1] = tmp_signal[::2]
+            signal_data[2] = tmp_signal[1::2]
+            measurement_error[1] = tmp_error[::2]
+            measurement_error[2] = tmp_error[1::2]
+        else:
+            if len(controlled_variable) != len(tmp_signal):
+                self.log.error('Length of controlled variable ({0}) does not match length of number of readout '
+                               'pulses ({1}).'.format(len(controlled_variable), len(tmp_signal)))
+                return None
+            signal_data[1] = tmp_signal
+            measurement_error[1] = tmp_error
+
+        return {'laser_data': laser_data,
+                'signal_data': signal_data,
+                'measurement_error': measurement_error,
                 # Compute alternative data array from signal
-                self._compute_alt_data()
+                'signal_alt_data': self._get_alt_data(signal_data, settings)}
 
-            # emit signals
-            self.sigTimerUpdated.emit(self.__elapsed_time, self.__elapsed_sweeps,
-                                      self.__timer_interval)
-            self.sigMeasurementDataUpdated.emit()
+    def _enable_event_windows(self):
+        """
+        Switch to event mode analysis if configured and possible: the fast counter counts the
+        photons in the analysis windows of every laser pulse as they arrive, and the analysis timer
+        only reads these sums instead of the whole time trace.
+        This requires an ungated fast counter providing set_event_windows, locked laser flanks
+        and an analysis method working on window sums. laser_data and raw_data are not updated
+        in event mode until the measurement is stopped.
+        """
+        if not self._event_mode_analysis or self._event_windows_active:
+            return
+        if self._recalled_raw_data_tag is not None or self.__fast_counter_gates > 0:
+            return
+        fastcounter = self._fastcounter()
+        if not hasattr(fastcounter, 'set_event_windows'):
+            return
+        flanks = self._pulseextractor.locked_flanks
+        windows = self._pulseanalyzer.get_analysis_windows()
+        bin_width = self.fast_counter_settings.get('bin_width')
+        if flanks is None or windows is None or not isinstance(bin_width, float):
             return
 
-    def _extract_laser_pulses(self):
-        # Get counter raw data (including recalled raw data from previous measurement)
-        fc_data, info_dict = self._get_raw_data()
-        self.raw_data = fc_data
-        self.__elapsed_sweeps = info_dict['elapsed_sweeps']
-        self.__elapsed_time = info_dict['elapsed_time']
+        # windows relative to the rising flanks, with the same slice semantics as the
+        # analysis methods applied to the extracted laser pulses
+        rising_ind, falling_ind = flanks
+        laser_bins = range(max(int(np.max(falling_ind - rising_ind)), 0))
+        signal_bins = laser_bins[round(windows['signal_start'] / bin_width):
+                                 round(windows['signal_end'] / bin_width)]
+        signal_windows = rising_ind[:, np.newaxis] + [signal_bins.start, signal_bins.stop]
+        if 'norm_start' in windows:
+            reference_bins = laser_bins[round(windows['norm_start'] / bin_width):
+                                        round(windows['norm_end'] / bin_width)]
+            reference_windows = rising_ind[:, np.newaxis] + [reference_bins.start,
+                                                            reference_bins.stop]
+        else:
+            reference_bins = range(0)
+            reference_windows = None
+
+        if fastcounter.set_event_windows(signal_windows, reference_windows) < 0:
+            return
+        self._event_window_bins = (np.full(rising_ind.size, len(signal_bins)),
+                                   np.full(rising_ind.size, len(reference_bins)))
+        self._event_windows_active = True
+        self.log.debug('Switched to event mode analysis of {0:d} laser pulses.'
+                       ''.format(rising_ind.size))
+        return
 
-        # extract laser pulses from raw data
-        return_dict = self._pulseextractor.extract_laser_pulses(self.raw_data)
-        self.laser_data = return_dict['laser_counts_arr']
+    def _disable_event_windows(self):
+        """ Go back to analysing the whole time trace, e.g. after the analysis windows changed. """
+        if self._event_windows_active:
+            self._event_windows_active = False
+            self._fastcounter().clear_event_windows()
         return
 
-    def _analyze_laser_pulses(self):
+    def _analyse_event_windows(self):
+        """
+        Analyse the window sums counted by the fast counter in event mode.
+
+        @return bool: False if no window sums were available and the time trace must be analysed
+        """
+        start = time.perf_counter()
+        signal_sum, reference_sum, info_dict = self._fastcounter().get_window_sums()
+        self._stage_metrics.record('fetch', start)
+        if signal_sum is None:
+            return False
+        signal_sum = netobtain(signal_sum)
+        reference_sum = netobtain(reference_sum)
+
+        if isinstance(info_dict, dict) and info_dict.get('elapsed_sweeps') is not None:
+            self.__elapsed_sweeps = info_dict['elapsed_sweeps']
+        else:
+            self.__elapsed_sweeps = -1
+        if isinstance(info_dict, dict) and info_dict.get('elapsed_time') is not None:
+            self.__elapsed_time = info_dict['elapsed_time']
+        else:
+            self.__elapsed_time = time.time() - self.__start_time
+
+        signal_len, reference_len = self._event_window_bins
+        with self._analysis_lock:
+            try:
+                start = time.perf_counter()
+                tmp_signal, tmp_error = self._pulseanalyzer.analyse_window_sums(
+                    signal_sum, signal_len, reference_sum, reference_len)
+                self._stage_metrics.record('analyze', start, signal_len.size)
+            except:
+                self.log.exception('Analysis of laser pulse window sums failed:')
+                return False
+        result = self._build_analysis_result(self.laser_data, tmp_signal, tmp_error,
+                                             self._get_analysis_settings())
+        if result is not None:
+            self._analysis_job_id += 1
+            self._swap_analysis_result(result)
+        return True
+
+    def _analyze_laser_pulses(self, laser_data):
         # analyze pulses and get data points for signal array. Also check if extraction
         # worked (non-zero array returned).
-        if self.laser_data.any():
-            tmp_signal, tmp_error = self._pulseanalyzer.analyse_laser_pulses(
-                self.laser_data)
+        if laser_data.any():
+            tmp_signal, tmp_error = self._pulseanalyzer.analyse_laser_pulses(laser_data)
         else:
-            tmp_signal = np.zeros(self.laser_data.shape[0])
-            tmp_error = np.zeros(self.laser_data.shape[0])
+            tmp_signal = np.zeros(laser_data.shape[0])
+            tmp_error = np.zeros(laser_data.shape[0])
         return tmp_signal, tmp_error
 
     def _get_raw_data(self):
         """
         Get the raw count data from the fast counting hardware and perform sanity checks.
         Also add recalled raw data to the newly received data.
+        The fast counter may return an unsigned integer array (e.g. its internal uint32 histogram
+        buffer) instead of int64. Such data is only widened to int64 where it is accumulated.
         @return tuple(numpy.ndarray, info_dict): The count data (1D for ungated, 2D for gated counter) and
                                                  info_dict with keys 'elapsed_sweeps' and 'elapsed_time'
         """
@@ -1299,6 +1622,9 @@ class PulsedMeasurementLogic(LogicBase):
         else:
             elapsed_time = time.time() - self.__start_time
 
+        # counts added since the previous call, if the fast counter provides them
+        delta = info_dict.get('delta') if isinstance(info_dict, dict) else None
+
         # add old raw data from previous measurements if necessary
         if self._saved_raw_data.get(self._recalled_raw_data_tag) is not None:
             # self.log.info('Found old saved raw data with tag "{0}".'
@@ -1311,7 +1637,15 @@ class PulsedMeasurementLogic(LogicBase):
                 fc_data = self._saved_raw_data[self._recalled_raw_data_tag][0]
             elif self._saved_raw_data[self._recalled_raw_data_tag][0].shape == fc_data.shape:
                 self.log.debug('Recalled raw data has the same shape as current data.')
-                fc_data = self._saved_raw_data[self._recalled_raw_data_tag][0] + fc_data
+                if delta is not None and self._accumulated_raw_data is not None and \
+                        self._accumulated_raw_data.shape == fc_data.shape:
+                    # a new array, the previous one may still be used as raw_data:
+                    self._accumulated_raw_data = self._accumulated_raw_data + netobtain(delta)
+                else:
+                    self._accumulated_raw_data = np.add(
+                        self._saved_raw_data[self._recalled_raw_data_tag][0], fc_data,
+                        dtype='int64')
+                fc_data = self._accumulated_raw_data
             else:
                 self.log.warning('Recalled raw data has not the same shape as current data.'
                                  '\nDid NOT add recalled raw data to current time trace.')
@@ -1346,7 +1680,7 @@ class PulsedMeasurementLogic(LogicBase):
         else:
             self.raw_data = np.zeros(number_of_bins, dtype='int64')
 
-        self.sigMeasurementDataUpdated.emit()
+        self._emit_measurement_data_updated()
         return
 
     # FIXME: Revise everything below
@@ -1717,28 +2051,44 @@ class PulsedMeasurementLogic(LogicBase):
         """
         Performing transformations on the measurement data (e.g. fourier transform).
         """
-        if self._alternative_data_type == 'Delta' and len(self.signal_data) == 3:
-            self.signal_alt_data = np.empty((2, self.signal_data.shape[1]), dtype=float)
-            self.signal_alt_data[0] = self.signal_data[0]
-            self.signal_alt_data[1] = self.signal_data[1] - self.signal_data[2]
-        elif self._alternative_data_type == 'FFT' and self.signal_data.shape[1] >= 2:
-            fft_x, fft_y = compute_ft(x_val=self.signal_data[0],
-                                      y_val=self.signal_data[1],
+        self.signal_alt_data = self._get_alt_data(self.signal_data)
+        return
+
+    def _get_alt_data(self, signal_data, settings=None):
+        """
+        Compute the alternative data array from a signal data array.
+
+        @param numpy.ndarray signal_data: signal data array, first row is the controlled variable
+        @param dict settings: optional, measurement settings (see _get_analysis_settings), the
+                              current alternative data type is used if not given
+        @return numpy.ndarray: the alternative data array
+        """
+        if settings is None:
+            alternative_data_type = self._alternative_data_type
+        else:
+            alternative_data_type = settings['alternative_data_type']
+        if alternative_data_type == 'Delta' and len(signal_data) == 3:
+            signal_alt_data = np.empty((2, signal_data.shape[1]), dtype=float)
+            signal_alt_data[0] = signal_data[0]
+            signal_alt_data[1] = signal_data[1] - signal_data[2]
+        elif alternative_data_type == 'FFT' and signal_data.shape[1] >= 2:
+            fft_x, fft_y = compute_ft(x_val=signal_data[0],
+                                      y_val=signal_data[1],
                                       zeropad_num=self.zeropad,
                                       window=self.window,
                                       base_corr=self.base_corr,
                                       psd=self.psd)
-            self.signal_alt_data = np.empty((len(self.signal_data), len(fft_x)), dtype=float)
-            self.signal_alt_data[0] = fft_x
-            self.signal_alt_data[1] = fft_y
-            for dim in range(2, len(self.signal_data)):
-                dummy, self.signal_alt_data[dim] = compute_ft(x_val=self.signal_data[0],
-                                                              y_val=self.signal_data[dim],
-                                                              zeropad_num=self.zeropad,
-                                                              window=self.window,
-                                                              base_corr=self.base_corr,
-                                                              psd=self.psd)
+            signal_alt_data = np.empty((len(signal_data), len(fft_x)), dtype=float)
+            signal_alt_data[0] = fft_x
+            signal_alt_data[1] = fft_y
+            for dim in range(2, len(signal_data)):
+                dummy, signal_alt_data[dim] = compute_ft(x_val=signal_data[0],
+                                                         y_val=signal_data[dim],
+                                                         zeropad_num=self.zeropad,
+                                                         window=self.window,
+                                                         base_corr=self.base_corr,
+                                                         psd=self.psd)
         else:
-            self.signal_alt_data = np.zeros(self.signal_data.shape, dtype=float)
-            self.signal_alt_data[0] = self.signal_data[0]
-        return
+            signal_alt_data = np.zeros(signal_data.shape, dtype=float)
+            signal_alt_data[0] = signal_data[0]
+        return signal_alt_data
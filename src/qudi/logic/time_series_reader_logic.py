@@ -19,6 +19,8 @@ You should have received a copy of the GNU Lesser General Public License along w
 If not, see <https://www.gnu.org/licenses/>.
 """
 
+import os
+import time
 from PySide2 import QtCore
 import numpy as np
 import datetime as dt
@@ -29,9 +31,62 @@ from qudi.core.statusvariable import StatusVar
 from qudi.core.configoption import ConfigOption
 from qudi.core.module import LogicBase
 from qudi.util.mutex import Mutex
+from qudi.util.datastorage import get_timestamp_filename
+from qudi.util.npy_stream_writer import NpyStreamWriter
 from qudi.interface.data_instream_interface import StreamChannelType, StreamingMode
 
 
+class _TraceRingBuffer:
+    """
+    Circular buffer holding the newest <size> samples of each channel.
+    Every sample is stored twice (at index i and i + size), so the whole window is always
+    available as a contiguous view without copying or rolling the data. Appending n samples
+    costs O(n) independent of the buffer size.
+    """
+
+    def __init__(self, channels, size):
+        self._size = max(int(size), 0)
+        self._buffer = np.zeros((channels, 2 * self._size))
+        # index of the oldest sample
+        self._head = 0
+
+    @property
+    def size(self):
+        return self._size
+
+    def append(self, data):
+        """ Add samples, overwriting the oldest ones.
+
+        @param numpy.ndarray data: samples to add, shape [channels, samples]
+        """
+        if self._size == 0:
+            return
+        data = data[:, -self._size:]
+        samples = data.shape[1]
+        first = min(samples, self._size - self._head)
+        for offset in (self._head, self._head + self._size):
+            self._buffer[:, offset:offset + first] = data[:, :first]
+        for offset in (0, self._size):
+            self._buffer[:, offset:offset + samples - first] = data[:, first:]
+        self._head = (self._head + samples) % self._size
+
+    def newest(self, samples):
+        """ Read-only view of the newest samples, ordered from old to new.
+
+        @param int samples: number of samples (at most size)
+        """
+        end = self._head + self._size
+        view = self._buffer[:, end - min(samples, self._size):end]
+        view.flags.writeable = False
+        return view
+
+    def window(self):
+        """ Read-only view of all samples ordered from old to new. It is only valid until the next
+        call of append.
+        """
+        return self.newest(self._size)
+
+
 class TimeSeriesReaderLogic(LogicBase):
     """
     This logic module gathers data from a hardware streaming device.
@@ -41,7 +96,9 @@ class TimeSeriesReaderLogic(LogicBase):
     time_series_reader_logic:
         module.Class: 'time_series_reader_logic.TimeSeriesReaderLogic'
         max_frame_rate: 10  # optional (10Hz by default)
+        max_read_latency: 0.1  # optional, max. time in s new samples may wait to be read
         calc_digital_freq: True  # optional (True by default)
+        recording_chunk_samples: 65536  # optional, samples per chunk streamed to disk
         connect:
             _streamer_con: <streamer_name>
             _savelogic_con: <save_logic_name>
@@ -58,6 +115,11 @@ class TimeSeriesReaderLogic(LogicBase):
     # config options
     _max_frame_rate = ConfigOption('max_frame_rate', default=10, missing='warn')
     _calc_digital_freq = ConfigOption('calc_digital_freq', default=True, missing='warn')
+    _recording_chunk_samples = ConfigOption('recording_chunk_samples', default=65536)
+    # Samples are read in batches of at least one frame (data_rate / max_frame_rate samples) unless
+    # the oldest unread sample would wait longer than max_read_latency. Data updates are emitted at
+    # most with max_frame_rate, independent of how often data is read.
+    _max_read_latency = ConfigOption('max_read_latency', default=0.1)
 
     # status vars
     _trace_window_size = StatusVar('trace_window_size', default=6)
@@ -77,14 +139,19 @@ class TimeSeriesReaderLogic(LogicBase):
         self._samples_per_frame = None
         self._stop_requested = True
 
+        # read and update scheduling
+        self._frame_timer = None
+        self._last_read_time = 0
+        self._last_emit_time = 0
+        self._emit_pending = False
+
         # Data arrays
         self._trace_data = None
         self._trace_times = None
         self._trace_data_averaged = None
-        self.__moving_filter = None
 
-        # for data recording
-        self._recorded_data = None
+        # for data recording, streaming the samples to disk
+        self._recorder = None
         self._data_recording_active = False
         self._record_start_time = None
         return
@@ -137,6 +204,11 @@ class TimeSeriesReaderLogic(LogicBase):
 
         # set up internal frame loop connection
         self._sigNextDataFrame.connect(self.acquire_data_block, QtCore.Qt.QueuedConnection)
+        # QTimer must be created here instead of __init__ to run in this logic's thread.
+        # It delays the next read until a batch of samples is available.
+        self._frame_timer = QtCore.QTimer()
+        self._frame_timer.setSingleShot(True)
+        self._frame_timer.timeout.connect(self.acquire_data_block, QtCore.Qt.QueuedConnection)
         return
 
     def on_deactivate(self):
@@ -147,6 +219,9 @@ class TimeSeriesReaderLogic(LogicBase):
             self._stop_reader_wait()
 
         self._sigNextDataFrame.disconnect()
+        self._frame_timer.stop()
+        self._frame_timer.timeout.disconnect()
+        self._frame_timer = None
 
         # Save status vars
         self._active_channels = self.active_channel_names
@@ -155,12 +230,11 @@ class TimeSeriesReaderLogic(LogicBase):
 
     def _init_data_arrays(self):
         window_size = self.trace_window_size_samples
-        self._trace_data = np.zeros(
-            [self.number_of_active_channels, window_size + self._moving_average_width // 2])
-        self._trace_data_averaged = np.zeros(
-            [len(self._averaged_channels), window_size - self._moving_average_width // 2])
+        self._trace_data = _TraceRingBuffer(self.number_of_active_channels,
+                                            window_size + self._moving_average_width // 2)
+        self._trace_data_averaged = _TraceRingBuffer(
+            len(self._averaged_channels), window_size - self._moving_average_width // 2)
         self._trace_times = np.arange(window_size) / self.data_rate
-        self._recorded_data = list()
         return
 
     @property
@@ -272,18 +346,20 @@ class TimeSeriesReaderLogic(LogicBase):
 
     @property
     def trace_data(self):
-        data_offset = self._trace_data.shape[1] - self._moving_average_width // 2
-        data = {ch: self._trace_data[i, :data_offset] for i, ch in
-                enumerate(self.active_channel_names)}
+        # The window of the circular buffer is only valid until the next append, so the data
+        # is copied once (as a whole) before it is handed to queued signal receivers.
+        data_offset = self._trace_data.size - self._moving_average_width // 2
+        trace = self._trace_data.window()[:, :data_offset].copy()
+        data = {ch: trace[i] for i, ch in enumerate(self.active_channel_names)}
         return self._trace_times, data
 
     @property
     def averaged_trace_data(self):
         if not self.averaged_channel_names or self.moving_average_width <= 1:
             return None, None
-        data = {ch: self._trace_data_averaged[i] for i, ch in
-                enumerate(self.averaged_channel_names)}
-        return self._trace_times[-self._trace_data_averaged.shape[1]:], data
+        trace = self._trace_data_averaged.window().copy()
+        data = {ch: trace[i] for i, ch in enumerate(self.averaged_channel_names)}
+        return self._trace_times[-self._trace_data_averaged.size:], data
 
     @property
     def all_settings(self):
@@ -366,8 +442,6 @@ class TimeSeriesReaderLogic(LogicBase):
                 if new_val / data_rate > self.trace_window_size:
                     if 'data_rate' in settings_dict or 'trace_window_size' in settings_dict:
                         self._moving_average_width = new_val
-                        self.__moving_filter = np.full(shape=self.moving_average_width,
-                                                       fill_value=1.0 / self.moving_average_width)
                     else:
                         self.log.warning('Moving average width to set ({0:d}) is smaller than the '
                                          'trace window size. Will adjust trace window size to '
@@ -375,8 +449,6 @@ class TimeSeriesReaderLogic(LogicBase):
                         self._trace_window_size = float(new_val / data_rate)
                 else:
                     self._moving_average_width = new_val
-                    self.__moving_filter = np.full(shape=self.moving_average_width,
-                                                   fill_value=1.0 / self.moving_average_width)
 
             if 'data_rate' in settings_dict:
                 new_val = float(settings_dict['data_rate'])
@@ -477,6 +549,9 @@ class TimeSeriesReaderLogic(LogicBase):
 
             self.module_state.lock()
             self._stop_requested = False
+            self._last_read_time = time.perf_counter()
+            self._last_emit_time = 0
+            self._emit_pending = False
 
             self.sigStatusChanged.emit(True, self._data_recording_active)
 
@@ -498,8 +573,7 @@ class TimeSeriesReaderLogic(LogicBase):
             # self.sigSettingsChanged.emit(settings)
 
             if self._data_recording_active:
-                self._record_start_time = dt.datetime.now()
-                self._recorded_data = list()
+                self._start_recorder()
 
             if self._streamer().start_stream() < 0:
                 self.log.error('Error while starting streaming device data acquisition.')
@@ -527,7 +601,10 @@ class TimeSeriesReaderLogic(LogicBase):
         """
         This method gets the available data from the hardware.
 
-        It runs repeatedly by being connected to a QTimer timeout signal.
+        It runs repeatedly by re-emitting _sigNextDataFrame. Samples are read in batches of at
+        least one frame; if less samples are available and max_read_latency has not passed since
+        the last read, the next call is delayed until enough samples should be available instead
+        of polling the hardware in a tight loop.
         """
         with self.threadlock:
             if self.module_state() == 'locked':
@@ -539,15 +616,25 @@ class TimeSeriesReaderLogic(LogicBase):
                             'Error while trying to stop streaming device data acquisition.')
                     if self._data_recording_active:
                         self._save_recorded_data(to_file=True, save_figure=True)
-                        self._recorded_data = list()
                     self._data_recording_active = False
                     self.module_state.unlock()
+                    if self._emit_pending:
+                        self._emit_pending = False
+                        self.sigDataChanged.emit(*self.trace_data, *self.averaged_trace_data)
                     self.sigStatusChanged.emit(False, False)
                     return
 
-                samples_to_read = max(
-                    (self._streamer().available_samples // self._oversampling_factor) * self._oversampling_factor,
-                    self._samples_per_frame * self._oversampling_factor)
+                frame_samples = self._samples_per_frame * self._oversampling_factor
+                available = (self._streamer().available_samples // self._oversampling_factor) * \
+                    self._oversampling_factor
+                since_last_read = time.perf_counter() - self._last_read_time
+                if available < frame_samples and since_last_read < self._max_read_latency:
+                    # wait for a full frame, but at most until the latency budget is used up
+                    missing_time = (frame_samples - available) / self.sampling_rate
+                    wait_time = min(missing_time, self._max_read_latency - since_last_read)
+                    self._frame_timer.start(max(1, int(1000 * wait_time)))
+                    return
+                samples_to_read = available if available > 0 else frame_samples
                 if samples_to_read < 1:
                     self._sigNextDataFrame.emit()
                     return
@@ -561,11 +648,18 @@ class TimeSeriesReaderLogic(LogicBase):
                     self._sigNextDataFrame.emit()
                     return
 
+                self._last_read_time = time.perf_counter()
+
                 # Process data
                 self._process_trace_data(data)
 
-                # Emit update signal
-                self.sigDataChanged.emit(*self.trace_data, *self.averaged_trace_data)
+                # Emit update signal, at most with max_frame_rate
+                if self._last_read_time - self._last_emit_time >= 1 / self._max_frame_rate:
+                    self._last_emit_time = self._last_read_time
+                    self._emit_pending = False
+                    self.sigDataChanged.emit(*self.trace_data, *self.averaged_trace_data)
+                else:
+                    self._emit_pending = True
                 self._sigNextDataFrame.emit()
         return
 
@@ -590,27 +684,34 @@ class TimeSeriesReaderLogic(LogicBase):
         if self._calc_digital_freq and digital_channels:
             data[:len(digital_channels)] *= self.sampling_rate
 
-        # Append data to save if necessary
-        if self._data_recording_active:
-            self._recorded_data.append(data)
+        # Stream data to disk if necessary
+        if self._data_recording_active and self._recorder is not None:
+            try:
+                self._recorder.write(data)
+            except (OSError, ValueError):
+                self.log.exception('Writing recorded data to "{0}" failed. Recording stopped.'
+                                   ''.format(self._recorder.file_path))
+                self._save_recorded_data()
+                self._data_recording_active = False
+                self.sigStatusChanged.emit(True, False)
 
-        data = data[:, -self._trace_data.shape[1]:]
+        data = data[:, -self._trace_data.size:]
         new_samples = data.shape[1]
 
-        # Roll data array to have a continuously running time trace
-        self._trace_data = np.roll(self._trace_data, -new_samples, axis=1)
-        # Insert new data
-        self._trace_data[:, -new_samples:] = data
-
-        # Calculate moving average by using numpy.convolve with a normalized uniform filter
-        if self.moving_average_width > 1 and self.averaged_channel_names:
-            # Only convolve the new data and roll the previously calculated moving average
-            self._trace_data_averaged = np.roll(self._trace_data_averaged, -new_samples, axis=1)
-            offset = new_samples + len(self.__moving_filter) - 1
-            for i, ch in enumerate(self.averaged_channel_names):
-                data_index = self.active_channel_names.index(ch)
-                self._trace_data_averaged[i, -new_samples:] = np.convolve(
-                    self._trace_data[data_index, -offset:], self.__moving_filter, mode='valid')
+        # Insert new data into the circular buffer of the continuously running time trace
+        self._trace_data.append(data)
+
+        # Calculate the moving average of the new samples from the running sum over the new data
+        # and the preceding (moving_average_width - 1) samples
+        width = self.moving_average_width
+        if width > 1 and self.averaged_channel_names:
+            channel_indices = [self.active_channel_names.index(ch) for ch in
+                               self.averaged_channel_names]
+            samples = self._trace_data.newest(new_samples + width - 1)[channel_indices]
+            running_sum = np.zeros((samples.shape[0], samples.shape[1] + 1))
+            np.cumsum(samples, axis=1, out=running_sum[:, 1:])
+            self._trace_data_averaged.append(
+                (running_sum[:, width:] - running_sum[:, :-width]) / width)
         return
 
     @QtCore.Slot()
@@ -628,8 +729,7 @@ class TimeSeriesReaderLogic(LogicBase):
 
             self._data_recording_active = True
             if self.module_state() == 'locked':
-                self._recorded_data = list()
-                self._record_start_time = dt.datetime.now()
+                self._start_recorder()
                 self.sigStatusChanged.emit(True, True)
             else:
                 self.start_reading()
@@ -651,72 +751,73 @@ class TimeSeriesReaderLogic(LogicBase):
             self._data_recording_active = False
             if self.module_state() == 'locked':
                 self._save_recorded_data(to_file=True, save_figure=True)
-                self._recorded_data = list()
                 self.sigStatusChanged.emit(True, False)
         return 0
 
+    def _start_recorder(self, name_tag=''):
+        """ Open a new file in the default data directory to stream the recorded data to.
+
+        @param str name_tag: an additional tag, which will be added to the filename
+        """
+        self._record_start_time = dt.datetime.now()
+        os.makedirs(self.module_default_data_dir, exist_ok=True)
+        file_label = 'data_trace_{0}'.format(name_tag) if name_tag else 'data_trace'
+        file_path = os.path.join(
+            self.module_default_data_dir,
+            get_timestamp_filename(timestamp=self._record_start_time, nametag=file_label) + '.npy')
+        self._recorder = NpyStreamWriter(file_path,
+                                         channels=self.number_of_active_channels,
+                                         chunk_samples=self._recording_chunk_samples)
+        try:
+            self._recorder.open()
+        except OSError:
+            self.log.exception('Unable to create recording file "{0}".'.format(file_path))
+            self._recorder = None
+        return
+
     def _save_recorded_data(self, to_file=True, name_tag='', save_figure=True):
-        """ Save the counter trace data and writes it to a file.
+        """ Finish streaming the recorded data to file and save the recording parameters next to
+        it. The samples are already on disk, so this takes the same time for any recording length.
 
-        @param bool to_file: indicate, whether data have to be saved to file
-        @param str name_tag: an additional tag, which will be added to the filename upon save
-        @param bool save_figure: select whether png and pdf should be saved
+        @param bool to_file: indicate, whether the parameters have to be saved to file
+        @param str name_tag: unused, the file name is chosen when the recording starts
+        @param bool save_figure: unused, no figure is created for streamed recordings
 
         @return dict parameters: Dictionary which contains the saving parameters
         """
-        pass
-        # if not self._recorded_data:
-        #     self.log.error('No data has been recorded. Save to file failed.')
-        #     return np.empty(0), dict()
-        #
-        # data_arr = np.concatenate(self._recorded_data, axis=1)
-        # if data_arr.size == 0:
-        #     self.log.error('No data has been recorded. Save to file failed.')
-        #     return np.empty(0), dict()
-        #
-        # saving_stop_time = self._record_start_time + dt.timedelta(
-        #     seconds=data_arr.shape[1] * self.data_rate)
-        #
-        # # write the parameters:
-        # parameters = dict()
-        # parameters['Start recoding time'] = self._record_start_time.strftime(
-        #     '%d.%m.%Y, %H:%M:%S.%f')
-        # parameters['Stop recoding time'] = saving_stop_time.strftime('%d.%m.%Y, %H:%M:%S.%f')
-        # parameters['Data rate (Hz)'] = self.data_rate
-        # parameters['Oversampling factor (samples)'] = self.oversampling_factor
-        # parameters['Sampling rate (Hz)'] = self.sampling_rate
-        #
-        # if to_file:
-        #     # If there is a postfix then add separating underscore
-        #     filelabel = 'data_trace_{0}'.format(name_tag) if name_tag else 'data_trace'
-        #
-        #     # prepare the data in a dict:
-        #     header = ', '.join(
-        #         '{0} ({1})'.format(ch, unit) for ch, unit in self.active_channel_units.items())
-        #
-        #     data = {header: data_arr.transpose()}
-        #     filepath = self._savelogic.get_path_for_module(module_name='TimeSeriesReader')
-        #     set_of_units = set(self.active_channel_units.values())
-        #     unit_list = tuple(self.active_channel_units)
-        #     y_unit = 'arb.u.'
-        #     occurrences = 0
-        #     for unit in set_of_units:
-        #         count = unit_list.count(unit)
-        #         if count > occurrences:
-        #             occurrences = count
-        #             y_unit = unit
-        #
-        #     fig = self._draw_figure(data_arr, self.data_rate, y_unit) if save_figure else None
-        #
-        #     self._savelogic.save_data(data=data,
-        #                               filepath=filepath,
-        #                               parameters=parameters,
-        #                               filelabel=filelabel,
-        #                               plotfig=fig,
-        #                               delimiter='\t',
-        #                               timestamp=saving_stop_time)
-        #     self.log.info('Time series saved to: {0}'.format(filepath))
-        # return data_arr, parameters
+        recorder = self._recorder
+        self._recorder = None
+        if recorder is None:
+            return dict()
+        try:
+            samples = recorder.close()
+        except OSError:
+            self.log.exception('Writing recorded data to "{0}" failed.'.format(recorder.file_path))
+            return dict()
+        if samples == 0:
+            self.log.warning('No data has been recorded.')
+
+        saving_stop_time = self._record_start_time + dt.timedelta(seconds=samples / self.data_rate)
+
+        # write the parameters:
+        parameters = dict()
+        parameters['Start recoding time'] = self._record_start_time.strftime(
+            '%d.%m.%Y, %H:%M:%S.%f')
+        parameters['Stop recoding time'] = saving_stop_time.strftime('%d.%m.%Y, %H:%M:%S.%f')
+        parameters['Data rate (Hz)'] = self.data_rate
+        parameters['Oversampling factor (samples)'] = self.oversampling_factor
+        parameters['Sampling rate (Hz)'] = self.sampling_rate
+        parameters['Number of samples'] = samples
+        parameters['Channels'] = ', '.join(
+            '{0} ({1})'.format(ch, unit) for ch, unit in self.active_channel_units.items())
+
+        if to_file:
+            parameter_path = os.path.splitext(recorder.file_path)[0] + '_parameters.txt'
+            with open(parameter_path, 'w') as file:
+                for key, value in parameters.items():
+                    file.write('{0}: {1}\n'.format(key, value))
+            self.log.info('Time series saved to: {0}'.format(recorder.file_path))
+        return parameters
 
     def _draw_figure(self, data, timebase, y_unit):
         """ Draw figure to save with data file.
@@ -800,7 +901,6 @@ class TimeSeriesReaderLogic(LogicBase):
                     'Error while trying to stop streaming device data acquisition.')
             if self._data_recording_active:
                 self._save_recorded_data(to_file=True, save_figure=True)
-                self._recorded_data = list()
             self._data_recording_active = False
             self.module_state.unlock()
             self.sigStatusChanged.emit(False, False)
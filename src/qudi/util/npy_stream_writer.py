@@ -0,0 +1,179 @@
+# -*- coding: utf-8 -*-
+
+"""
+This file contains a writer appending multi-channel sample blocks to a numpy .npy file from a
+background thread.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import queue
+import threading
+import numpy as np
+
+__all__ = ['NpyStreamWriter']
+
+
+class NpyStreamWriter:
+    """
+    Appends sample blocks of shape [channels, samples] to a .npy file holding an array of shape
+    [samples, channels], which can be read with numpy.load (also memory-mapped).
+
+    Samples are collected in fixed-size chunks. Full chunks are written to disk by a background
+    thread, so write() only copies the samples. A fixed set of chunk buffers is reused, which
+    bounds the memory to (max_queued_chunks + 1) chunks no matter how long the recording runs. If
+    the disk does not keep up and all buffers are queued, write() blocks until one is free.
+    close() only has to write the last chunks and patch the array shape in the file header, so it
+    takes the same time for any recording length.
+    """
+
+    # total size of magic string, header length field and header (multiple of 64 bytes), large
+    # enough for the longest possible shape
+    _HEADER_SIZE = 128
+    _SENTINEL = None
+
+    def __init__(self, file_path, channels, dtype=np.float64, chunk_samples=65536,
+                 max_queued_chunks=8):
+        """
+        @param str file_path: path of the .npy file to create (overwritten if it exists)
+        @param int channels: number of channels per sample
+        @param dtype: data type to store the samples with
+        @param int chunk_samples: number of samples per chunk written to disk at once
+        @param int max_queued_chunks: number of full chunks which may wait to be written
+        """
+        self._file_path = file_path
+        self._channels = int(channels)
+        self._dtype = np.dtype(dtype)
+        self._chunk_samples = max(int(chunk_samples), 1)
+        self._free_chunks = queue.Queue()
+        for _ in range(max(int(max_queued_chunks), 1) + 1):
+            self._free_chunks.put(np.empty((self._chunk_samples, self._channels), self._dtype))
+        self._full_chunks = queue.Queue()
+        self._chunk = None
+        self._chunk_fill = 0
+        self._samples_written = 0
+        self._file = None
+        self._thread = None
+        self._error = None
+
+    @property
+    def file_path(self):
+        return self._file_path
+
+    @property
+    def is_open(self):
+        return self._file is not None
+
+    @property
+    def samples_written(self):
+        """ Number of samples handed to write() so far, including unflushed ones. """
+        return self._samples_written
+
+    def __enter__(self):
+        self.open()
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+    def open(self):
+        """ Create the file and start the writer thread. """
+        if self._file is not None:
+            return
+        self._file = open(self._file_path, 'wb')
+        self._file.write(self._header(0))
+        self._samples_written = 0
+        self._error = None
+        self._chunk = self._free_chunks.get()
+        self._chunk_fill = 0
+        self._thread = threading.Thread(target=self._run, name='NpyStreamWriter', daemon=True)
+        self._thread.start()
+
+    def write(self, data):
+        """ Append samples.
+
+        @param numpy.ndarray data: samples of shape [channels, samples]
+        """
+        if self._file is None:
+            raise RuntimeError('NpyStreamWriter is not open.')
+        if self._error is not None:
+            raise self._error
+        data = np.asarray(data)
+        if data.ndim != 2 or data.shape[0] != self._channels:
+            raise ValueError('NpyStreamWriter expected data of shape [{0:d}, samples], got {1}.'
+                             ''.format(self._channels, data.shape))
+        samples = data.shape[1]
+        index = 0
+        while index < samples:
+            count = min(samples - index, self._chunk_samples - self._chunk_fill)
+            self._chunk[self._chunk_fill:self._chunk_fill + count] = \
+                data[:, index:index + count].T
+            self._chunk_fill += count
+            index += count
+            if self._chunk_fill == self._chunk_samples:
+                self._full_chunks.put((self._chunk, self._chunk_fill))
+                self._chunk = self._free_chunks.get()
+                self._chunk_fill = 0
+        self._samples_written += samples
+
+    def close(self):
+        """ Write the remaining samples, stop the writer thread and finalize the file header.
+
+        @return int: number of samples in the file
+        """
+        if self._file is None:
+            return self._samples_written
+        if self._chunk_fill > 0:
+            self._full_chunks.put((self._chunk, self._chunk_fill))
+        else:
+            self._free_chunks.put(self._chunk)
+        self._chunk = None
+        self._chunk_fill = 0
+        self._full_chunks.put(self._SENTINEL)
+        self._thread.join()
+        self._thread = None
+        try:
+            self._file.seek(0)
+            self._file.write(self._header(self._samples_written))
+        finally:
+            self._file.close()
+            self._file = None
+        if self._error is not None:
+            raise self._error
+        return self._samples_written
+
+    def _run(self):
+        while True:
+            item = self._full_chunks.get()
+            if item is self._SENTINEL:
+                return
+            chunk, count = item
+            try:
+                if self._error is None:
+                    chunk[:count].tofile(self._file)
+            except OSError as err:
+                # reported to the caller with the next write or close
+                self._error = err
+            finally:
+                self._free_chunks.put(chunk)
+
+    def _header(self, samples):
+        """ .npy format version 1.0 header padded to the fixed _HEADER_SIZE. """
+        header = "{{'descr': {0!r}, 'fortran_order': False, 'shape': ({1:d}, {2:d}), }}".format(
+            np.lib.format.dtype_to_descr(self._dtype), samples, self._channels)
+        header = header.ljust(self._HEADER_SIZE - 10 - 1) + '\n'
+        return b'\x93NUMPY\x01\x00' + len(header).to_bytes(2, 'little') + header.encode('latin1')
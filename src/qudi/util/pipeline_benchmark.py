@@ -0,0 +1,274 @@
+# -*- coding: utf-8 -*-
+"""
+This file contains a benchmark of the data processing hot paths: decoding and histogramming of
+TTTR records, laser pulse extraction and analysis of the pulsed measurement and the trace
+processing of the time series reader. The TTTR records are either synthetic or replayed from a
+recorded PTU file. Run it, e.g. on the measurement computer while it is under load, with:
+
+    python -m qudi.util.pipeline_benchmark --mode 3 --count-rate 5e6
+    python -m qudi.util.pipeline_benchmark --ptu recorded.ptu
+
+For every stage, the throughput and the latency percentiles of the single calls (ticks) are
+reported, so regressions show up before a new version is deployed.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import argparse
+import time
+from logging import getLogger
+from types import SimpleNamespace
+import numpy as np
+
+from qudi.hardware.picoquant.tttr_decoder import PicoHarpTTTRDecoder
+from qudi.hardware.picoquant.tttr_histogram import TTTRHistogram
+from qudi.hardware.picoquant.tttr_correlator import TTTRCorrelator
+from qudi.hardware.picoquant.tttr_synthetic import SyntheticTTTRGenerator
+from qudi.hardware.picoquant.ptu_file import PTUReader
+
+__all__ = ['StageTimer', 'benchmark_tttr', 'benchmark_pulsed', 'benchmark_time_series',
+           'format_results']
+
+_logger = getLogger(__name__)
+
+
+class StageTimer:
+    """ Collects the duration and the number of processed items of every call (tick) of a stage.
+    """
+
+    def __init__(self, name, unit='records'):
+        self.name = name
+        self.unit = unit
+        self._durations = list()
+        self._items = 0
+
+    def time(self, func, *args, items=1):
+        """ Call func with args, timing the call.
+
+        @param callable func: function to time
+        @param int items: number of items processed by the call (e.g. records)
+
+        @return: the return value of func
+        """
+        start = time.perf_counter()
+        result = func(*args)
+        self._durations.append(time.perf_counter() - start)
+        self._items += items
+        return result
+
+    def result(self):
+        """ Summary of all timed calls.
+
+        @return dict: name, unit, number of ticks and items, total time in s, items/s, ns/item and
+                      the 50, 90, 99 and 100 percentiles of the tick latency in s
+        """
+        durations = np.asarray(self._durations)
+        total = float(durations.sum()) if durations.size > 0 else 0.0
+        if durations.size > 0:
+            p50, p90, p99, p100 = np.percentile(durations, [50, 90, 99, 100])
+        else:
+            p50 = p90 = p99 = p100 = np.nan
+        return {'name': self.name,
+                'unit': self.unit,
+                'ticks': durations.size,
+                'items': self._items,
+                'total_s': total,
+                'items_per_s': self._items / total if total > 0 else np.nan,
+                'ns_per_item': 1e9 * total / self._items if self._items > 0 else np.nan,
+                'latency_s': (p50, p90, p99, p100)}
+
+
+def _record_blocks(args):
+    """ Yield the decoder and the raw record blocks of a PTU file or of the synthetic generator. """
+    if args.ptu:
+        reader = PTUReader(args.ptu)
+        try:
+            decoder = reader.create_decoder()
+            for block in reader.blocks(args.block_size):
+                # copy, so the file access is not part of the timed stages
+                yield decoder, np.array(block)
+        finally:
+            reader.close()
+        return
+    generator = SyntheticTTTRGenerator(mode=args.mode,
+                                       count_rate=args.count_rate,
+                                       marker_rate=args.marker_rate,
+                                       gap_rate=args.gap_rate,
+                                       gap_length_s=args.gap_length,
+                                       seed=args.seed)
+    decoder = PicoHarpTTTRDecoder(mode=args.mode)
+    generated = 0
+    while generated < args.records:
+        photons = min(args.block_size, args.records - generated)
+        generated += photons
+        yield decoder, generator.generate(photons)
+
+
+def benchmark_tttr(args):
+    """ Decode the record blocks and histogram (T3) or correlate (T2) them.
+
+    @return list: StageTimer results
+    """
+    decode_timer = StageTimer('decode')
+    histogram_timer = StageTimer('histogram (T3)')
+    correlate_timer = StageTimer('correlate (T2)')
+    histogram = TTTRHistogram(bin_count=4096, rebin=1)
+    # 100 ns lag range in 100 ps bins on 4 ps time tags:
+    correlator = TTTRCorrelator(bin_width=25, max_lag=25000)
+    for decoder, records in _record_blocks(args):
+        events = decode_timer.time(decoder.decode, records, items=records.size)
+        if events.dtime is not None:
+            histogram_timer.time(histogram.add, events, items=records.size)
+        else:
+            correlate_timer.time(correlator.add, events, items=records.size)
+    results = [timer.result() for timer in (decode_timer, histogram_timer, correlate_timer)]
+    return [result for result in results if result['ticks'] > 0]
+
+
+def _pulsed_trace(number_of_lasers, laser_bins, period_bins, counts, rng):
+    """ Ungated time trace of a pulse sequence with rectangular laser pulses. """
+    trace = rng.poisson(counts / 10, number_of_lasers * period_bins)
+    for laser in range(number_of_lasers):
+        start = laser * period_bins + period_bins // 4
+        trace[start:start + laser_bins] += rng.poisson(counts, laser_bins)
+    return trace.astype(np.int64)
+
+
+def benchmark_pulsed(args):
+    """ Laser pulse extraction (ungated_conv_deriv) and analysis (analyse_mean_norm) of a
+    synthetic ungated time trace.
+
+    @return list: StageTimer results
+    """
+    from qudi.logic.pulsed.pulse_extraction_methods.basic_extraction_methods import \
+        BasicPulseExtractor
+    from qudi.logic.pulsed.pulsed_analysis_methods.basic_analysis_methods import \
+        BasicPulseAnalyzer
+
+    bin_width = 1e-9
+    number_of_lasers = args.lasers
+    logic = SimpleNamespace(fast_counter_settings={'bin_width': bin_width, 'is_gated': False},
+                            measurement_settings={'number_of_lasers': number_of_lasers},
+                            sampling_information=dict(),
+                            log=_logger)
+    extractor = BasicPulseExtractor(logic)
+    analyzer = BasicPulseAnalyzer(logic)
+    rng = np.random.default_rng(args.seed)
+    trace = _pulsed_trace(number_of_lasers, laser_bins=3000, period_bins=4000, counts=20, rng=rng)
+
+    extract_timer = StageTimer('ungated_conv_deriv', unit='bins')
+    analyse_timer = StageTimer('analyse_mean_norm', unit='lasers')
+    for _ in range(args.repeat):
+        result = extract_timer.time(extractor.ungated_conv_deriv, trace, items=trace.size)
+        analyse_timer.time(analyzer.analyse_mean_norm, result['laser_counts_arr'],
+                           items=number_of_lasers)
+    return [extract_timer.result(), analyse_timer.result()]
+
+
+def benchmark_time_series(args):
+    """ Trace processing of the time series reader (_process_trace_data) with a moving average.
+
+    @return list: StageTimer results
+    """
+    from qudi.interface.data_instream_interface import StreamChannelType
+    from qudi.logic.time_series_reader_logic import TimeSeriesReaderLogic, _TraceRingBuffer
+
+    channels = 4
+    trace_samples = 100000
+    block_samples = 1000
+    names = tuple('ch{0:d}'.format(channel) for channel in range(channels))
+    # the logic state used by _process_trace_data, without a running qudi:
+    logic = SimpleNamespace(oversampling_factor=1,
+                            active_channel_types={name: StreamChannelType.ANALOG
+                                                  for name in names},
+                            active_channel_names=names,
+                            averaged_channel_names=names,
+                            moving_average_width=9,
+                            sampling_rate=1e5,
+                            _calc_digital_freq=False,
+                            _data_recording_active=False,
+                            _recorder=None,
+                            _trace_data=_TraceRingBuffer(channels, trace_samples),
+                            _trace_data_averaged=_TraceRingBuffer(channels, trace_samples),
+                            log=_logger)
+    rng = np.random.default_rng(args.seed)
+    data = rng.random((channels, block_samples))
+    timer = StageTimer('_process_trace_data', unit='samples')
+    for _ in range(args.repeat * 100):
+        timer.time(TimeSeriesReaderLogic._process_trace_data, logic, data.copy(),
+                   items=block_samples)
+    return [timer.result()]
+
+
+def format_results(results):
+    """ Format the StageTimer results as a table.
+
+    @param list results: StageTimer results
+
+    @return str: the table
+    """
+    lines = ['{0:<22} {1:>8} {2:>12} {3:>10} {4:>14} {5:>10} {6:>10} {7:>10} {8:>10} {9:>10}'
+             ''.format('stage', 'unit', 'items', 'ticks', 'items/s', 'ns/item', 'p50 ms',
+                       'p90 ms', 'p99 ms', 'max ms')]
+    for result in results:
+        lines.append('{0:<22} {1:>8} {2:>12d} {3:>10d} {4:>14.4g} {5:>10.3g} {6:>10.3f} {7:>10.3f} '
+                     '{8:>10.3f} {9:>10.3f}'.format(result['name'],
+                                                    result['unit'],
+                                                    result['items'],
+                                                    result['ticks'],
+                                                    result['items_per_s'],
+                                                    result['ns_per_item'],
+                                                    *[1e3 * t for t in result['latency_s']]))
+    return '\n'.join(lines)
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='Benchmark the qudi data processing hot paths.')
+    parser.add_argument('--stages', nargs='+', default=['tttr', 'pulsed', 'time_series'],
+                        choices=['tttr', 'pulsed', 'time_series'], help='benchmarks to run')
+    parser.add_argument('--ptu', default=None, help='replay the records of this PTU file')
+    parser.add_argument('--mode', type=int, default=3, choices=[2, 3],
+                        help='TTTR mode of the synthetic records')
+    parser.add_argument('--records', type=int, default=10000000,
+                        help='number of synthetic photon records')
+    parser.add_argument('--block-size', type=int, default=131072,
+                        help='records per block (default: TTREADMAX)')
+    parser.add_argument('--count-rate', type=float, default=1e6, help='photon rate in 1/s')
+    parser.add_argument('--marker-rate', type=float, default=0.0, help='marker rate in 1/s')
+    parser.add_argument('--gap-rate', type=float, default=0.0,
+                        help='rate of gaps without photons in 1/s')
+    parser.add_argument('--gap-length', type=float, default=0.0, help='gap length in s')
+    parser.add_argument('--lasers', type=int, default=100,
+                        help='laser pulses of the synthetic pulsed trace')
+    parser.add_argument('--repeat', type=int, default=20,
+                        help='repetitions of the pulsed and time series stages')
+    parser.add_argument('--seed', type=int, default=None, help='random seed')
+    args = parser.parse_args(argv)
+
+    results = list()
+    if 'tttr' in args.stages:
+        results.extend(benchmark_tttr(args))
+    if 'pulsed' in args.stages:
+        results.extend(benchmark_pulsed(args))
+    if 'time_series' in args.stages:
+        results.extend(benchmark_time_series(args))
+    print(format_results(results))
+    return results
+
+
+if __name__ == '__main__':
+    main()
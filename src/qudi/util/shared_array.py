@@ -0,0 +1,293 @@
+# -*- coding: utf-8 -*-
+
+"""
+This file contains a shared memory transport of numpy arrays from the module producing them (e.g.
+the pulsed measurement logic) to consumers in other processes on the same computer (e.g. a GUI
+connected to a remote logic module). The consumers map the same memory region, so a data update
+costs one local copy instead of serializing every array over the remote connection.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import os
+from multiprocessing import shared_memory, resource_tracker
+import numpy as np
+
+__all__ = ['SharedArrayPublisher', 'SharedArrayReader']
+
+# segments created by publishers of this process, see SharedArrayReader.__init__
+_own_segments = set()
+
+
+class _SegmentLayout:
+    """ Memory layout of a segment: a header of uint64 words, the array names and the array data.
+
+    Header words:
+        0: sequence number of the seqlock, odd while the publisher is writing
+        1: closed flag, set when the publisher moved to a larger segment or was closed
+        2: number of arrays
+        3: reserved
+    followed by one slot per array: data offset, number of bytes, number of dimensions, dtype
+    string (packed into 8 bytes) and the shape (MAX_DIMS words).
+    """
+    MAX_ARRAYS = 8
+    MAX_DIMS = 4
+    NAME_BYTES = 32
+    ALIGNMENT = 64
+    HEADER_WORDS = 4
+    SLOT_WORDS = 4 + MAX_DIMS
+    NAMES_OFFSET = 8 * (HEADER_WORDS + MAX_ARRAYS * SLOT_WORDS)
+    DATA_OFFSET = -(-(NAMES_OFFSET + MAX_ARRAYS * NAME_BYTES) // ALIGNMENT) * ALIGNMENT
+
+    @classmethod
+    def header(cls, shm):
+        return np.ndarray(cls.HEADER_WORDS + cls.MAX_ARRAYS * cls.SLOT_WORDS, dtype=np.uint64,
+                          buffer=shm.buf)
+
+    @classmethod
+    def names(cls, shm):
+        return np.ndarray((cls.MAX_ARRAYS, cls.NAME_BYTES), dtype=np.uint8, buffer=shm.buf,
+                          offset=cls.NAMES_OFFSET)
+
+    @classmethod
+    def slot(cls, header, index):
+        start = cls.HEADER_WORDS + index * cls.SLOT_WORDS
+        return header[start:start + cls.SLOT_WORDS]
+
+    @staticmethod
+    def pack_dtype(dtype):
+        return np.frombuffer(np.dtype(dtype).str.encode().ljust(8, b'\0'), dtype=np.uint64)[0]
+
+    @staticmethod
+    def unpack_dtype(word):
+        return np.dtype(np.uint64(word).tobytes().rstrip(b'\0').decode())
+
+
+class SharedArrayPublisher:
+    """ Owner of a shared memory segment holding the newest version of a fixed set of named arrays.
+
+    Every publish() writes all arrays under a seqlock: the sequence number in the header is odd
+    while the arrays are written and is incremented to the next even number afterwards, so the
+    version of the data is the sequence number divided by 2. Readers check the sequence number
+    before and after reading and retry if it changed, the publisher never waits for readers.
+
+    The shapes and dtypes of the arrays may change from one version to the next. If the arrays do
+    not fit into the segment anymore, a segment of twice the size is created and the old one is
+    marked closed, so the readers know they have to attach to the new name.
+    """
+
+    def __init__(self, names, capacity=1 << 20):
+        """
+        @param iterable names: names of the arrays (at most 8, each at most 32 characters)
+        @param int capacity: optional, initial number of bytes available for the array data
+        """
+        names = tuple(str(name) for name in names)
+        if len(names) > _SegmentLayout.MAX_ARRAYS:
+            raise ValueError('SharedArrayPublisher supports at most {0:d} arrays.'
+                             ''.format(_SegmentLayout.MAX_ARRAYS))
+        if any(len(name.encode()) > _SegmentLayout.NAME_BYTES for name in names):
+            raise ValueError('SharedArrayPublisher array names must not exceed {0:d} bytes.'
+                             ''.format(_SegmentLayout.NAME_BYTES))
+        self._names = names
+        self._sequence = 0
+        self._shm = None
+        self._header = None
+        self._allocate(int(capacity))
+
+    @property
+    def name(self):
+        """ Name of the current shared memory segment, to be passed to SharedArrayReader. """
+        return None if self._shm is None else self._shm.name
+
+    @property
+    def version(self):
+        """ Version of the published data, 0 before the first publish(). """
+        return self._sequence // 2
+
+    @property
+    def capacity(self):
+        return 0 if self._shm is None else self._shm.size - _SegmentLayout.DATA_OFFSET
+
+    def _allocate(self, capacity):
+        shm = shared_memory.SharedMemory(create=True,
+                                         size=_SegmentLayout.DATA_OFFSET + max(capacity, 1))
+        _own_segments.add(shm.name)
+        header = _SegmentLayout.header(shm)
+        header[:] = 0
+        # a new segment continues with the version of the old one
+        header[0] = self._sequence
+        header[2] = len(self._names)
+        names = _SegmentLayout.names(shm)
+        names[...] = 0
+        for index, name in enumerate(self._names):
+            encoded = name.encode()
+            names[index, :len(encoded)] = np.frombuffer(encoded, dtype=np.uint8)
+        self._release()
+        self._shm = shm
+        self._header = header
+
+    def _release(self):
+        """ Mark the current segment closed and free it. Attached readers keep their mapping. """
+        if self._shm is None:
+            return
+        self._header[1] = 1
+        self._header = None
+        shm = self._shm
+        self._shm = None
+        shm.close()
+        shm.unlink()
+        _own_segments.discard(shm.name)
+
+    def publish(self, **arrays):
+        """ Write a new version of the arrays.
+
+        @param arrays: numpy arrays by name, missing names are published as empty arrays
+
+        @return int: the new version
+        """
+        data = list()
+        offset = 0
+        for name in self._names:
+            array = np.ascontiguousarray(arrays.get(name, np.empty(0)))
+            if array.ndim > _SegmentLayout.MAX_DIMS or array.dtype.hasobject:
+                raise ValueError('SharedArrayPublisher can not publish array "{0}" with {1:d} '
+                                 'dimensions and dtype {2}.'.format(name, array.ndim, array.dtype))
+            data.append((offset, array))
+            offset += -(-array.nbytes // _SegmentLayout.ALIGNMENT) * _SegmentLayout.ALIGNMENT
+        if self._shm is None:
+            raise RuntimeError('SharedArrayPublisher is closed.')
+        if offset > self.capacity:
+            self._allocate(max(2 * self.capacity, offset))
+
+        header = self._header
+        buffer = self._shm.buf
+        self._sequence += 1
+        header[0] = self._sequence
+        for index, (offset, array) in enumerate(data):
+            slot = _SegmentLayout.slot(header, index)
+            slot[0] = offset
+            slot[1] = array.nbytes
+            slot[2] = array.ndim
+            slot[3] = _SegmentLayout.pack_dtype(array.dtype)
+            slot[4:] = 0
+            slot[4:4 + array.ndim] = array.shape
+            start = _SegmentLayout.DATA_OFFSET + offset
+            np.ndarray(array.shape, dtype=array.dtype, buffer=buffer, offset=start)[...] = array
+        self._sequence += 1
+        header[0] = self._sequence
+        return self._sequence // 2
+
+    def close(self):
+        self._release()
+
+
+class SharedArrayReader:
+    """ Maps the segment of a SharedArrayPublisher, possibly in another process.
+
+    read() copies a consistent version of all arrays out of the segment. read(copy=False) returns
+    views into the segment instead, which may be overwritten by the next publish(): check is_valid()
+    with the returned version after using them. Once the reader is closed (closed is True), the
+    publisher moved to a new segment and a new reader has to be created with its new name.
+    """
+
+    def __init__(self, name):
+        """
+        @param str name: name of the shared memory segment (SharedArrayPublisher.name)
+        """
+        self._shm = shared_memory.SharedMemory(name=name)
+        # Attaching registers the segment with the resource tracker of this process, which would
+        # unlink it when this process exits although the publisher still uses it.
+        if os.name == 'posix' and self._shm.name not in _own_segments:
+            try:
+                resource_tracker.unregister(self._shm._name, 'shared_memory')
+            except Exception:
+                pass
+        self._header = _SegmentLayout.header(self._shm)
+        names = _SegmentLayout.names(self._shm)
+        self._names = tuple(names[index].tobytes().rstrip(b'\0').decode()
+                            for index in range(int(self._header[2])))
+
+    @property
+    def name(self):
+        return self._shm.name
+
+    @property
+    def names(self):
+        return self._names
+
+    @property
+    def closed(self):
+        """ True if the publisher does not write to this segment anymore. """
+        return self._header is None or int(self._header[1]) != 0
+
+    @property
+    def version(self):
+        """ Version of the data in the segment (odd sequence numbers are rounded down). """
+        return int(self._header[0]) // 2
+
+    def is_valid(self, version):
+        """ Check if the segment still holds the given version, i.e. views of it are consistent.
+
+        @param int version: version returned by read()
+
+        @return bool: True if no publish() started since the version was written
+        """
+        return int(self._header[0]) == 2 * version
+
+    def read(self, copy=True, retries=100):
+        """ Read the newest consistent version of all arrays.
+
+        @param bool copy: optional, return copies of the arrays (True) or views into the segment
+        @param int retries: optional, number of attempts while the publisher is writing
+
+        @return tuple(int, dict): version and the arrays by name, (-1, None) if the reader is closed
+                                  or no consistent version could be read
+        """
+        header = self._header
+        buffer = self._shm.buf
+        for _ in range(retries):
+            if self.closed:
+                return -1, None
+            sequence = int(header[0])
+            if sequence % 2 != 0:
+                continue
+            arrays = dict()
+            for index, name in enumerate(self._names):
+                slot = [int(word) for word in _SegmentLayout.slot(header, index)]
+                ndim = slot[2]
+                try:
+                    array = np.ndarray(tuple(slot[4:4 + ndim]),
+                                       dtype=_SegmentLayout.unpack_dtype(slot[3]),
+                                       buffer=buffer,
+                                       offset=_SegmentLayout.DATA_OFFSET + slot[0])
+                except (TypeError, ValueError):
+                    # torn slot of a concurrent publish(), detected by the sequence check below
+                    break
+                arrays[name] = array.copy() if copy else array
+            if int(header[0]) == sequence and len(arrays) == len(self._names):
+                return sequence // 2, arrays
+        return -1, None
+
+    def close(self):
+        if self._header is None:
+            return
+        self._header = None
+        try:
+            self._shm.close()
+        except BufferError:
+            # views returned by read(copy=False) are still alive, the mapping is released with them
+            pass
@@ -0,0 +1,112 @@
+# -*- coding: utf-8 -*-
+
+"""
+This file contains low-overhead latency statistics of the processing stages of a data pipeline,
+e.g. decoding, extraction and analysis.
+
+Copyright (c) 2021, the qudi developers. See the AUTHORS.md file at the top-level directory of this
+distribution and on <https://github.com/Ulm-IQO/qudi-iqo-modules/>
+
+This file is part of qudi.
+
+Qudi is free software: you can redistribute it and/or modify it under the terms of
+the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+Qudi is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along with qudi.
+If not, see <https://www.gnu.org/licenses/>.
+"""
+
+import time
+
+__all__ = ['StageLatency', 'StageMetrics']
+
+
+class StageLatency:
+    """ Running latency statistics of a single processing stage.
+
+    Only the thread running the stage may call record(), so no lock is needed: every field is a
+    single Python object assignment. A reader in another thread may see the fields of two
+    consecutive records mixed, which is irrelevant for monitoring.
+    """
+    __slots__ = ('calls', 'items', 'total_s', 'max_s', 'last_s')
+
+    def __init__(self):
+        self.reset()
+
+    def reset(self):
+        self.calls = 0
+        self.items = 0
+        self.total_s = 0.0
+        self.max_s = 0.0
+        self.last_s = 0.0
+
+    def record(self, duration_s, items=0):
+        """ Add a single call of the stage.
+
+        @param float duration_s: duration of the call in seconds
+        @param int items: optional, number of items (e.g. records) processed by the call
+        """
+        self.calls += 1
+        self.items += items
+        self.total_s += duration_s
+        self.last_s = duration_s
+        if duration_s > self.max_s:
+            self.max_s = duration_s
+
+    def to_dict(self):
+        """
+        @return dict: number of calls and items, total, mean, maximum and last duration in seconds
+        """
+        calls = self.calls
+        total_s = self.total_s
+        return {'calls': calls,
+                'items': self.items,
+                'total_s': total_s,
+                'mean_s': total_s / calls if calls > 0 else 0.0,
+                'max_s': self.max_s,
+                'last_s': self.last_s}
+
+
+class StageMetrics:
+    """ StageLatency statistics of a fixed set of named stages.
+
+    Time a stage with:
+
+        start = time.perf_counter()
+        ...
+        metrics.record('decode', start, items=records.size)
+    """
+
+    def __init__(self, stages):
+        """
+        @param iterable stages: names of the stages
+        """
+        self._stages = {name: StageLatency() for name in stages}
+
+    @property
+    def stages(self):
+        return tuple(self._stages)
+
+    def record(self, stage, start, items=0):
+        """ Add a call of a stage which started at start (time.perf_counter) and ended now.
+
+        @param str stage: name of the stage
+        @param float start: time.perf_counter() at the start of the call
+        @param int items: optional, number of items processed by the call
+        """
+        self._stages[stage].record(time.perf_counter() - start, items)
+
+    def reset(self):
+        for latency in self._stages.values():
+            latency.reset()
+
+    def snapshot(self):
+        """
+        @return dict: StageLatency.to_dict() of every stage
+        """
+        return {name: latency.to_dict() for name, latency in self._stages.items()}